@@ -0,0 +1,271 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+constexpr std::size_t CACHE_LINE_SIZE = 64;
+
+// Where component storage gets its memory from. An EntityManager passes its
+// allocator to every container and archetype it creates. Allocators are not
+// thread-safe; storage only allocates during structural changes, which are
+// single-threaded anyway.
+class Allocator
+{
+public:
+	virtual ~Allocator() = default;
+
+	// alignment must be a power of two.
+	virtual void* Allocate(std::size_t size, std::size_t alignment) = 0;
+	virtual void Deallocate(void* memory, std::size_t size, std::size_t alignment) = 0;
+};
+
+// The global heap, via aligned operator new.
+class HeapAllocator final : public Allocator
+{
+public:
+	inline void* Allocate(std::size_t size, std::size_t alignment) override
+	{
+		return ::operator new(size, std::align_val_t{ alignment });
+	}
+
+	inline void Deallocate(void* memory, std::size_t, std::size_t alignment) override
+	{
+		::operator delete(memory, std::align_val_t{ alignment });
+	}
+};
+
+inline Allocator& DefaultAllocator()
+{
+	static HeapAllocator heap;
+	return heap;
+}
+
+// Recycles fixed-size blocks - such as column pages and archetype chunks -
+// through a free list, fetching them from upstream in slabs. Requests larger
+// than a block go straight to upstream.
+class PoolAllocator final : public Allocator
+{
+public:
+	explicit PoolAllocator(std::size_t blockSize, std::size_t blocksPerSlab = 64,
+						   Allocator& upstream = DefaultAllocator());
+	~PoolAllocator();
+
+	PoolAllocator(const PoolAllocator&) = delete;
+	PoolAllocator& operator=(const PoolAllocator&) = delete;
+
+	void* Allocate(std::size_t size, std::size_t alignment) override;
+	void Deallocate(void* memory, std::size_t size, std::size_t alignment) override;
+
+	inline std::size_t BlockSize() const { return _blockSize; }
+	inline std::size_t FreeBlockCount() const { return _freeBlocks.size(); }
+
+private:
+	inline bool Fits(std::size_t size, std::size_t alignment) const
+	{
+		return size <= _blockSize && alignment <= CACHE_LINE_SIZE;
+	}
+
+	std::size_t _blockSize;
+	std::size_t _blocksPerSlab;
+	Allocator& _upstream;
+	std::vector<void*> _slabs;
+	std::vector<void*> _freeBlocks;
+};
+
+inline PoolAllocator::PoolAllocator(std::size_t blockSize, std::size_t blocksPerSlab, Allocator& upstream)
+	: _blockSize{ (std::max(blockSize, std::size_t(1)) + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1) },
+	  _blocksPerSlab{ std::max(blocksPerSlab, std::size_t(1)) },
+	  _upstream{ upstream }
+{
+}
+
+inline PoolAllocator::~PoolAllocator()
+{
+	for (auto slab : _slabs)
+	{
+		_upstream.Deallocate(slab, _blockSize * _blocksPerSlab, CACHE_LINE_SIZE);
+	}
+}
+
+inline void* PoolAllocator::Allocate(std::size_t size, std::size_t alignment)
+{
+	if (!Fits(size, alignment))
+	{
+		return _upstream.Allocate(size, alignment);
+	}
+
+	if (_freeBlocks.empty())
+	{
+		auto slab = static_cast<std::byte*>(_upstream.Allocate(_blockSize * _blocksPerSlab, CACHE_LINE_SIZE));
+		_slabs.push_back(slab);
+
+		for (auto i = _blocksPerSlab; i > 0; --i)
+		{
+			_freeBlocks.push_back(slab + (i - 1) * _blockSize);
+		}
+	}
+
+	auto block = _freeBlocks.back();
+	_freeBlocks.pop_back();
+	return block;
+}
+
+inline void PoolAllocator::Deallocate(void* memory, std::size_t size, std::size_t alignment)
+{
+	if (!Fits(size, alignment))
+	{
+		_upstream.Deallocate(memory, size, alignment);
+		return;
+	}
+
+	_freeBlocks.push_back(memory);
+}
+
+// Carves allocations out of large mappings that are aligned to 2 MiB and
+// advised as transparent huge pages, so that big worlds need far fewer TLB
+// entries. Freed memory is kept for later requests of the same size, which
+// is what columns and chunks ask for. Only Linux gets huge pages; elsewhere
+// the regions come from upstream.
+class HugePageAllocator final : public Allocator
+{
+public:
+	static constexpr std::size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+	static constexpr std::size_t DEFAULT_REGION_SIZE = 32 * HUGE_PAGE_SIZE;
+
+	explicit HugePageAllocator(std::size_t regionSize = DEFAULT_REGION_SIZE, Allocator& upstream = DefaultAllocator());
+	~HugePageAllocator();
+
+	HugePageAllocator(const HugePageAllocator&) = delete;
+	HugePageAllocator& operator=(const HugePageAllocator&) = delete;
+
+	void* Allocate(std::size_t size, std::size_t alignment) override;
+	void Deallocate(void* memory, std::size_t size, std::size_t alignment) override;
+
+	inline std::size_t RegionCount() const { return _regions.size(); }
+
+private:
+	struct Region
+	{
+		std::byte* memory;
+		std::size_t size;
+	};
+
+	static inline std::size_t RoundUp(std::size_t value, std::size_t alignment)
+	{
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+
+	Region Map(std::size_t size);
+	void Unmap(const Region& region);
+
+	std::size_t _regionSize;
+	Allocator& _upstream;
+	std::vector<Region> _regions;
+	std::size_t _used = 0;
+	std::unordered_map<std::size_t, std::vector<void*>> _freeBySize;
+};
+
+inline HugePageAllocator::HugePageAllocator(std::size_t regionSize, Allocator& upstream)
+	: _regionSize{ RoundUp(std::max(regionSize, HUGE_PAGE_SIZE), HUGE_PAGE_SIZE) }, _upstream{ upstream }
+{
+}
+
+inline HugePageAllocator::~HugePageAllocator()
+{
+	for (const auto& region : _regions)
+	{
+		Unmap(region);
+	}
+}
+
+inline void* HugePageAllocator::Allocate(std::size_t size, std::size_t alignment)
+{
+	assert(alignment <= HUGE_PAGE_SIZE);
+	size = RoundUp(std::max(size, std::size_t(1)), std::max(alignment, CACHE_LINE_SIZE));
+
+	auto& reusable = _freeBySize[size];
+	if (!reusable.empty())
+	{
+		auto memory = reusable.back();
+		reusable.pop_back();
+		return memory;
+	}
+
+	if (!_regions.empty())
+	{
+		auto& current = _regions.back();
+		auto offset = RoundUp(_used, alignment);
+		if (offset + size <= current.size)
+		{
+			_used = offset + size;
+			return current.memory + offset;
+		}
+	}
+
+	// Requests bigger than a region get a mapping of their own; it goes in
+	// front of the current region so that one keeps being filled.
+	auto region = Map(std::max(_regionSize, RoundUp(size, HUGE_PAGE_SIZE)));
+	if (region.size > _regionSize && !_regions.empty())
+	{
+		_regions.insert(_regions.end() - 1, region);
+		return region.memory;
+	}
+
+	_regions.push_back(region);
+	_used = size;
+	return region.memory;
+}
+
+inline void HugePageAllocator::Deallocate(void* memory, std::size_t size, std::size_t alignment)
+{
+	size = RoundUp(std::max(size, std::size_t(1)), std::max(alignment, CACHE_LINE_SIZE));
+	_freeBySize[size].push_back(memory);
+}
+
+inline HugePageAllocator::Region HugePageAllocator::Map(std::size_t size)
+{
+#if defined(__linux__)
+	// Over-map by a huge page and trim, since mmap only guarantees 4 KiB alignment.
+	auto mapped = mmap(nullptr, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mapped == MAP_FAILED)
+	{
+		throw std::bad_alloc();
+	}
+
+	auto begin = reinterpret_cast<std::uintptr_t>(mapped);
+	auto aligned = RoundUp(begin, HUGE_PAGE_SIZE);
+	if (aligned > begin)
+	{
+		munmap(mapped, aligned - begin);
+	}
+	if (aligned + size < begin + size + HUGE_PAGE_SIZE)
+	{
+		munmap(reinterpret_cast<void*>(aligned + size), begin + HUGE_PAGE_SIZE - aligned);
+	}
+
+#if defined(MADV_HUGEPAGE)
+	madvise(reinterpret_cast<void*>(aligned), size, MADV_HUGEPAGE);
+#endif
+	return Region{ reinterpret_cast<std::byte*>(aligned), size };
+#else
+	return Region{ static_cast<std::byte*>(_upstream.Allocate(size, HUGE_PAGE_SIZE)), size };
+#endif
+}
+
+inline void HugePageAllocator::Unmap(const Region& region)
+{
+#if defined(__linux__)
+	munmap(region.memory, region.size);
+#else
+	_upstream.Deallocate(region.memory, region.size, HUGE_PAGE_SIZE);
+#endif
+}
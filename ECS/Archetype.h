@@ -0,0 +1,554 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Component.h"
+
+constexpr std::size_t ARCHETYPE_CHUNK_SIZE = 16 * 1024;
+
+enum class StorageMode
+{
+	Columns,		// one ComponentContainer<T> per type, indexed by entity
+	Archetypes		// entities grouped by signature into packed chunks
+};
+
+// Type-erased lifetime operations, so that archetypes can move components
+// between chunks without knowing their types.
+struct ComponentInfo
+{
+	std::size_t size = 0;
+	void (*moveConstruct)(void* destination, void* source) = nullptr;
+	void (*destroy)(void* component) = nullptr;
+};
+
+template <typename T> ComponentInfo MakeComponentInfo()
+{
+	static_assert(alignof(T) <= CACHE_LINE_SIZE, "Component alignment exceeds chunk column alignment");
+
+	ComponentInfo info;
+	info.size = sizeof(T);
+	info.moveConstruct = [](void* destination, void* source)
+	{
+		new (destination) T(std::move(*static_cast<T*>(source)));
+	};
+	info.destroy = [](void* component)
+	{
+		static_cast<T*>(component)->~T();
+	};
+	return info;
+}
+
+// All entities sharing one signature. Rows are kept packed: chunks are
+// filled front to back and a removed row is refilled from the last one.
+// Inside a chunk every column starts on its own cache line.
+class Archetype
+{
+public:
+	Archetype(const EntityFilter& signature, const std::array<ComponentInfo, MAX_COMPONENT_COUNT>& infos,
+			  Allocator& allocator, const ChangeVersion* clock = &NO_VERSION);
+	~Archetype();
+
+	Archetype(const Archetype&) = delete;
+	Archetype& operator=(const Archetype&) = delete;
+
+	inline const EntityFilter& Signature() const { return _signature; }
+	inline std::size_t Count() const { return _count; }
+	inline std::size_t ChunkCount() const { return _chunks.size(); }
+	inline std::size_t ChunkCapacity() const { return _chunkCapacity; }
+	std::size_t CountInChunk(std::size_t chunk) const;
+
+	void* Get(ComponentID id, std::size_t row) const;
+	void* Components(ComponentID id, std::size_t chunk) const;
+	EntityIndex* Entities(std::size_t chunk) const;
+
+	std::size_t Allocate(EntityIndex entity);
+	bool Remove(std::size_t row, OUT EntityIndex& movedEntity);
+	// Gives row another entity index, which counts as writing the row.
+	void Renumber(std::size_t row, EntityIndex entity);
+
+	// Change versions are kept per chunk and column. Any row written into a
+	// chunk counts as a change and an addition of all its components, so
+	// filters built on them may report more than what really changed.
+	ChangeVersion ChangedVersion(ComponentID id, std::size_t chunk) const;
+	ChangeVersion AddedVersion(ComponentID id, std::size_t chunk) const;
+	// Const like Components, which hands out mutable columns of a const archetype.
+	void MarkChanged(ComponentID id, std::size_t chunk) const;
+
+private:
+	struct Column
+	{
+		std::size_t offset;
+		ComponentInfo info;
+	};
+
+	inline void* At(const Column& column, std::size_t row) const
+	{
+		return _chunks[row / _chunkCapacity] + column.offset + (row % _chunkCapacity) * column.info.size;
+	}
+
+	void ComputeLayout();
+	void MarkRowWritten(std::size_t row);
+
+	EntityFilter _signature;
+	Allocator& _allocator;
+	const ChangeVersion* _clock;
+	std::vector<Column> _columns;
+	std::array<std::size_t, MAX_COMPONENT_COUNT> _columnByComponent;
+	std::size_t _chunkCapacity = 0;
+	std::size_t _chunkSize = ARCHETYPE_CHUNK_SIZE;
+	std::size_t _count = 0;
+	std::vector<std::byte*> _chunks;
+
+	// Per chunk, per column: last change, then last addition.
+	mutable std::vector<ChangeVersion> _versions;
+};
+
+// Read/write access to the columns of a single chunk.
+class ChunkView
+{
+public:
+	ChunkView(const Archetype& archetype, std::size_t chunk) : _archetype{ &archetype }, _chunk{ chunk } {}
+
+	inline std::size_t Count() const { return _archetype->CountInChunk(_chunk); }
+	inline std::size_t Capacity() const { return _archetype->ChunkCapacity(); }
+	inline const EntityIndex* Entities() const { return _archetype->Entities(_chunk); }
+	// Asking for non-const components marks the column of this chunk as changed.
+	template <typename T> T* Components() const;
+
+	inline ChangeVersion ChangedVersion(ComponentID id) const { return _archetype->ChangedVersion(id, _chunk); }
+	inline ChangeVersion AddedVersion(ComponentID id) const { return _archetype->AddedVersion(id, _chunk); }
+
+private:
+	const Archetype* _archetype;
+	std::size_t _chunk;
+};
+
+template <typename T> T* ChunkView::Components() const
+{
+	static_assert(!IsTag<std::remove_const_t<T>>, "Tags have no column");
+	static ComponentID id = GetComponentID<T>();
+
+	if constexpr (!std::is_const_v<T>)
+	{
+		_archetype->MarkChanged(id, _chunk);
+	}
+
+	return static_cast<T*>(_archetype->Components(id, _chunk));
+}
+
+// Maps entities to their archetype row and moves them between archetypes
+// whenever their signature changes.
+class ArchetypeStorage
+{
+public:
+	explicit ArchetypeStorage(Allocator& allocator = DefaultAllocator()) : _allocator{ allocator } {}
+
+	// The version clock handed to every archetype; set before the first one is created.
+	inline void SetClock(const ChangeVersion* clock) { _clock = clock; }
+
+	template <typename T> void Register();
+	void AddNew(std::size_t count);
+
+	template <typename T> T* Find(EntityIndex entity) const;
+	// Both move the entity to the archetype for signature if it lacks the
+	// component. Set assigns component to an existing one, Emplace constructs
+	// it from args in place of the old one.
+	template <typename T> void Set(EntityIndex entity, const EntityFilter& signature, T&& component);
+	template <typename T, typename ... Args> void Emplace(EntityIndex entity, const EntityFilter& signature, Args&&... args);
+	void Move(EntityIndex entity, const EntityFilter& signature);
+	void Remove(EntityIndex entity);
+	// Compaction support: exchanges where two entity indices live, and drops
+	// every index from count on, none of which may be in an archetype.
+	void Swap(EntityIndex a, EntityIndex b);
+	void Truncate(std::size_t count);
+
+	// Places entities that are in no archetype yet into the one for signature.
+	// construct(i, archetype, row) must construct all components of row.
+	template <typename Construct>
+	void Insert(const EntityIndex* entities, std::size_t count, const EntityFilter& signature, Construct&& construct);
+
+	template <typename Func> void ForEachArchetype(const EntityFilter& filter, Func&& func) const;
+	inline std::size_t ComponentSize(ComponentID id) const { return _infos[id].size; }
+
+private:
+	struct EntityLocation
+	{
+		Archetype* archetype = nullptr;
+		std::size_t row = 0;
+	};
+
+	Archetype& GetOrCreateArchetype(const EntityFilter& signature);
+	void RemoveFromArchetype(const EntityLocation& location);
+
+	Allocator& _allocator;
+	const ChangeVersion* _clock = &NO_VERSION;
+	std::array<ComponentInfo, MAX_COMPONENT_COUNT> _infos;
+	EntityFilter _stored;
+	std::vector<std::unique_ptr<Archetype>> _archetypes;
+	std::unordered_map<EntityFilter, Archetype*> _archetypeBySignature;
+	std::vector<EntityLocation> _locations;
+};
+
+inline Archetype::Archetype(const EntityFilter& signature,
+							const std::array<ComponentInfo, MAX_COMPONENT_COUNT>& infos, Allocator& allocator,
+							const ChangeVersion* clock)
+	: _signature{ signature }, _allocator{ allocator }, _clock{ clock }
+{
+	_columnByComponent.fill(MAX_COMPONENT_COUNT);
+
+	// Tags, and anything else never registered, have no column.
+	for (ComponentID id = 0; id < MAX_COMPONENT_COUNT; ++id)
+	{
+		if (signature[id] && infos[id].moveConstruct != nullptr)
+		{
+			_columnByComponent[id] = _columns.size();
+			_columns.push_back(Column{ 0, infos[id] });
+		}
+	}
+
+	ComputeLayout();
+}
+
+inline Archetype::~Archetype()
+{
+	for (std::size_t row = 0; row < _count; ++row)
+	{
+		for (const auto& column : _columns)
+		{
+			column.info.destroy(At(column, row));
+		}
+	}
+
+	for (auto chunk : _chunks)
+	{
+		_allocator.Deallocate(chunk, _chunkSize, CACHE_LINE_SIZE);
+	}
+}
+
+inline void Archetype::ComputeLayout()
+{
+	auto alignUp = [](std::size_t value) { return (value + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1); };
+
+	auto rowSize = sizeof(EntityIndex);
+	for (const auto& column : _columns)
+	{
+		rowSize += column.info.size;
+	}
+
+	// Components too large for a single default chunk get a chunk sized for one row.
+	auto padding = (_columns.size() + 1) * CACHE_LINE_SIZE;
+	if (rowSize + padding > _chunkSize)
+	{
+		_chunkSize = alignUp(rowSize + padding);
+	}
+
+	for (_chunkCapacity = (_chunkSize - padding) / rowSize; ; --_chunkCapacity)
+	{
+		auto end = alignUp(sizeof(EntityIndex) * _chunkCapacity);
+		for (auto& column : _columns)
+		{
+			column.offset = end;
+			end = alignUp(end + column.info.size * _chunkCapacity);
+		}
+
+		if (end <= _chunkSize)
+		{
+			break;
+		}
+	}
+
+	assert(_chunkCapacity > 0);
+}
+
+inline std::size_t Archetype::CountInChunk(std::size_t chunk) const
+{
+	auto first = chunk * _chunkCapacity;
+	return _count <= first ? 0 : std::min(_count - first, _chunkCapacity);
+}
+
+inline void* Archetype::Get(ComponentID id, std::size_t row) const
+{
+	return At(_columns[_columnByComponent[id]], row);
+}
+
+inline void* Archetype::Components(ComponentID id, std::size_t chunk) const
+{
+	return _chunks[chunk] + _columns[_columnByComponent[id]].offset;
+}
+
+inline EntityIndex* Archetype::Entities(std::size_t chunk) const
+{
+	return reinterpret_cast<EntityIndex*>(_chunks[chunk]);
+}
+
+// Returns the new row; its component memory is left uninitialized for the caller.
+inline std::size_t Archetype::Allocate(EntityIndex entity)
+{
+	auto row = _count;
+
+	if (row / _chunkCapacity == _chunks.size())
+	{
+		_chunks.push_back(static_cast<std::byte*>(_allocator.Allocate(_chunkSize, CACHE_LINE_SIZE)));
+		_versions.resize(_chunks.size() * _columns.size() * 2, NO_VERSION);
+	}
+
+	Entities(row / _chunkCapacity)[row % _chunkCapacity] = entity;
+	MarkRowWritten(row);
+	++_count;
+	return row;
+}
+
+// Destroys the components in row and fills the hole with the last row.
+// Returns true if an entity was moved, which is then written to movedEntity.
+inline bool Archetype::Remove(std::size_t row, OUT EntityIndex& movedEntity)
+{
+	auto last = _count - 1;
+
+	for (const auto& column : _columns)
+	{
+		column.info.destroy(At(column, row));
+	}
+
+	auto moved = row != last;
+	if (moved)
+	{
+		for (const auto& column : _columns)
+		{
+			column.info.moveConstruct(At(column, row), At(column, last));
+			column.info.destroy(At(column, last));
+		}
+
+		movedEntity = Entities(last / _chunkCapacity)[last % _chunkCapacity];
+		Entities(row / _chunkCapacity)[row % _chunkCapacity] = movedEntity;
+		MarkRowWritten(row);
+	}
+
+	--_count;
+
+	// Keep one empty chunk around, so that entities flickering across a
+	// chunk boundary don't allocate and free on every change.
+	auto usedChunks = (_count + _chunkCapacity - 1) / _chunkCapacity;
+	while (_chunks.size() > usedChunks + 1)
+	{
+		_allocator.Deallocate(_chunks.back(), _chunkSize, CACHE_LINE_SIZE);
+		_chunks.pop_back();
+	}
+	_versions.resize(_chunks.size() * _columns.size() * 2);
+
+	return moved;
+}
+
+inline ChangeVersion Archetype::ChangedVersion(ComponentID id, std::size_t chunk) const
+{
+	return _versions[(chunk * _columns.size() + _columnByComponent[id]) * 2];
+}
+
+inline ChangeVersion Archetype::AddedVersion(ComponentID id, std::size_t chunk) const
+{
+	return _versions[(chunk * _columns.size() + _columnByComponent[id]) * 2 + 1];
+}
+
+inline void Archetype::MarkChanged(ComponentID id, std::size_t chunk) const
+{
+	_versions[(chunk * _columns.size() + _columnByComponent[id]) * 2] = *_clock;
+}
+
+inline void Archetype::Renumber(std::size_t row, EntityIndex entity)
+{
+	Entities(row / _chunkCapacity)[row % _chunkCapacity] = entity;
+	MarkRowWritten(row);
+}
+
+inline void Archetype::MarkRowWritten(std::size_t row)
+{
+	auto first = _versions.begin() + (row / _chunkCapacity) * _columns.size() * 2;
+	std::fill(first, first + _columns.size() * 2, *_clock);
+}
+
+template <typename T> void ArchetypeStorage::Register()
+{
+	static_assert(!IsTag<T>, "Tags have no column");
+	auto id = GetComponentID<T>();
+	_infos[id] = MakeComponentInfo<T>();
+	_stored.set(id);
+}
+
+inline void ArchetypeStorage::AddNew(std::size_t count)
+{
+	_locations.resize(_locations.size() + count);
+}
+
+template <typename T> T* ArchetypeStorage::Find(EntityIndex entity) const
+{
+	static ComponentID id = GetComponentID<T>();
+	const auto& location = _locations[entity];
+
+	if (location.archetype == nullptr || !location.archetype->Signature()[id])
+	{
+		return nullptr;
+	}
+
+	return static_cast<T*>(location.archetype->Get(id, location.row));
+}
+
+template <typename T> void ArchetypeStorage::Set(EntityIndex entity, const EntityFilter& signature, T&& component)
+{
+	using Component = std::decay_t<T>;
+	static ComponentID id = GetComponentID<Component>();
+
+	if constexpr (!IsTag<Component>)
+	{
+		if (auto existing = Find<Component>(entity))
+		{
+			*existing = std::forward<T>(component);
+			const auto& location = _locations[entity];
+			location.archetype->MarkChanged(id, location.row / location.archetype->ChunkCapacity());
+			return;
+		}
+	}
+
+	Emplace<Component>(entity, signature, std::forward<T>(component));
+}
+
+template <typename T, typename ... Args>
+void ArchetypeStorage::Emplace(EntityIndex entity, const EntityFilter& signature, Args&&... args)
+{
+	static ComponentID id = GetComponentID<T>();
+
+	auto location = _locations[entity];
+	auto present = location.archetype != nullptr && location.archetype->Signature()[id];
+	if (!present)
+	{
+		Move(entity, signature);
+		location = _locations[entity];
+	}
+
+	if constexpr (!IsTag<T>)
+	{
+		auto component = static_cast<T*>(location.archetype->Get(id, location.row));
+		if (present)
+		{
+			Reconstruct(*component, std::forward<Args>(args)...);
+			location.archetype->MarkChanged(id, location.row / location.archetype->ChunkCapacity());
+		}
+		else
+		{
+			new (component) T(std::forward<Args>(args)...);
+		}
+	}
+}
+
+// Moves the entity to the archetype for signature, carrying over all components
+// both archetypes share. Components that are new in signature are left
+// uninitialized and must be constructed by the caller.
+inline void ArchetypeStorage::Move(EntityIndex entity, const EntityFilter& signature)
+{
+	auto source = _locations[entity];
+	auto& target = GetOrCreateArchetype(signature);
+	auto row = target.Allocate(entity);
+
+	if (source.archetype != nullptr)
+	{
+		auto shared = source.archetype->Signature() & signature & _stored;
+		for (ComponentID id = 0; id < MAX_COMPONENT_COUNT; ++id)
+		{
+			if (shared[id])
+			{
+				_infos[id].moveConstruct(target.Get(id, row), source.archetype->Get(id, source.row));
+			}
+		}
+
+		RemoveFromArchetype(source);
+	}
+
+	_locations[entity] = EntityLocation{ &target, row };
+}
+
+inline void ArchetypeStorage::Remove(EntityIndex entity)
+{
+	auto& location = _locations[entity];
+
+	if (location.archetype != nullptr)
+	{
+		RemoveFromArchetype(location);
+		location = EntityLocation();
+	}
+}
+
+inline void ArchetypeStorage::Swap(EntityIndex a, EntityIndex b)
+{
+	std::swap(_locations[a], _locations[b]);
+
+	for (auto entity : { a, b })
+	{
+		const auto& location = _locations[entity];
+		if (location.archetype != nullptr)
+		{
+			location.archetype->Renumber(location.row, entity);
+		}
+	}
+}
+
+inline void ArchetypeStorage::Truncate(std::size_t count)
+{
+	_locations.resize(count);
+	_locations.shrink_to_fit();
+}
+
+template <typename Construct>
+void ArchetypeStorage::Insert(const EntityIndex* entities, std::size_t count, const EntityFilter& signature,
+							  Construct&& construct)
+{
+	auto& archetype = GetOrCreateArchetype(signature);
+
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		assert(_locations[entities[i]].archetype == nullptr);
+
+		auto row = archetype.Allocate(entities[i]);
+		construct(i, archetype, row);
+		_locations[entities[i]] = EntityLocation{ &archetype, row };
+	}
+}
+
+template <typename Func> void ArchetypeStorage::ForEachArchetype(const EntityFilter& filter, Func&& func) const
+{
+	for (const auto& archetype : _archetypes)
+	{
+		if (archetype->Count() > 0 && (archetype->Signature() & filter) == filter)
+		{
+			func(*archetype);
+		}
+	}
+}
+
+inline Archetype& ArchetypeStorage::GetOrCreateArchetype(const EntityFilter& signature)
+{
+	auto found = _archetypeBySignature.find(signature);
+	if (found != _archetypeBySignature.end())
+	{
+		return *found->second;
+	}
+
+	_archetypes.push_back(std::make_unique<Archetype>(signature, _infos, _allocator, _clock));
+	auto archetype = _archetypes.back().get();
+	_archetypeBySignature.emplace(signature, archetype);
+	return *archetype;
+}
+
+inline void ArchetypeStorage::RemoveFromArchetype(const EntityLocation& location)
+{
+	EntityIndex movedEntity;
+	if (location.archetype->Remove(location.row, OUT movedEntity))
+	{
+		_locations[movedEntity].row = location.row;
+	}
+}
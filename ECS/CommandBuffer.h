@@ -0,0 +1,260 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "ECS.h"
+#include "LinearArena.h"
+#include "ThreadPool.h"
+
+// An entity created through a CommandBuffer. It gets a real index when the
+// buffer is played back; CommandQueue::Resolve tells which one.
+struct PendingEntity
+{
+	std::uint32_t buffer;
+	std::uint32_t index;
+};
+
+// Structural changes recorded by one thread, to be applied later by its
+// CommandQueue. Components are moved into a linear arena until then. Only
+// reads the manager while recording, so any number of buffers can record
+// while systems iterate.
+class CommandBuffer
+{
+public:
+	CommandBuffer(const CommandBuffer&) = delete;
+	CommandBuffer& operator=(const CommandBuffer&) = delete;
+	~CommandBuffer() { Clear(); }
+
+	// origin orders the creation against other commands, see CommandQueue.
+	// It is usually the entity whose update spawns the new one.
+	PendingEntity CreateEntity(EntityIndex origin);
+	void DestroyEntity(EntityIndex entity);
+	template <typename T> void SetComponent(EntityIndex entity, T&& component);
+	template <typename T> void SetComponent(PendingEntity entity, T&& component);
+	template <typename T> void RemoveComponent(EntityIndex entity);
+
+	inline std::size_t CommandCount() const { return _commands.size(); }
+
+private:
+	friend class CommandQueue;
+
+	static constexpr std::uint32_t NOT_PENDING = static_cast<std::uint32_t>(-1);
+
+	enum class CommandType : std::uint8_t
+	{
+		Create,
+		Destroy,
+		Set,
+		Remove
+	};
+
+	struct Command
+	{
+		EntityIndex key;
+		CommandType type;
+		// Index into _pendingOrigins if the target is created by this buffer.
+		std::uint32_t pending;
+		EntityHandle target;
+		void (*apply)(EntityManager& manager, EntityIndex entity, void* component);
+		void (*destroy)(void* component);
+		void* component;
+	};
+
+	CommandBuffer(const EntityManager& manager, std::uint32_t index) : _manager{ manager }, _index{ index } {}
+
+	Command Targeting(EntityIndex entity, CommandType type) const;
+	Command Targeting(PendingEntity entity, CommandType type) const;
+	template <typename T> void RecordSet(Command command, T&& component);
+	void Clear();
+
+	const EntityManager& _manager;
+	std::uint32_t _index;
+	LinearArena _arena;
+	std::vector<Command> _commands;
+	std::vector<EntityIndex> _pendingOrigins;
+	std::vector<EntityHandle> _created;
+};
+
+inline PendingEntity CommandBuffer::CreateEntity(EntityIndex origin)
+{
+	auto index = static_cast<std::uint32_t>(_pendingOrigins.size());
+	_pendingOrigins.push_back(origin);
+
+	auto command = Targeting(PendingEntity{ _index, index }, CommandType::Create);
+	_commands.push_back(command);
+	return PendingEntity{ _index, index };
+}
+
+inline void CommandBuffer::DestroyEntity(EntityIndex entity)
+{
+	auto command = Targeting(entity, CommandType::Destroy);
+	command.apply = [](EntityManager& manager, EntityIndex entity, void*) { manager.DestroyEntity(entity); };
+	_commands.push_back(command);
+}
+
+template <typename T> void CommandBuffer::SetComponent(EntityIndex entity, T&& component)
+{
+	RecordSet(Targeting(entity, CommandType::Set), std::forward<T>(component));
+}
+
+template <typename T> void CommandBuffer::SetComponent(PendingEntity entity, T&& component)
+{
+	RecordSet(Targeting(entity, CommandType::Set), std::forward<T>(component));
+}
+
+template <typename T> void CommandBuffer::RemoveComponent(EntityIndex entity)
+{
+	auto command = Targeting(entity, CommandType::Remove);
+	command.apply = [](EntityManager& manager, EntityIndex entity, void*) { manager.RemoveComponent<T>(entity); };
+	_commands.push_back(command);
+}
+
+// The handle is taken now, so a command whose entity is destroyed before
+// playback reaches it is dropped instead of hitting a reused index.
+inline CommandBuffer::Command CommandBuffer::Targeting(EntityIndex entity, CommandType type) const
+{
+	assert(_manager.HasComponent<EntityState>(entity));
+	return Command{ entity, type, NOT_PENDING, _manager.GetHandle(entity), nullptr, nullptr, nullptr };
+}
+
+inline CommandBuffer::Command CommandBuffer::Targeting(PendingEntity entity, CommandType type) const
+{
+	assert(entity.buffer == _index && entity.index < _pendingOrigins.size());
+	return Command{ _pendingOrigins[entity.index], type, entity.index, EntityHandle(), nullptr, nullptr, nullptr };
+}
+
+template <typename T> void CommandBuffer::RecordSet(Command command, T&& component)
+{
+	using Component = std::decay_t<T>;
+
+	auto memory = _arena.Allocate(sizeof(Component), alignof(Component));
+	command.component = new (memory) Component(std::forward<T>(component));
+	command.apply = [](EntityManager& manager, EntityIndex entity, void* component)
+	{
+		manager.SetComponent<Component>(entity, std::move(*static_cast<Component*>(component)));
+	};
+
+	if constexpr (!std::is_trivially_destructible_v<Component>)
+	{
+		command.destroy = [](void* component) { static_cast<Component*>(component)->~Component(); };
+	}
+
+	_commands.push_back(command);
+}
+
+inline void CommandBuffer::Clear()
+{
+	for (auto& command : _commands)
+	{
+		if (command.destroy != nullptr)
+		{
+			command.destroy(command.component);
+		}
+	}
+
+	_commands.clear();
+	_pendingOrigins.clear();
+	_arena.Reset();
+}
+
+// One CommandBuffer per thread of a pool, so parallel systems record
+// structural changes without locking, and Playback applies them all at a
+// sync point. Commands are applied ordered by key - the entity they target,
+// or the origin of the entity they create - then by buffer, then in recording
+// order. As long as each key is only recorded from one thread, which holds
+// for systems that only touch the entity they iterate, the outcome does not
+// depend on how work was spread over the threads.
+class CommandQueue
+{
+public:
+	CommandQueue(EntityManager& manager, const ThreadPool& pool);
+
+	// The buffer of the calling thread: one of the pool's workers, or the
+	// single outside thread that waits on it.
+	inline CommandBuffer& Local() { return *_buffers[_pool.ThreadIndex()]; }
+	inline CommandBuffer& Buffer(std::size_t index) { return *_buffers[index]; }
+	inline std::size_t BufferCount() const { return _buffers.size(); }
+
+	// Must not overlap with recording or any other use of the manager.
+	void Playback();
+
+	// The entity created for a pending one by the last Playback.
+	inline EntityIndex Resolve(PendingEntity entity) const
+	{
+		return _buffers[entity.buffer]->_created[entity.index].Index();
+	}
+
+private:
+	struct Entry
+	{
+		EntityIndex key;
+		std::uint32_t buffer;
+		std::uint32_t command;
+	};
+
+	EntityManager& _manager;
+	const ThreadPool& _pool;
+	std::vector<std::unique_ptr<CommandBuffer>> _buffers;
+	std::vector<Entry> _order;
+};
+
+inline CommandQueue::CommandQueue(EntityManager& manager, const ThreadPool& pool)
+	: _manager{ manager }, _pool{ pool }
+{
+	for (std::size_t i = 0; i < pool.ThreadCount(); ++i)
+	{
+		_buffers.push_back(std::unique_ptr<CommandBuffer>(new CommandBuffer(manager, static_cast<std::uint32_t>(i))));
+	}
+}
+
+inline void CommandQueue::Playback()
+{
+	_order.clear();
+
+	for (std::uint32_t buffer = 0; buffer < _buffers.size(); ++buffer)
+	{
+		auto& commands = _buffers[buffer]->_commands;
+		for (std::uint32_t command = 0; command < commands.size(); ++command)
+		{
+			_order.push_back(Entry{ commands[command].key, buffer, command });
+		}
+
+		_buffers[buffer]->_created.assign(_buffers[buffer]->_pendingOrigins.size(), EntityHandle());
+	}
+
+	std::sort(_order.begin(), _order.end(), [](const Entry& a, const Entry& b)
+	{
+		return std::tie(a.key, a.buffer, a.command) < std::tie(b.key, b.buffer, b.command);
+	});
+
+	for (auto& entry : _order)
+	{
+		auto& buffer = *_buffers[entry.buffer];
+		auto& command = buffer._commands[entry.command];
+
+		if (command.type == CommandBuffer::CommandType::Create)
+		{
+			buffer._created[command.pending] = _manager.GetHandle(_manager.CreateEntity());
+			continue;
+		}
+
+		auto target = command.pending == CommandBuffer::NOT_PENDING ? command.target : buffer._created[command.pending];
+		if (_manager.IsValid(target))
+		{
+			command.apply(_manager, target.Index(), command.component);
+		}
+	}
+
+	for (auto& buffer : _buffers)
+	{
+		buffer->Clear();
+	}
+}
@@ -0,0 +1,253 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+#include "ECS.h"
+
+// An entity moved by a Compactor: handles to from no longer validate, and
+// EntityManager::Resolve(from) returns to until forwarding is cleared.
+struct EntityMove
+{
+	EntityHandle from;
+	EntityHandle to;
+};
+
+enum class CompactionOrder
+{
+	None,		// only close holes, by moving the last entities into them
+	Signature,	// then group entities sharing a signature into one run
+	Key			// then sort entities by a key
+};
+
+// Gives back what a world holds on to after churn, a slice at a time: live
+// entities from the back are moved into the holes left by destroyed ones,
+// and every index past the last live entity is dropped, shrinking the
+// columns. Optionally entities are then reordered, so that queries over
+// common signatures or by some locality key walk contiguous runs.
+//
+// Moving an entity changes its index and counts as adding its components
+// there, so Changed and Added filters and deltas pick it up. Components that
+// store entity indices, and command buffers not yet played back, have to be
+// patched from the reported moves; stored handles can be resolved instead.
+// Reordering is planned in one go when holes are closed and applies to
+// columns only, since archetypes already keep signatures together.
+class Compactor
+{
+public:
+	explicit Compactor(EntityManager& manager, CompactionOrder order = CompactionOrder::None);
+	// Orders entities by key(entity), ascending; equal keys keep their order.
+	Compactor(EntityManager& manager, std::function<std::uint64_t(EntityIndex)> key);
+
+	// Moves entities until done or about budget has passed, and returns true
+	// once done. moves receives every move, in order; an entity may be moved
+	// more than once. The world may change between steps.
+	bool Step(std::chrono::nanoseconds budget, OUT std::vector<EntityMove>& moves);
+	inline bool Run(OUT std::vector<EntityMove>& moves) { return Step(std::chrono::nanoseconds::max(), moves); }
+	inline bool IsDone() const { return _done; }
+
+private:
+	// The clock is read once per this many moves.
+	static constexpr std::size_t MOVES_PER_CLOCK_CHECK = 64;
+
+	template <typename OutOfTime> bool CloseHoles(OutOfTime& outOfTime, std::vector<EntityMove>& moves);
+	template <typename OutOfTime> bool Reorder(OutOfTime& outOfTime, std::vector<EntityMove>& moves);
+	void Plan();
+	void Move(EntityIndex from, EntityIndex to, std::vector<EntityMove>& moves);
+
+	EntityManager& _manager;
+	CompactionOrder _order;
+	std::function<std::uint64_t(EntityIndex)> _key;
+	bool _done = false;
+
+	// The entity wanted at each position, and the position wanted for the
+	// entity at each index; positions before _cursor are done.
+	bool _planned = false;
+	std::size_t _cursor = 0;
+	std::vector<EntityHandle> _plan;
+	std::vector<std::size_t> _targets;
+};
+
+inline Compactor::Compactor(EntityManager& manager, CompactionOrder order) : _manager{ manager }, _order{ order }
+{
+	assert(order != CompactionOrder::Key);
+}
+
+inline Compactor::Compactor(EntityManager& manager, std::function<std::uint64_t(EntityIndex)> key)
+	: _manager{ manager }, _order{ CompactionOrder::Key }, _key{ std::move(key) }
+{
+}
+
+inline bool Compactor::Step(std::chrono::nanoseconds budget, OUT std::vector<EntityMove>& moves)
+{
+	if (_done)
+	{
+		return true;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	std::size_t work = 0;
+	auto outOfTime = [&]
+	{
+		return ++work % MOVES_PER_CLOCK_CHECK == 0 && std::chrono::steady_clock::now() - start >= budget;
+	};
+
+	if (!CloseHoles(outOfTime, moves))
+	{
+		return false;
+	}
+
+	if (_order == CompactionOrder::None || _manager._storageMode == StorageMode::Archetypes)
+	{
+		_done = true;
+		return true;
+	}
+
+	// Entities created or destroyed since planning leave the plan behind.
+	if (!_planned || _plan.size() != _manager._firstUsableEntityIndex)
+	{
+		Plan();
+	}
+
+	_done = Reorder(outOfTime, moves);
+	return _done;
+}
+
+// Holes are filled lowest first, so the free list is kept sorted with the
+// lowest index last, which is also the next one reused.
+template <typename OutOfTime> bool Compactor::CloseHoles(OutOfTime& outOfTime, std::vector<EntityMove>& moves)
+{
+	auto& free = _manager._freeEntityIndices;
+	std::sort(free.begin(), free.end(), std::greater<EntityIndex>());
+
+	auto end = _manager._firstUsableEntityIndex;
+	auto finished = true;
+
+	while (true)
+	{
+		while (end > 0 && _manager._signatureByEntity[end - 1] == EMPTY_SIGNATURE)
+		{
+			--end;
+		}
+
+		if (free.empty() || free.back() >= end)
+		{
+			break;
+		}
+
+		if (outOfTime())
+		{
+			finished = false;
+			break;
+		}
+
+		auto hole = free.back();
+		free.pop_back();
+		Move(end - 1, hole, moves);
+		--end;
+	}
+
+	_manager.TruncateEntities(end);
+	return finished;
+}
+
+inline void Compactor::Plan()
+{
+	auto count = _manager._firstUsableEntityIndex;
+	std::vector<EntityIndex> order(count);
+
+	if (_order == CompactionOrder::Signature)
+	{
+		std::vector<std::size_t> offsets(_manager._signatures.Count() + 1);
+		for (EntityIndex entity = 0; entity < count; ++entity)
+		{
+			++offsets[_manager._signatureByEntity[entity] + 1];
+		}
+
+		std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+		for (EntityIndex entity = 0; entity < count; ++entity)
+		{
+			order[offsets[_manager._signatureByEntity[entity]]++] = entity;
+		}
+	}
+	else
+	{
+		std::vector<std::uint64_t> keys(count);
+		for (EntityIndex entity = 0; entity < count; ++entity)
+		{
+			keys[entity] = _key(entity);
+		}
+
+		std::iota(order.begin(), order.end(), EntityIndex(0));
+		std::stable_sort(order.begin(), order.end(), [&](EntityIndex a, EntityIndex b) { return keys[a] < keys[b]; });
+	}
+
+	_plan.resize(count);
+	_targets.resize(count);
+	for (std::size_t position = 0; position < count; ++position)
+	{
+		_plan[position] = _manager.GetHandle(order[position]);
+		_targets[order[position]] = position;
+	}
+
+	_cursor = 0;
+	_planned = true;
+}
+
+// Each position takes its entity in one swap, which sends the entity that
+// was there to where the wanted one came from.
+template <typename OutOfTime> bool Compactor::Reorder(OutOfTime& outOfTime, std::vector<EntityMove>& moves)
+{
+	for (; _cursor < _plan.size(); ++_cursor)
+	{
+		auto wanted = _plan[_cursor];
+		if (!_manager.IsValid(wanted) || _manager.GetHandle(_cursor) != _plan[_targets[_cursor]])
+		{
+			// Something was destroyed and its index reused since planning.
+			_planned = false;
+			return false;
+		}
+
+		auto from = wanted.Index();
+		if (from == _cursor)
+		{
+			continue;
+		}
+
+		if (outOfTime())
+		{
+			return false;
+		}
+
+		auto displaced = _targets[_cursor];
+		Move(from, _cursor, moves);
+
+		_plan[_cursor] = _manager.GetHandle(_cursor);
+		_plan[displaced] = _manager.GetHandle(from);
+		_targets[_cursor] = _cursor;
+		_targets[from] = displaced;
+	}
+
+	return true;
+}
+
+inline void Compactor::Move(EntityIndex from, EntityIndex to, std::vector<EntityMove>& moves)
+{
+	auto moved = _manager.GetHandle(from);
+	auto displaced = _manager.GetHandle(to);
+	auto displacedLive = _manager._signatureByEntity[to] != EMPTY_SIGNATURE;
+
+	_manager.SwapEntities(from, to);
+
+	moves.push_back(EntityMove{ moved, _manager.GetHandle(to) });
+	if (displacedLive)
+	{
+		moves.push_back(EntityMove{ displaced, _manager.GetHandle(from) });
+	}
+}
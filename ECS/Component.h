@@ -1,4 +1,35 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <istream>
+#include <memory>
+#include <new>
+#include <ostream>
+#include <streambuf>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "Allocator.h"
+#include "PagedColumn.h"
+
+#define OUT
+
+constexpr std::size_t MAX_COMPONENT_COUNT = 256;
+
+using EntityIndex = std::size_t;
+using ComponentID = std::size_t;
+using EntityFilter = std::bitset<MAX_COMPONENT_COUNT>;
+
+// Writes are stamped with the version current at the time; 0 means never.
+using ChangeVersion = std::uint32_t;
+inline constexpr ChangeVersion NO_VERSION = 0;
 
 enum class EntityState
 {
@@ -15,51 +46,801 @@ std::size_t GetNextComponentID()
 
 template <typename T> std::size_t GetComponentID()
 {
-	static std::size_t id = GetNextComponentID();
-	return id;
+	using Component = std::remove_cv_t<std::remove_reference_t<T>>;
+
+	if constexpr (std::is_same_v<T, Component>)
+	{
+		static std::size_t id = GetNextComponentID();
+		return id;
+	}
+	else
+	{
+		return GetComponentID<Component>();
+	}
 };
 
+template <typename... Ts> EntityFilter MakeFilter()
+{
+	EntityFilter filter;
+	auto _ = { (filter.set(GetComponentID<Ts>(), true), 0)... };
+	return filter;
+}
+
 //TODO naming
 template <typename... Ts> class UsedComponents { };
 
+enum class StoragePolicy
+{
+	Dense,		// one slot per entity, indexed directly
+	Sparse		// packed array of owners only, for rarely used types
+};
+
+// Wrap a type in UsedComponents to store it with StoragePolicy::Sparse,
+// e.g. UsedComponents<EntityState, Position, Sparse<Burning>>.
+template <typename T> struct Sparse { };
+
+// Tags are empty types: they only exist as a bit in the signature, with no
+// container, archetype column or write. EntityState is kept the same way,
+// since its bit is what marks an entity alive; it reads as Active.
+template <typename T> constexpr bool IsTag = std::is_empty_v<T> || std::is_same_v<T, EntityState>;
+
+template <typename T> T TagValue()
+{
+	if constexpr (std::is_same_v<T, EntityState>)
+	{
+		return EntityState::Active;
+	}
+	else
+	{
+		return T{};
+	}
+}
+
+// Filters for EntityManager::Each(since, func): entities whose T was
+// written, or added, after version since.
+template <typename T> struct Changed { };
+template <typename T> struct Added { };
+
+struct VersionFilter
+{
+	ComponentID id;
+	bool added;
+};
+
+template <typename T> VersionFilter MakeVersionFilter(Changed<T>)
+{
+	static_assert(!IsTag<T>, "Tags have no change versions");
+	return VersionFilter{ GetComponentID<T>(), false };
+}
+
+template <typename T> VersionFilter MakeVersionFilter(Added<T>)
+{
+	static_assert(!IsTag<T>, "Tags have no change versions");
+	return VersionFilter{ GetComponentID<T>(), true };
+}
+
+// Specialize for component types that are not trivially copyable to make
+// them part of snapshots; trivially copyable ones are stored as raw bytes.
+//		template <> struct SnapshotHook<Name>
+//		{
+//			static void Write(std::ostream& out, const Name& name);
+//			static void Read(std::istream& in, Name& name);
+//		};
+template <typename T> struct SnapshotHook;
+
+template <typename T, typename = void> struct HasSnapshotHook : std::false_type { };
+template <typename T> struct HasSnapshotHook<T, std::void_t<decltype(&SnapshotHook<T>::Write)>> : std::true_type { };
+
+template <typename T> struct ComponentStorage
+{
+	using Component = T;
+	static constexpr StoragePolicy Policy = StoragePolicy::Dense;
+};
+
+template <typename T> struct ComponentStorage<Sparse<T>>
+{
+	using Component = T;
+	static constexpr StoragePolicy Policy = StoragePolicy::Sparse;
+};
+
 class ComponentContainerBase
 {
 public:
-	virtual void AddNew() = 0;
+	static constexpr std::size_t CHANGE_RANGE_SIZE = 1024;
+
+	explicit ComponentContainerBase(StoragePolicy policy, Allocator& allocator = DefaultAllocator())
+		: _policy{ policy }, _changedVersions{ allocator }, _addedVersions{ allocator }, _rangeVersions{ allocator } {}
+	virtual ~ComponentContainerBase() = default;
+
+	virtual void AddNew(std::size_t count) = 0;
+	virtual void Remove(std::size_t index) = 0;
+	virtual void Remove(const EntityIndex* indices, std::size_t count) = 0;
+
+	// Snapshot support, see Snapshot.h. The stored components - one per entity
+	// if dense, one per owner if sparse - are written as whole raw pages when
+	// trivially copyable, or else through SnapshotHook.
+	virtual bool CanSnapshot() const = 0;
+	virtual bool IsRaw() const = 0;
+	virtual std::size_t ElementSize() const = 0;
+	virtual std::size_t StoredCount() const = 0;
+	virtual void WriteComponents(std::ostream& out) const = 0;
+	// Whether size bytes hold count raw components in whole pages, as written.
+	virtual bool FitsComponents(std::size_t size, std::size_t count) const = 0;
+	// Loads count components into an empty container. Raw components are
+	// used in place if borrow is set, so data must then outlive the container.
+	// Fails, leaving the container empty, if data is too short or a
+	// SnapshotHook can't read it.
+	virtual bool ReadComponents(const std::byte* data, std::size_t size, std::size_t count, bool borrow) = 0;
+	void RestoreOwners(const std::vector<EntityIndex>& owners);
+
+	// Delta support, see Delta.h; raw components only. RawAcquire is Acquire
+	// on the bytes of the component.
+	virtual const std::byte* RawGet(EntityIndex entity) const = 0;
+	virtual std::byte* RawAcquire(EntityIndex entity) = 0;
+
+	inline StoragePolicy Policy() const { return _policy; }
+
+	// Compaction support, see Compaction.h. Swap exchanges the components
+	// and versions of two entity indices, whichever of them has one; Truncate
+	// drops every index from count on, none of which may own a component, and
+	// gives back the memory they took.
+	virtual void Swap(EntityIndex a, EntityIndex b) = 0;
+	virtual void Truncate(std::size_t count) = 0;
+
+	// Group support, see Group.h; sparse only. PackedSlot is the slot of the
+	// component of entity, or one past every slot if it has none, and
+	// MoveToSlot exchanges it with the one at slot. MarkPackedChanged marks
+	// count components from slot first on.
+	inline std::size_t PackedSlot(EntityIndex entity) const { return FindSlot(entity); }
+	virtual void MoveToSlot(EntityIndex entity, std::size_t slot) = 0;
+	void MarkPackedChanged(std::size_t first, std::size_t count);
+
+	// Capacity counts allocated components; AllocatedBytes is everything the
+	// container holds on to, versions and sparse indices included.
+	virtual std::size_t Capacity() const = 0;
+	std::size_t AllocatedBytes() const;
+
+	// Only meaningful for sparse containers: the entities that own a component,
+	// in the same order as the packed components.
+	inline const std::vector<EntityIndex>& Owners() const { return _owners; }
+
+	// Writes are stamped with the version clock points at, normally the one
+	// of the owning EntityManager. Only entities that have the component
+	// may be asked for their versions.
+	inline void SetClock(const ChangeVersion* clock) { _clock = clock; }
+	ChangeVersion ChangedVersion(EntityIndex entity) const;
+	ChangeVersion AddedVersion(EntityIndex entity) const;
+	void MarkChanged(EntityIndex entity);
+	void MarkAdded(EntityIndex entity);
+
+	// Dense only: the latest change of any entity in the same block of
+	// CHANGE_RANGE_SIZE entities, so that untouched blocks can be skipped.
+	inline ChangeVersion RangeVersion(EntityIndex entity) const
+	{
+		return _rangeVersions[entity / CHANGE_RANGE_SIZE].load(std::memory_order_relaxed);
+	}
+
+protected:
+	static constexpr std::size_t SPARSE_PAGE_SIZE = 1024;
+	static constexpr std::size_t NO_SLOT = static_cast<std::size_t>(-1);
+
+	std::size_t FindSlot(EntityIndex entity) const;
+	void SetSlot(EntityIndex entity, std::size_t slot);
+
+	// Versions are kept per entity for dense containers and per packed slot
+	// for sparse ones.
+	inline std::size_t VersionSlot(EntityIndex entity) const
+	{
+		return _policy == StoragePolicy::Dense ? entity : FindSlot(entity);
+	}
+	void GrowVersions(std::size_t count);
+	void MoveVersions(std::size_t to, std::size_t from);
+	void PopVersions();
+	void SwapVersions(EntityIndex a, EntityIndex b);
+	void SwapSlots(EntityIndex a, EntityIndex b);
+	void TruncateVersions(std::size_t count);
+	void SwapPacked(std::size_t a, std::size_t b);
+
+	StoragePolicy _policy;
+	std::vector<EntityIndex> _owners;
+
+	const ChangeVersion* _clock = &NO_VERSION;
+	PagedColumn<ChangeVersion> _changedVersions;
+	PagedColumn<ChangeVersion> _addedVersions;
+	PagedColumn<std::atomic<ChangeVersion>> _rangeVersions;
+
+	// Entity -> packed slot, split into pages that are only allocated once
+	// an entity in their range owns a component.
+	std::vector<std::unique_ptr<std::size_t[]>> _sparsePages;
 };
 
+inline std::size_t ComponentContainerBase::FindSlot(EntityIndex entity) const
+{
+	auto page = entity / SPARSE_PAGE_SIZE;
+	if (page >= _sparsePages.size() || !_sparsePages[page])
+	{
+		return NO_SLOT;
+	}
+
+	return _sparsePages[page][entity % SPARSE_PAGE_SIZE];
+}
+
+inline void ComponentContainerBase::SetSlot(EntityIndex entity, std::size_t slot)
+{
+	auto page = entity / SPARSE_PAGE_SIZE;
+	if (page >= _sparsePages.size())
+	{
+		_sparsePages.resize(page + 1);
+	}
+
+	if (!_sparsePages[page])
+	{
+		_sparsePages[page] = std::make_unique<std::size_t[]>(SPARSE_PAGE_SIZE);
+		std::fill_n(_sparsePages[page].get(), SPARSE_PAGE_SIZE, NO_SLOT);
+	}
+
+	_sparsePages[page][entity % SPARSE_PAGE_SIZE] = slot;
+}
+
+inline ChangeVersion ComponentContainerBase::ChangedVersion(EntityIndex entity) const
+{
+	return _changedVersions[VersionSlot(entity)];
+}
+
+inline ChangeVersion ComponentContainerBase::AddedVersion(EntityIndex entity) const
+{
+	return _addedVersions[VersionSlot(entity)];
+}
+
+// Called for every entity of a mutable Each, possibly from several threads.
+// Entities are disjoint between threads; only the range stamp is shared.
+inline void ComponentContainerBase::MarkChanged(EntityIndex entity)
+{
+	auto version = *_clock;
+	_changedVersions[VersionSlot(entity)] = version;
+
+	if (_policy == StoragePolicy::Dense)
+	{
+		auto& range = _rangeVersions[entity / CHANGE_RANGE_SIZE];
+		if (range.load(std::memory_order_relaxed) != version)
+		{
+			range.store(version, std::memory_order_relaxed);
+		}
+	}
+}
+
+inline void ComponentContainerBase::MarkAdded(EntityIndex entity)
+{
+	_addedVersions[VersionSlot(entity)] = *_clock;
+	MarkChanged(entity);
+}
+
+inline void ComponentContainerBase::RestoreOwners(const std::vector<EntityIndex>& owners)
+{
+	_owners = owners;
+
+	for (std::size_t slot = 0; slot < _owners.size(); ++slot)
+	{
+		SetSlot(_owners[slot], slot);
+	}
+}
+
+inline std::size_t ComponentContainerBase::AllocatedBytes() const
+{
+	auto bytes = Capacity() * ElementSize();
+	bytes += (_changedVersions.Capacity() + _addedVersions.Capacity()) * sizeof(ChangeVersion);
+	bytes += _rangeVersions.Capacity() * sizeof(std::atomic<ChangeVersion>);
+	bytes += _owners.capacity() * sizeof(EntityIndex) + _sparsePages.capacity() * sizeof(_sparsePages[0]);
+
+	for (auto& page : _sparsePages)
+	{
+		bytes += page ? SPARSE_PAGE_SIZE * sizeof(std::size_t) : 0;
+	}
+
+	return bytes;
+}
+
+inline void ComponentContainerBase::GrowVersions(std::size_t count)
+{
+	_changedVersions.Grow(count);
+	_addedVersions.Grow(count);
+
+	if (_policy == StoragePolicy::Dense)
+	{
+		auto ranges = (_changedVersions.size() + CHANGE_RANGE_SIZE - 1) / CHANGE_RANGE_SIZE;
+		_rangeVersions.Grow(ranges - _rangeVersions.size());
+	}
+}
+
+inline void ComponentContainerBase::MoveVersions(std::size_t to, std::size_t from)
+{
+	_changedVersions[to] = _changedVersions[from];
+	_addedVersions[to] = _addedVersions[from];
+}
+
+inline void ComponentContainerBase::PopVersions()
+{
+	_changedVersions.PopBack();
+	_addedVersions.PopBack();
+}
+
+// Dense only. Both ranges keep covering the latest change in them.
+inline void ComponentContainerBase::SwapVersions(EntityIndex a, EntityIndex b)
+{
+	std::swap(_changedVersions[a], _changedVersions[b]);
+	std::swap(_addedVersions[a], _addedVersions[b]);
+
+	for (auto entity : { a, b })
+	{
+		auto& range = _rangeVersions[entity / CHANGE_RANGE_SIZE];
+		if (range.load(std::memory_order_relaxed) < _changedVersions[entity])
+		{
+			range.store(_changedVersions[entity], std::memory_order_relaxed);
+		}
+	}
+}
+
+// Sparse only: the packed components stay where they are, their owners change.
+inline void ComponentContainerBase::SwapSlots(EntityIndex a, EntityIndex b)
+{
+	auto slotA = FindSlot(a);
+	auto slotB = FindSlot(b);
+
+	if (slotA != NO_SLOT)
+	{
+		_owners[slotA] = b;
+	}
+	if (slotB != NO_SLOT)
+	{
+		_owners[slotB] = a;
+	}
+
+	if (slotA != NO_SLOT || slotB != NO_SLOT)
+	{
+		SetSlot(a, slotB);
+		SetSlot(b, slotA);
+	}
+}
+
+inline void ComponentContainerBase::TruncateVersions(std::size_t count)
+{
+	if (_policy == StoragePolicy::Dense)
+	{
+		_changedVersions.Shrink(count);
+		_addedVersions.Shrink(count);
+		_rangeVersions.Shrink((count + CHANGE_RANGE_SIZE - 1) / CHANGE_RANGE_SIZE);
+		return;
+	}
+
+	_changedVersions.Shrink(_changedVersions.size());
+	_addedVersions.Shrink(_addedVersions.size());
+	_sparsePages.resize(std::min(_sparsePages.size(), (count + SPARSE_PAGE_SIZE - 1) / SPARSE_PAGE_SIZE));
+	_sparsePages.shrink_to_fit();
+	_owners.shrink_to_fit();
+}
+
+inline void ComponentContainerBase::MarkPackedChanged(std::size_t first, std::size_t count)
+{
+	auto version = *_clock;
+	for (auto slot = first; slot < first + count; ++slot)
+	{
+		_changedVersions[slot] = version;
+	}
+}
+
+// Sparse only: everything but the components at slots a and b trades places.
+inline void ComponentContainerBase::SwapPacked(std::size_t a, std::size_t b)
+{
+	std::swap(_owners[a], _owners[b]);
+	std::swap(_changedVersions[a], _changedVersions[b]);
+	std::swap(_addedVersions[a], _addedVersions[b]);
+	SetSlot(_owners[a], a);
+	SetSlot(_owners[b], b);
+}
+
+// Replaces a live component with one constructed from args: in place when
+// that cannot throw, or else through a temporary, so that a throwing
+// constructor leaves the old component alive.
+template <typename T, typename ... Args> T& Reconstruct(T& component, Args&&... args)
+{
+	if constexpr (std::is_nothrow_constructible_v<T, Args...>)
+	{
+		component.~T();
+		return *new (&component) T(std::forward<Args>(args)...);
+	}
+	else
+	{
+		component = T(std::forward<Args>(args)...);
+		return component;
+	}
+}
+
+// Final, so that code holding the concrete type calls it without virtual dispatch.
 template <typename T>
-class ComponentContainer : public ComponentContainerBase
+class ComponentContainer final : public ComponentContainerBase
 {
 public:
-	void AddNew() override;
-	void Set(std::size_t index, T&& value);
+	explicit ComponentContainer(StoragePolicy policy = StoragePolicy::Dense, Allocator& allocator = DefaultAllocator())
+		: ComponentContainerBase{ policy, allocator }, _components{ allocator } {}
+
+	void AddNew(std::size_t count) override;
+	void Remove(std::size_t index) override;
+	void Remove(const EntityIndex* indices, std::size_t count) override;
+	void Swap(EntityIndex a, EntityIndex b) override;
+	void Truncate(std::size_t count) override;
+	void MoveToSlot(EntityIndex entity, std::size_t slot) override;
+	// Set, Emplace, the mutable Get and Acquire mark the component as changed.
+	// Set assigns value, moving it if it is an rvalue; Emplace constructs the
+	// component from args, replacing the one index had.
+	template <typename U> void Set(std::size_t index, U&& value);
+	template <typename ... Args> T& Emplace(std::size_t index, Args&&... args);
 	const T& Get(std::size_t index) const;
+	T& Get(std::size_t index);
+
+	// Like Get, but adds a default constructed component to a sparse
+	// container that has none for index yet.
+	T& Acquire(std::size_t index);
+
+	inline bool CanSnapshot() const override { return IsRaw() || HasSnapshotHook<T>::value; }
+	inline bool IsRaw() const override { return std::is_trivially_copyable_v<T>; }
+	inline std::size_t ElementSize() const override { return sizeof(T); }
+	inline std::size_t StoredCount() const override { return _components.size(); }
+	inline std::size_t Capacity() const override { return _components.Capacity(); }
+	void WriteComponents(std::ostream& out) const override;
+	bool FitsComponents(std::size_t size, std::size_t count) const override;
+	bool ReadComponents(const std::byte* data, std::size_t size, std::size_t count, bool borrow) override;
+	const std::byte* RawGet(EntityIndex entity) const override;
+	std::byte* RawAcquire(EntityIndex entity) override;
+
+	// Sparse only: the packed components from slot on, up to the end of
+	// their page.
+	inline T* Packed(std::size_t slot) { return &_components[slot]; }
 
 private:
-	std::vector<T> _components;
+	// Dense: indexed by entity. Sparse: packed, parallel to Owners().
+	PagedColumn<T> _components;
 };
 
 template <typename T>
-void ComponentContainer<T>::AddNew()
+void ComponentContainer<T>::AddNew(std::size_t count)
 {
-	_components.push_back(T{});
+	if (_policy == StoragePolicy::Dense)
+	{
+		_components.Grow(count);
+		GrowVersions(count);
+	}
 }
 
+// A dense slot outlives its component, so it is reset to a default one,
+// which gives back whatever the removed component held on to.
 template <typename T>
-void ComponentContainer<T>::Set(std::size_t index, T&& value)
+void ComponentContainer<T>::Remove(std::size_t index)
 {
-	_components[index] = value;
+	if (_policy == StoragePolicy::Dense)
+	{
+		if constexpr (!std::is_trivially_destructible_v<T>)
+		{
+			Reconstruct(_components[index]);
+		}
+		return;
+	}
+
+	auto slot = FindSlot(index);
+	if (slot == NO_SLOT)
+	{
+		return;
+	}
+
+	auto last = _components.size() - 1;
+	if (slot != last)
+	{
+		_components[slot] = std::move(_components[last]);
+		_owners[slot] = _owners[last];
+		MoveVersions(slot, last);
+		SetSlot(_owners[slot], slot);
+	}
+
+	_components.PopBack();
+	_owners.pop_back();
+	PopVersions();
+	SetSlot(index, NO_SLOT);
+}
+
+template <typename T>
+void ComponentContainer<T>::Remove(const EntityIndex* indices, std::size_t count)
+{
+	if (_policy == StoragePolicy::Dense && std::is_trivially_destructible_v<T>)
+	{
+		return;
+	}
+
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		Remove(indices[i]);
+	}
+}
+
+template <typename T>
+void ComponentContainer<T>::Swap(EntityIndex a, EntityIndex b)
+{
+	if (_policy == StoragePolicy::Dense)
+	{
+		using std::swap;
+		swap(_components[a], _components[b]);
+		SwapVersions(a, b);
+		return;
+	}
+
+	SwapSlots(a, b);
+}
+
+template <typename T>
+void ComponentContainer<T>::Truncate(std::size_t count)
+{
+	_components.Shrink(_policy == StoragePolicy::Dense ? count : _components.size());
+	TruncateVersions(count);
+}
+
+template <typename T>
+void ComponentContainer<T>::MoveToSlot(EntityIndex entity, std::size_t slot)
+{
+	auto from = FindSlot(entity);
+	if (from == slot)
+	{
+		return;
+	}
+
+	using std::swap;
+	swap(_components[from], _components[slot]);
+	SwapPacked(from, slot);
+}
+
+template <typename T>
+template <typename U> void ComponentContainer<T>::Set(std::size_t index, U&& value)
+{
+	if (_policy == StoragePolicy::Dense)
+	{
+		_components[index] = std::forward<U>(value);
+		MarkChanged(index);
+		return;
+	}
+
+	auto slot = FindSlot(index);
+	if (slot != NO_SLOT)
+	{
+		_components[slot] = std::forward<U>(value);
+		MarkChanged(index);
+		return;
+	}
+
+	SetSlot(index, _components.size());
+	_components.EmplaceBack(std::forward<U>(value));
+	_owners.push_back(index);
+	GrowVersions(1);
+	MarkAdded(index);
+}
+
+template <typename T>
+template <typename ... Args> T& ComponentContainer<T>::Emplace(std::size_t index, Args&&... args)
+{
+	if (_policy == StoragePolicy::Dense)
+	{
+		MarkChanged(index);
+		return Reconstruct(_components[index], std::forward<Args>(args)...);
+	}
+
+	auto slot = FindSlot(index);
+	if (slot != NO_SLOT)
+	{
+		MarkChanged(index);
+		return Reconstruct(_components[slot], std::forward<Args>(args)...);
+	}
+
+	auto& component = _components.EmplaceBack(std::forward<Args>(args)...);
+	SetSlot(index, _components.size() - 1);
+	_owners.push_back(index);
+	GrowVersions(1);
+	MarkAdded(index);
+	return component;
 }
 
 template <typename T>
 const T& ComponentContainer<T>::Get(std::size_t index) const
 {
-	return _components[index];
+	if (_policy == StoragePolicy::Dense)
+	{
+		return _components[index];
+	}
+
+	auto slot = FindSlot(index);
+	assert(slot != NO_SLOT);
+	return _components[slot];
+}
+
+template <typename T>
+T& ComponentContainer<T>::Get(std::size_t index)
+{
+	auto& component = const_cast<T&>(static_cast<const ComponentContainer<T>&>(*this).Get(index));
+	MarkChanged(index);
+	return component;
+}
+
+template <typename T>
+T& ComponentContainer<T>::Acquire(std::size_t index)
+{
+	if (_policy == StoragePolicy::Dense)
+	{
+		MarkChanged(index);
+		return _components[index];
+	}
+
+	auto slot = FindSlot(index);
+	if (slot != NO_SLOT)
+	{
+		MarkChanged(index);
+		return _components[slot];
+	}
+
+	SetSlot(index, _components.size());
+	_owners.push_back(index);
+	GrowVersions(1);
+	MarkAdded(index);
+	return _components.EmplaceBack();
+}
+
+template <typename T>
+void ComponentContainer<T>::WriteComponents(std::ostream& out) const
+{
+	if constexpr (std::is_trivially_copyable_v<T>)
+	{
+		// Whole pages, so that a loaded column can borrow them as they are.
+		static const char zeros[CACHE_LINE_SIZE] = {};
+		constexpr auto pageSize = PagedColumn<T>::PAGE_CAPACITY * sizeof(T);
+
+		for (std::size_t page = 0; page * PagedColumn<T>::PAGE_CAPACITY < _components.size(); ++page)
+		{
+			auto count = std::min(_components.size() - page * PagedColumn<T>::PAGE_CAPACITY, PagedColumn<T>::PAGE_CAPACITY);
+			out.write(reinterpret_cast<const char*>(_components.Page(page)), count * sizeof(T));
+
+			for (auto padding = pageSize - count * sizeof(T); padding > 0; )
+			{
+				auto chunk = std::min(padding, sizeof(zeros));
+				out.write(zeros, chunk);
+				padding -= chunk;
+			}
+		}
+	}
+	else if constexpr (HasSnapshotHook<T>::value)
+	{
+		for (std::size_t i = 0; i < _components.size(); ++i)
+		{
+			SnapshotHook<T>::Write(out, _components[i]);
+		}
+	}
+	else
+	{
+		assert(false && "Component type needs a SnapshotHook");
+	}
+}
+
+template <typename T>
+bool ComponentContainer<T>::FitsComponents(std::size_t size, std::size_t count) const
+{
+	constexpr auto pageSize = PagedColumn<T>::PAGE_CAPACITY * sizeof(T);
+	return (count + PagedColumn<T>::PAGE_CAPACITY - 1) / PagedColumn<T>::PAGE_CAPACITY <= size / pageSize;
+}
+
+template <typename T>
+bool ComponentContainer<T>::ReadComponents(const std::byte* data, std::size_t size, std::size_t count, bool borrow)
+{
+	assert(_components.size() == 0);
+
+	if constexpr (std::is_trivially_copyable_v<T>)
+	{
+		if (!FitsComponents(size, count))
+		{
+			return false;
+		}
+
+		if (borrow && PagedColumn<T>::PAGE_ALIGNMENT == CACHE_LINE_SIZE)
+		{
+			_components.Borrow(reinterpret_cast<T*>(const_cast<std::byte*>(data)), count);
+		}
+		else
+		{
+			_components.Grow(count);
+			for (std::size_t page = 0; page * PagedColumn<T>::PAGE_CAPACITY < count; ++page)
+			{
+				auto first = page * PagedColumn<T>::PAGE_CAPACITY;
+				std::memcpy(_components.Page(page), data + first * sizeof(T),
+							std::min(count - first, PagedColumn<T>::PAGE_CAPACITY) * sizeof(T));
+			}
+		}
+	}
+	else if constexpr (HasSnapshotHook<T>::value)
+	{
+		struct MemoryBuffer : std::streambuf
+		{
+			MemoryBuffer(const std::byte* data, std::size_t size)
+			{
+				auto begin = reinterpret_cast<char*>(const_cast<std::byte*>(data));
+				setg(begin, begin, begin + size);
+			}
+		};
+
+		MemoryBuffer buffer(data, size);
+		std::istream in(&buffer);
+
+		for (std::size_t i = 0; i < count && in; ++i)
+		{
+			SnapshotHook<T>::Read(in, _components.EmplaceBack());
+		}
+
+		if (!in)
+		{
+			_components.Shrink(0);
+			return false;
+		}
+	}
+	else
+	{
+		assert(false && "Component type needs a SnapshotHook");
+		return false;
+	}
+
+	GrowVersions(count);
+	return true;
 }
 
+template <typename T>
+const std::byte* ComponentContainer<T>::RawGet(EntityIndex entity) const
+{
+	if constexpr (std::is_trivially_copyable_v<T>)
+	{
+		return reinterpret_cast<const std::byte*>(&Get(entity));
+	}
+	else
+	{
+		assert(false && "Component type is not trivially copyable");
+		return nullptr;
+	}
+}
 
+template <typename T>
+std::byte* ComponentContainer<T>::RawAcquire(EntityIndex entity)
+{
+	if constexpr (std::is_trivially_copyable_v<T>)
+	{
+		return reinterpret_cast<std::byte*>(&Acquire(entity));
+	}
+	else
+	{
+		assert(false && "Component type is not trivially copyable");
+		return nullptr;
+	}
+}
 
+// Stands in for the container of a tag, for code written against
+// containers: every entity reads the same value, and writes go nowhere.
+template <typename T>
+class TagContainer
+{
+public:
+	explicit TagContainer(StoragePolicy = StoragePolicy::Dense, Allocator& = DefaultAllocator()) {}
 
+	inline void SetClock(const ChangeVersion*) {}
+	inline void AddNew(std::size_t) {}
+	inline void Remove(std::size_t) {}
+	template <typename U> inline void Set(std::size_t, U&&) {}
+	template <typename ... Args> inline T& Emplace(std::size_t, Args&&...) { return _value; }
+	inline void MarkAdded(EntityIndex) {}
+	inline const T& Get(std::size_t) const { return _value; }
+	inline T& Get(std::size_t) { return _value; }
+	inline T& Acquire(std::size_t) { return _value; }
+	inline T& operator[](std::size_t) { return _value; }
 
+private:
+	T _value = TagValue<T>();
+};
 
+template <typename T> using ContainerFor = std::conditional_t<IsTag<T>, TagContainer<T>, ComponentContainer<T>>;
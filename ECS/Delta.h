@@ -0,0 +1,798 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "ECS.h"
+
+constexpr std::uint32_t DELTA_MAGIC = 0x44534345;	// "ECSD"
+
+enum class DeltaCompression : std::uint8_t
+{
+	None,	// changed components as they are
+	XorRle	// XOR with the previous value, runs of zero bytes collapsed
+};
+
+// The wire format: LEB128 varints, entity lists as ascending differences,
+// and zero-run coded byte streams.
+class DeltaWriter
+{
+public:
+	explicit DeltaWriter(std::vector<std::byte>& out) : _out{ out } {}
+
+	void Varint(std::uint64_t value);
+	void Entities(const std::vector<EntityIndex>& entities);
+	void Bytes(const std::byte* bytes, std::size_t count);
+	// Pairs of (zero run, literal length, literals) until count bytes are covered.
+	void ZeroRuns(const std::byte* bytes, std::size_t count);
+
+private:
+	std::vector<std::byte>& _out;
+};
+
+class DeltaReader
+{
+public:
+	DeltaReader(const std::byte* data, std::size_t size) : _position{ data }, _end{ data + size } {}
+
+	bool Varint(OUT std::uint64_t& value);
+	bool Entities(EntityIndex limit, OUT std::vector<EntityIndex>& entities);
+	bool Bytes(std::byte* bytes, std::size_t count);
+	bool ZeroRuns(std::byte* bytes, std::size_t count);
+
+	inline bool AtEnd() const { return _position == _end; }
+
+private:
+	const std::byte* _position;
+	const std::byte* _end;
+};
+
+// Replicates a columns-mode EntityManager tick by tick. The encoder keeps a
+// copy of the state it encoded last and writes only what differs from it:
+// created and destroyed entities as generation changes, signature changes,
+// the free list if it changed, and the components whose bytes changed.
+// Change versions limit the comparison to blocks and entities written since
+// the last Encode. A replica with the same UsedComponents, given every delta
+// in order through a DeltaDecoder, ends up with the same entities, handles,
+// signatures and components. Components must be trivially copyable.
+class DeltaEncoder
+{
+public:
+	// Appends the delta since the previous Encode to out. The first delta,
+	// and the first after Reset, holds the whole world. Fails in archetype
+	// mode or if a component type is not trivially copyable.
+	bool Encode(const EntityManager& manager, OUT std::vector<std::byte>& out,
+				DeltaCompression compression = DeltaCompression::XorRle);
+	// Forgets the previous state, e.g. to bring a new replica up to date.
+	void Reset();
+
+	inline std::uint64_t Tick() const { return _tick; }
+
+private:
+	// Previous bytes: indexed by entity if dense, in the order of the sorted
+	// owners if sparse.
+	struct Column
+	{
+		std::size_t elementSize;
+		std::vector<std::byte> values;
+		std::vector<EntityIndex> owners;
+	};
+
+	static const std::byte* Previous(const Column& column, StoragePolicy policy, EntityIndex entity);
+	void EncodeColumn(const EntityManager& manager, std::size_t index, DeltaCompression compression, DeltaWriter& writer);
+
+	const EntityManager* _manager = nullptr;
+	std::uint64_t _tick = 0;
+	ChangeVersion _version = NO_VERSION;
+
+	std::vector<EntityGeneration> _generations;
+	std::vector<SignatureID> _signatures;
+	std::vector<EntityIndex> _freeEntityIndices;
+	std::vector<Column> _columns;
+	std::vector<EntityIndex> _dropped;
+	// Signature IDs below this are known to the decoder.
+	std::size_t _sentSignatures = 0;
+
+	// Reused between calls.
+	std::vector<EntityIndex> _touched;
+	std::vector<EntityIndex> _columnIndices;
+	std::vector<EntityIndex> _added;
+	std::vector<EntityIndex> _changed;
+	std::vector<std::byte> _addedBytes;
+	std::vector<std::byte> _changedBytes;
+};
+
+// Applies the deltas of one DeltaEncoder to a replica, which has to start
+// out empty and must not be changed by anything else in between.
+class DeltaDecoder
+{
+public:
+	// Fails without touching replica if the delta is malformed or does not
+	// continue from the one applied last.
+	bool Apply(EntityManager& replica, const std::byte* data, std::size_t size);
+	inline bool Apply(EntityManager& replica, const std::vector<std::byte>& delta)
+	{
+		return Apply(replica, delta.data(), delta.size());
+	}
+
+	inline std::uint64_t Tick() const { return _tick; }
+
+private:
+	struct Column
+	{
+		std::vector<EntityIndex> added;
+		std::vector<EntityIndex> changed;
+		std::vector<std::byte> addedBytes;
+		std::vector<std::byte> changedBytes;
+	};
+
+	static bool ReadBytes(DeltaReader& reader, DeltaCompression compression, std::size_t count, OUT std::vector<std::byte>& bytes);
+
+	std::uint64_t _tick = 0;
+	// Ours for each signature ID of the encoder.
+	std::vector<SignatureID> _signatureIds;
+
+	// The delta being applied, decoded in full before the replica is touched.
+	std::vector<EntityIndex> _generationEntities;
+	std::vector<EntityGeneration> _generations;
+	std::vector<EntityFilter> _newSignatures;
+	std::vector<EntityIndex> _columnIndices;
+	std::vector<EntityIndex> _signatureEntities;
+	std::vector<SignatureID> _signatures;
+	std::vector<SignatureID> _signaturesBefore;
+	std::vector<EntityIndex> _freeEntityIndices;
+	std::vector<Column> _columns;
+	std::vector<EntityIndex> _dropped;
+};
+
+inline void DeltaWriter::Varint(std::uint64_t value)
+{
+	while (value >= 0x80)
+	{
+		_out.push_back(static_cast<std::byte>(value | 0x80));
+		value >>= 7;
+	}
+
+	_out.push_back(static_cast<std::byte>(value));
+}
+
+inline void DeltaWriter::Entities(const std::vector<EntityIndex>& entities)
+{
+	Varint(entities.size());
+
+	EntityIndex previous = 0;
+	for (auto entity : entities)
+	{
+		Varint(entity - previous);
+		previous = entity;
+	}
+}
+
+inline void DeltaWriter::Bytes(const std::byte* bytes, std::size_t count)
+{
+	_out.insert(_out.end(), bytes, bytes + count);
+}
+
+inline void DeltaWriter::ZeroRuns(const std::byte* bytes, std::size_t count)
+{
+	std::size_t i = 0;
+	while (i < count)
+	{
+		auto zeros = i;
+		while (zeros < count && bytes[zeros] == std::byte(0))
+		{
+			++zeros;
+		}
+
+		// Single zeros stay in the literals; they would cost more as a run.
+		auto literals = zeros;
+		while (literals < count && (bytes[literals] != std::byte(0) ||
+									(literals + 1 < count && bytes[literals + 1] != std::byte(0))))
+		{
+			++literals;
+		}
+
+		Varint(zeros - i);
+		Varint(literals - zeros);
+		Bytes(bytes + zeros, literals - zeros);
+		i = literals;
+	}
+}
+
+inline bool DeltaReader::Varint(OUT std::uint64_t& value)
+{
+	value = 0;
+
+	for (unsigned shift = 0; shift < 64 && _position < _end; shift += 7)
+	{
+		auto byte = static_cast<std::uint64_t>(*_position++);
+		value |= (byte & 0x7F) << shift;
+
+		if ((byte & 0x80) == 0)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+inline bool DeltaReader::Entities(EntityIndex limit, OUT std::vector<EntityIndex>& entities)
+{
+	std::uint64_t count;
+	if (!Varint(OUT count) || count > limit)
+	{
+		return false;
+	}
+
+	entities.resize(count);
+
+	// Strictly ascending and below limit.
+	std::uint64_t entity = 0;
+	for (std::size_t i = 0; i < entities.size(); ++i)
+	{
+		std::uint64_t difference;
+		if (!Varint(OUT difference) || (i > 0 && difference == 0) || difference >= limit - entity)
+		{
+			return false;
+		}
+
+		entity += difference;
+		entities[i] = static_cast<EntityIndex>(entity);
+	}
+
+	return true;
+}
+
+inline bool DeltaReader::Bytes(std::byte* bytes, std::size_t count)
+{
+	if (count > static_cast<std::size_t>(_end - _position))
+	{
+		return false;
+	}
+
+	std::copy_n(_position, count, bytes);
+	_position += count;
+	return true;
+}
+
+inline bool DeltaReader::ZeroRuns(std::byte* bytes, std::size_t count)
+{
+	std::size_t i = 0;
+	while (i < count)
+	{
+		std::uint64_t zeros, literals;
+		if (!Varint(OUT zeros) || !Varint(OUT literals) || zeros > count - i || literals > count - i - zeros ||
+			zeros + literals == 0)
+		{
+			return false;
+		}
+
+		std::fill_n(bytes + i, zeros, std::byte(0));
+		i += zeros;
+
+		if (!Bytes(bytes + i, literals))
+		{
+			return false;
+		}
+		i += literals;
+	}
+
+	return true;
+}
+
+inline void DeltaEncoder::Reset()
+{
+	_manager = nullptr;
+	_tick = 0;
+	_version = NO_VERSION;
+	_generations.clear();
+	_signatures.clear();
+	_freeEntityIndices.clear();
+	_columns.clear();
+	_sentSignatures = 0;
+}
+
+inline bool DeltaEncoder::Encode(const EntityManager& manager, OUT std::vector<std::byte>& out, DeltaCompression compression)
+{
+	if (manager._storageMode != StorageMode::Columns)
+	{
+		return false;
+	}
+
+	const auto& used = manager._usedComponents;
+	for (auto id : used)
+	{
+		if (manager._containers[id] != nullptr && !manager._containers[id]->IsRaw())
+		{
+			return false;
+		}
+	}
+
+	if (_manager != &manager)
+	{
+		Reset();
+		_manager = &manager;
+
+		for (auto id : used)
+		{
+			auto container = manager._containers[id].get();
+			_columns.push_back(Column{ container == nullptr ? 0 : container->ElementSize(), {}, {} });
+		}
+	}
+
+	auto entityCount = static_cast<std::size_t>(manager._firstUsableEntityIndex);
+
+	DeltaWriter writer(out);
+	writer.Varint(DELTA_MAGIC);
+	writer.Varint(static_cast<std::uint64_t>(compression));
+	writer.Varint(_tick);
+	writer.Varint(entityCount);
+	writer.Varint(used.size());
+
+	// Entities new since the last delta count as generation 0 without components.
+	_generations.resize(entityCount, 0);
+	_touched.clear();
+	for (EntityIndex entity = 0; entity < entityCount; ++entity)
+	{
+		if (manager._generations[entity] != _generations[entity])
+		{
+			_touched.push_back(entity);
+			_generations[entity] = manager._generations[entity];
+		}
+	}
+
+	writer.Entities(_touched);
+	for (auto entity : _touched)
+	{
+		writer.Varint(_generations[entity]);
+	}
+
+	// Signatures travel as our IDs. New ones are defined first, by the
+	// positions of their components in UsedComponents, so that processes
+	// that numbered their component types differently agree.
+	const auto& signatures = manager._signatures;
+	writer.Varint(signatures.Count() - _sentSignatures);
+	for (auto id = static_cast<SignatureID>(_sentSignatures); id < signatures.Count(); ++id)
+	{
+		_columnIndices.clear();
+		for (std::size_t column = 0; column < used.size(); ++column)
+		{
+			if (signatures.Contains(id, used[column]))
+			{
+				_columnIndices.push_back(column);
+			}
+		}
+		writer.Entities(_columnIndices);
+	}
+	_sentSignatures = signatures.Count();
+
+	// The columns still need the old signatures; they are replaced last.
+	_signatures.resize(entityCount, EMPTY_SIGNATURE);
+	_touched.clear();
+	for (EntityIndex entity = 0; entity < entityCount; ++entity)
+	{
+		if (manager._signatureByEntity[entity] != _signatures[entity])
+		{
+			_touched.push_back(entity);
+		}
+	}
+
+	writer.Entities(_touched);
+	for (auto entity : _touched)
+	{
+		writer.Varint(manager._signatureByEntity[entity]);
+	}
+
+	auto freeListChanged = manager._freeEntityIndices != _freeEntityIndices;
+	writer.Varint(freeListChanged ? 1 : 0);
+	if (freeListChanged)
+	{
+		_freeEntityIndices = manager._freeEntityIndices;
+		writer.Varint(_freeEntityIndices.size());
+		for (auto entity : _freeEntityIndices)
+		{
+			writer.Varint(entity);
+		}
+	}
+
+	for (std::size_t column = 0; column < used.size(); ++column)
+	{
+		EncodeColumn(manager, column, compression, writer);
+	}
+
+	for (auto entity : _touched)
+	{
+		_signatures[entity] = manager._signatureByEntity[entity];
+	}
+
+	// Writes made at this version after now still count as changes next time.
+	_version = manager.Version();
+	++_tick;
+	return true;
+}
+
+// Components the entity did not have before are added and sent as they are;
+// the others are sent if their bytes differ from before.
+inline void DeltaEncoder::EncodeColumn(const EntityManager& manager, std::size_t index, DeltaCompression compression,
+									   DeltaWriter& writer)
+{
+	auto id = manager._usedComponents[index];
+	if (manager._containers[id] == nullptr)
+	{
+		return;
+	}
+
+	const auto& container = *manager._containers[id];
+	auto policy = container.Policy();
+	auto& previous = _columns[index];
+	auto size = previous.elementSize;
+	const auto& signatures = manager._signatures;
+
+	_added.clear();
+	_changed.clear();
+
+	auto compare = [&](EntityIndex entity)
+	{
+		if (!signatures.Contains(_signatures[entity], id))
+		{
+			_added.push_back(entity);
+		}
+		else if (container.ChangedVersion(entity) >= _version &&
+				 std::memcmp(container.RawGet(entity), Previous(previous, policy, entity), size) != 0)
+		{
+			_changed.push_back(entity);
+		}
+	};
+
+	if (policy == StoragePolicy::Dense)
+	{
+		auto entityCount = static_cast<EntityIndex>(manager._firstUsableEntityIndex);
+		previous.values.resize(entityCount * size);
+
+		for (EntityIndex entity = 0; entity < entityCount; ++entity)
+		{
+			if (container.RangeVersion(entity) < _version)
+			{
+				entity = (entity / ComponentContainerBase::CHANGE_RANGE_SIZE + 1) * ComponentContainerBase::CHANGE_RANGE_SIZE - 1;
+			}
+			else if (signatures.Contains(manager._signatureByEntity[entity], id))
+			{
+				compare(entity);
+			}
+		}
+	}
+	else
+	{
+		for (auto entity : container.Owners())
+		{
+			compare(entity);
+		}
+
+		std::sort(_added.begin(), _added.end());
+		std::sort(_changed.begin(), _changed.end());
+	}
+
+	_addedBytes.resize(_added.size() * size);
+	for (std::size_t i = 0; i < _added.size(); ++i)
+	{
+		std::memcpy(_addedBytes.data() + i * size, container.RawGet(_added[i]), size);
+	}
+
+	_changedBytes.resize(_changed.size() * size);
+	for (std::size_t i = 0; i < _changed.size(); ++i)
+	{
+		auto current = container.RawGet(_changed[i]);
+		auto target = _changedBytes.data() + i * size;
+
+		if (compression == DeltaCompression::XorRle)
+		{
+			auto old = Previous(previous, policy, _changed[i]);
+			for (std::size_t byte = 0; byte < size; ++byte)
+			{
+				target[byte] = current[byte] ^ old[byte];
+			}
+		}
+		else
+		{
+			std::memcpy(target, current, size);
+		}
+	}
+
+	auto writeBytes = [&](const std::vector<std::byte>& bytes)
+	{
+		compression == DeltaCompression::XorRle ? writer.ZeroRuns(bytes.data(), bytes.size())
+												: writer.Bytes(bytes.data(), bytes.size());
+	};
+
+	writer.Varint(size);
+	writer.Entities(_added);
+	writeBytes(_addedBytes);
+	writer.Entities(_changed);
+	writeBytes(_changedBytes);
+
+	if (policy == StoragePolicy::Dense)
+	{
+		for (auto entities : { &_added, &_changed })
+		{
+			for (auto entity : *entities)
+			{
+				std::memcpy(previous.values.data() + entity * size, container.RawGet(entity), size);
+			}
+		}
+	}
+	else
+	{
+		previous.owners = container.Owners();
+		std::sort(previous.owners.begin(), previous.owners.end());
+
+		previous.values.resize(previous.owners.size() * size);
+		for (std::size_t i = 0; i < previous.owners.size(); ++i)
+		{
+			std::memcpy(previous.values.data() + i * size, container.RawGet(previous.owners[i]), size);
+		}
+	}
+}
+
+inline const std::byte* DeltaEncoder::Previous(const Column& column, StoragePolicy policy, EntityIndex entity)
+{
+	if (policy == StoragePolicy::Dense)
+	{
+		return column.values.data() + entity * column.elementSize;
+	}
+
+	auto slot = std::lower_bound(column.owners.begin(), column.owners.end(), entity) - column.owners.begin();
+	assert(slot < static_cast<std::ptrdiff_t>(column.owners.size()) && column.owners[slot] == entity);
+	return column.values.data() + slot * column.elementSize;
+}
+
+inline bool DeltaDecoder::Apply(EntityManager& replica, const std::byte* data, std::size_t size)
+{
+	if (replica._storageMode != StorageMode::Columns)
+	{
+		return false;
+	}
+
+	const auto& used = replica._usedComponents;
+	DeltaReader reader(data, size);
+
+	std::uint64_t magic, compressionValue, fromTick, entityCount, columnCount;
+	if (!reader.Varint(OUT magic) || magic != DELTA_MAGIC ||
+		!reader.Varint(OUT compressionValue) || compressionValue > static_cast<std::uint64_t>(DeltaCompression::XorRle) ||
+		!reader.Varint(OUT fromTick) || fromTick != _tick ||
+		!reader.Varint(OUT entityCount) || entityCount > 0xFFFFFFFFu ||
+		!reader.Varint(OUT columnCount) || columnCount != used.size())
+	{
+		return false;
+	}
+
+	auto compression = static_cast<DeltaCompression>(compressionValue);
+	auto limit = static_cast<EntityIndex>(entityCount);
+
+	if (!reader.Entities(limit, OUT _generationEntities))
+	{
+		return false;
+	}
+
+	_generations.resize(_generationEntities.size());
+	for (auto& generation : _generations)
+	{
+		std::uint64_t value;
+		if (!reader.Varint(OUT value) || value > 0xFFFFFFFFu)
+		{
+			return false;
+		}
+		generation = static_cast<EntityGeneration>(value);
+	}
+
+	std::uint64_t newSignatureCount;
+	if (!reader.Varint(OUT newSignatureCount) || newSignatureCount > size)
+	{
+		return false;
+	}
+
+	_newSignatures.resize(newSignatureCount);
+	for (auto& signature : _newSignatures)
+	{
+		if (!reader.Entities(used.size(), OUT _columnIndices))
+		{
+			return false;
+		}
+
+		signature.reset();
+		for (auto column : _columnIndices)
+		{
+			signature.set(used[column]);
+		}
+	}
+
+	if (!reader.Entities(limit, OUT _signatureEntities))
+	{
+		return false;
+	}
+
+	_signatures.resize(_signatureEntities.size());
+	for (auto& signature : _signatures)
+	{
+		std::uint64_t id;
+		if (!reader.Varint(OUT id) || id >= _signatureIds.size() + _newSignatures.size())
+		{
+			return false;
+		}
+		signature = static_cast<SignatureID>(id);
+	}
+
+	std::uint64_t freeListChanged;
+	if (!reader.Varint(OUT freeListChanged) || freeListChanged > 1)
+	{
+		return false;
+	}
+
+	if (freeListChanged)
+	{
+		std::uint64_t count;
+		if (!reader.Varint(OUT count) || count > entityCount)
+		{
+			return false;
+		}
+
+		_freeEntityIndices.resize(count);
+		for (auto& entity : _freeEntityIndices)
+		{
+			std::uint64_t value;
+			if (!reader.Varint(OUT value) || value >= entityCount)
+			{
+				return false;
+			}
+			entity = static_cast<EntityIndex>(value);
+		}
+	}
+
+	_columns.resize(used.size());
+	for (std::size_t column = 0; column < used.size(); ++column)
+	{
+		auto& decoded = _columns[column];
+		decoded.added.clear();
+		decoded.changed.clear();
+		if (replica._containers[used[column]] == nullptr)
+		{
+			continue;
+		}
+
+		const auto& container = *replica._containers[used[column]];
+
+		std::uint64_t elementSize;
+		if (!reader.Varint(OUT elementSize) || elementSize != container.ElementSize() || !container.IsRaw() ||
+			!reader.Entities(limit, OUT decoded.added) ||
+			!ReadBytes(reader, compression, decoded.added.size() * elementSize, OUT decoded.addedBytes) ||
+			!reader.Entities(limit, OUT decoded.changed) ||
+			!ReadBytes(reader, compression, decoded.changed.size() * elementSize, OUT decoded.changedBytes))
+		{
+			return false;
+		}
+	}
+
+	if (!reader.AtEnd())
+	{
+		return false;
+	}
+
+	// A compacted source drops indices; whatever the replica still has
+	// there was moved or destroyed at the source.
+	if (limit < replica._firstUsableEntityIndex)
+	{
+		_dropped.clear();
+		for (auto entity = limit; entity < replica._firstUsableEntityIndex; ++entity)
+		{
+			if (replica._signatureByEntity[entity] != EMPTY_SIGNATURE)
+			{
+				_dropped.push_back(entity);
+			}
+		}
+
+		replica.DestroyEntities(_dropped);
+		replica.TruncateEntities(limit);
+	}
+
+	if (entityCount > replica._firstUsableEntityIndex)
+	{
+		// New entities start at generation 0 on the encoder's side, whatever
+		// this replica retired when it last shrank.
+		auto first = replica._firstUsableEntityIndex;
+		replica.CreateContainersForNewEntities(limit - first);
+		std::fill(replica._generations.begin() + first, replica._generations.end(), EntityGeneration(0));
+		replica._firstUsableEntityIndex = limit;
+	}
+
+	for (std::size_t i = 0; i < _generationEntities.size(); ++i)
+	{
+		replica._generations[_generationEntities[i]] = _generations[i];
+	}
+
+	for (const auto& signature : _newSignatures)
+	{
+		_signatureIds.push_back(replica._signatures.Intern(signature));
+	}
+
+	// Components that went away are removed before the new ones are written.
+	_signaturesBefore.resize(_signatureEntities.size());
+	for (std::size_t i = 0; i < _signatureEntities.size(); ++i)
+	{
+		auto entity = _signatureEntities[i];
+		auto before = replica._signatureByEntity[entity];
+		auto after = _signatureIds[_signatures[i]];
+		replica.LeaveGroups(entity, replica._signatures.Get(before), replica._signatures.Get(after));
+
+		for (auto id : used)
+		{
+			if (replica._signatures.Contains(before, id) && !replica._signatures.Contains(after, id) &&
+				replica._containers[id] != nullptr)
+			{
+				replica._containers[id]->Remove(entity);
+			}
+		}
+
+		_signaturesBefore[i] = before;
+		replica._signatureByEntity[entity] = after;
+	}
+
+	for (std::size_t column = 0; column < used.size(); ++column)
+	{
+		if (replica._containers[used[column]] == nullptr)
+		{
+			continue;
+		}
+
+		auto& container = *replica._containers[used[column]];
+		const auto& decoded = _columns[column];
+		auto elementSize = container.ElementSize();
+
+		for (std::size_t i = 0; i < decoded.added.size(); ++i)
+		{
+			std::memcpy(container.RawAcquire(decoded.added[i]), decoded.addedBytes.data() + i * elementSize, elementSize);
+			container.MarkAdded(decoded.added[i]);
+		}
+
+		for (std::size_t i = 0; i < decoded.changed.size(); ++i)
+		{
+			auto target = container.RawAcquire(decoded.changed[i]);
+			auto source = decoded.changedBytes.data() + i * elementSize;
+
+			if (compression == DeltaCompression::XorRle)
+			{
+				for (std::size_t byte = 0; byte < elementSize; ++byte)
+				{
+					target[byte] ^= source[byte];
+				}
+			}
+			else
+			{
+				std::memcpy(target, source, elementSize);
+			}
+		}
+	}
+
+	for (std::size_t i = 0; i < _signatureEntities.size(); ++i)
+	{
+		auto before = replica._signatures.Get(_signaturesBefore[i]);
+		replica.JoinGroups(_signatureEntities[i], before, replica.GetSignature(_signatureEntities[i]));
+		replica.UpdateQueries(_signatureEntities[i], before);
+	}
+
+	if (freeListChanged)
+	{
+		replica._freeEntityIndices = _freeEntityIndices;
+	}
+
+	_tick = fromTick + 1;
+	return true;
+}
+
+inline bool DeltaDecoder::ReadBytes(DeltaReader& reader, DeltaCompression compression, std::size_t count,
+									OUT std::vector<std::byte>& bytes)
+{
+	bytes.resize(count);
+	return compression == DeltaCompression::XorRle ? reader.ZeroRuns(bytes.data(), count) : reader.Bytes(bytes.data(), count);
+}
@@ -1,68 +1,258 @@
 #pragma once
 #include <iostream>
+#include <algorithm>
 #include <array>
-#include <stack>
+#include <cassert>
 #include <vector>
 #include <bitset>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <numeric>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 
 #include "Component.h"
+#include "EntityHandle.h"
+#include "FunctionTraits.h"
+#include "Group.h"
+#include "Archetype.h"
+#include "Profile.h"
+#include "Query.h"
+#include "SignatureMatch.h"
+#include "ThreadPool.h"
 
-#define OUT
-
-constexpr std::size_t MAX_COMPONENT_COUNT = 32;
-
-using EntityIndex = std::size_t;
-using ComponentID = std::size_t;
-using EntityFilter = std::bitset<MAX_COMPONENT_COUNT>;
+constexpr std::size_t DEFAULT_GRAIN_SIZE = 4096;
 
 class EntityManager
 {
 public:
+	// All component storage is taken from allocator, which must outlive the manager.
 	template<typename ... Ts>
-	EntityManager(UsedComponents<Ts...> usedComponents)
+	EntityManager(UsedComponents<Ts...> usedComponents, StorageMode storageMode = StorageMode::Columns,
+				  Allocator& allocator = DefaultAllocator())
+		: _storageMode{ storageMode }, _allocator{ allocator }, _archetypes{ allocator }
 	{
+		_archetypes.SetClock(&_changeVersion);
 		SetupContainers<Ts...>();
 	}
 
-	~EntityManager()
-	{
-		CleanupContainers();
-	}
-
 	inline int EntityCount() const { return _firstUsableEntityIndex - _freeEntityIndices.size(); }
+	inline EntityFilter GetSignature(EntityIndex entity) const { return _signatures.Get(_signatureByEntity[entity]); }
 	EntityIndex CreateEntity();
 	void DestroyEntity(EntityIndex entity);
 
+	// Handles stay comparable across frames; IsValid turns false as soon as
+	// the entity is destroyed, even if its index has been reused since.
+	inline EntityHandle GetHandle(EntityIndex entity) const { return EntityHandle(entity, _generations[entity]); }
+	inline bool IsValid(EntityHandle handle) const
+	{
+		return handle.Index() < _generations.size() && _generations[handle.Index()] == handle.Generation();
+	}
+
+	// A Compactor moving an entity invalidates its handles, but leaves a
+	// forwarding entry: Resolve returns the current handle of the entity a
+	// handle was taken from, or the handle itself if that entity is gone.
+	// Entries pile up until cleared, normally once stored handles are updated.
+	EntityHandle Resolve(EntityHandle handle) const;
+	inline std::size_t ForwardingCount() const { return _forwarding.size(); }
+	inline void ClearForwarding() { _forwarding.clear(); }
+
 	template <typename T> bool HasComponent(EntityIndex entity) const;
+	// Moves component in if it is an rvalue, so move-only types work. Emplace
+	// constructs T from args where it is stored, replacing any T the entity
+	// had. Removed components are destroyed at once.
 	template <typename T> void SetComponent(EntityIndex entity, T&& component);
+	template <typename T, typename ... Args> void EmplaceComponent(EntityIndex entity, Args&&... args);
 	template <typename T> void RemoveComponent(EntityIndex entity);
 	template <typename T> T GetComponent(EntityIndex entity) const;
 	template <typename ... Ts> EntityIndex CreateEntityWithComponents(Ts... components);
 	template <typename T> ComponentContainer<T>& GetContainer() const;
+
+	// Bulk versions of CreateEntityWithComponents and DestroyEntity: containers
+	// grow once for all new entities, and signatures and queries are updated in
+	// one pass. entities receives the created indices.
+	template <typename ... Ts>
+	void CreateEntities(std::size_t count, OUT std::vector<EntityIndex>& entities, const Ts&... components);
+	// generator(i, Ts&... components) fills in the components of the i-th new entity.
+	template <typename ... Ts, typename Generator,
+			  typename = std::enable_if_t<std::is_invocable_v<Generator&, std::size_t, Ts&...>>>
+	void CreateEntities(std::size_t count, OUT std::vector<EntityIndex>& entities, Generator&& generator);
+	void DestroyEntities(const EntityIndex* entities, std::size_t count);
+	void DestroyEntities(const std::vector<EntityIndex>& entities);
 	
 	void GetEntities(const std::bitset<MAX_COMPONENT_COUNT>& filter,
 					 OUT std::vector<EntityIndex>& entities) const;
 
+	// Only available with StorageMode::Archetypes; calls func(ChunkView) for every
+	// chunk whose signature contains filter.
+	template <typename Func> void ForEachChunk(const EntityFilter& filter, Func&& func) const;
+
+	// The returned query lives as long as the manager and is kept up to date
+	// on every signature change, instead of rescanning in GetEntities.
+	// Registering the same filter twice returns the same query. Safe to call
+	// from several systems at once.
+	Query& RegisterQuery(const EntityFilter& filter);
+
+	// Columns only. Keeps the entities that have all of Ts packed at the front
+	// of their containers, which must be sparse and owned by no other group;
+	// see Group.h. Registering the same types twice returns the same group.
+	// Not safe to call while systems run.
+	template <typename ... Ts> Group& RegisterGroup();
+
+	// Observers learn which entities started or stopped matching a filter, in
+	// batches: changes are noted as signatures change, and FlushObservers
+	// hands them over as sorted spans, entities that stopped first. Entities
+	// matching on registration count as started. Only the net change since the
+	// previous flush is reported, except that an entity whose index was reused
+	// in between stops and starts. Changes made by the callbacks wait for the
+	// next flush; callbacks must not register observers. Not safe to call
+	// while systems run.
+	using ObserverCallback = std::function<void(const EntityIndex* entities, std::size_t count)>;
+	void Observe(const EntityFilter& filter, ObserverCallback onMatch, ObserverCallback onUnmatch = nullptr);
+	template <typename T> inline void OnAdded(ObserverCallback callback) { Observe(MakeFilter<T>(), std::move(callback)); }
+	template <typename T> inline void OnRemoved(ObserverCallback callback) { Observe(MakeFilter<T>(), nullptr, std::move(callback)); }
+	void FlushObservers();
+
+	// Calls func with references to the components of every entity that has
+	// all of them. The component types are taken from func's parameters:
+	//		Each([](Position& position, const Velocity& velocity) { ... });
+	// An optional leading EntityIndex parameter receives the entity. Types can
+	// also be given explicitly, as in Each<Position, Velocity>(func).
+	template <typename ... Ts, typename Func> void Each(Func&& func);
+
+	// Every component write is stamped with the current version. NextVersion
+	// ends it and returns it, so a system that calls it before running sees
+	// everything written since its last run as newer than what it returned then.
+	inline ChangeVersion Version() const { return _changeVersion; }
+	inline ChangeVersion NextVersion() { return _changeVersion++; }
+
+	// Like Each, but only visits entities passing all Filters, which are
+	// Changed<T> or Added<T> relative to version since:
+	//		Each<Changed<Position>>(lastRun, [](EntityIndex entity, const Position& position) { ... });
+	// Writes through mutable component references count as changes. Columns
+	// track versions per entity and skip blocks without any change; archetypes
+	// track them per chunk and visit every entity of a chunk that changed.
+	template <typename ... Filters, typename Func> void Each(ChangeVersion since, Func&& func);
+
+	// Like Each, but spread over the pool in ranges of about grainSize entities.
+	// Ranges never share a cache line of a component column, so writes from
+	// different threads don't false-share. func must be safe to call concurrently.
+	template <typename ... Ts, typename Func>
+	void ParallelEach(ThreadPool& pool, Func&& func, std::size_t grainSize = DEFAULT_GRAIN_SIZE);
+
+	// One entry per used component type other than tags, in the order of
+	// UsedComponents.
+	// Cheap enough for an occasional snapshot, but scans all signatures.
+	std::vector<ContainerStats> ContainerStatistics() const;
+
 private:
+	friend class Snapshot;
+	friend class DeltaEncoder;
+	friend class DeltaDecoder;
+	friend class Compactor;
+
 	bool TryReuseEntityIndex(OUT EntityIndex& entityIndex);
-	void CreateContainersForNewEntity();
-	void CleanupContainers();
+	// An index with an empty signature, reused or appended.
+	EntityIndex NewEntityIndex();
+	void CreateContainersForNewEntities(std::size_t count);
+	void SwapEntities(EntityIndex a, EntityIndex b);
+	void TruncateEntities(EntityIndex count);
 	
 	template <typename ... Ts> void SetupContainers();
 	template <typename T> void SetupContainer();
 
+	template <typename T> void ComponentAdded(EntityIndex entity, const EntityFilter& before);
+	void UpdateQueries(EntityIndex entity, ComponentID changed, const EntityFilter& before);
+	void UpdateQueries(EntityIndex entity, const EntityFilter& before);
+	void PopulateQueries();
+	void PopulateGroups();
+	void LeaveGroups(EntityIndex entity, const EntityFilter& before, const EntityFilter& after);
+	void JoinGroups(EntityIndex entity, const EntityFilter& before, const EntityFilter& after);
+	Query& FindOrAddQuery(const EntityFilter& filter);
+	const Query& SortedQuery(const EntityFilter& filter);
+
+	struct VersionFilters
+	{
+		ChangeVersion since;
+		std::vector<VersionFilter> filters;
+	};
+
+	// Component types keep their const; only non-const ones are marked as changed.
+	template <typename Func, typename First, typename ... Rest>
+	void EachDeduced(Func& func, ThreadPool* pool, std::size_t grainSize, TypeList<First, Rest...>,
+					 const VersionFilters* versionFilters = nullptr);
+	template <bool WithEntity, typename ... Ts, typename Func>
+	void EachMatching(Func& func, const VersionFilters* versionFilters = nullptr);
+	template <bool WithEntity, typename ... Ts, typename Func>
+	void ParallelEachMatching(Func& func, ThreadPool& pool, std::size_t grainSize);
+	template <bool WithEntity, typename ... Ts, typename Func, typename ... Containers>
+	static void EachInColumns(Func& func, const EntityIndex* entities, std::size_t count, Containers&&... containers);
+	bool PassesVersionFilters(const ChunkView& chunk, const VersionFilters& versionFilters) const;
+	void FilterByVersion(const std::vector<EntityIndex>& entities, const VersionFilters& versionFilters,
+						 OUT std::vector<EntityIndex>& passing) const;
+	template <typename Generator, typename ... Containers>
+	static void FillColumns(Generator& generator, const std::vector<EntityIndex>& entities, Containers&&... containers);
+	template <bool WithEntity, typename Func, typename ... Columns>
+	static void EachInArrays(Func& func, std::size_t count, const EntityIndex* entities, Columns... columns);
+
+	// Where a tag is asked for, these hand out a TagContainer instead.
+	template <typename T> decltype(auto) ColumnFor() const;
+	template <typename T> static decltype(auto) ChunkColumn(const ChunkView& chunk);
+	template <typename T> static T& ConstructInRow(Archetype& archetype, std::size_t row);
+
+	StorageMode _storageMode;
+	Allocator& _allocator;
+	ChangeVersion _changeVersion = 1;
+
+	// Components in the order of UsedComponents, and a loaded snapshot that
+	// columns may still borrow from; declared before the containers to outlive them.
+	std::vector<ComponentID> _usedComponents;
+	EntityFilter _tags;
+	std::shared_ptr<const void> _snapshotMemory;
+	ArchetypeStorage _archetypes;
+
 	EntityIndex _firstUsableEntityIndex = 0;
-	std::stack<EntityIndex> _freeEntityIndices;
+	std::vector<EntityIndex> _freeEntityIndices;
+	std::vector<EntityGeneration> _generations;
+	// New indices start above every generation of an index that was
+	// truncated, so that old handles to it cannot validate again.
+	EntityGeneration _retiredGeneration = 0;
+	std::unordered_map<EntityHandle, EntityHandle> _forwarding;
+
+	std::array<std::unique_ptr<ComponentContainerBase>, MAX_COMPONENT_COUNT> _containers;
+	SignatureTable _signatures;
+	std::vector<SignatureID> _signatureByEntity;
+
+	std::vector<std::unique_ptr<Query>> _queries;
+	std::unordered_map<EntityFilter, Query*> _queryByFilter;
+	std::mutex _queryMutex;
+	std::array<std::vector<Query*>, MAX_COMPONENT_COUNT> _queriesByComponent;
+
+	std::vector<std::unique_ptr<Group>> _groups;
+	std::array<Group*, MAX_COMPONENT_COUNT> _groupByComponent{};
+
+	struct Observer
+	{
+		Query* query;
+		ObserverCallback onMatch;
+		ObserverCallback onUnmatch;
+		// Per entity, the generation it was last reported matching with.
+		std::vector<EntityGeneration> reported;
+		std::vector<EntityIndex> pending;
+	};
 
-	std::array<ComponentContainerBase*, MAX_COMPONENT_COUNT> _containers;
-	std::vector<std::bitset<MAX_COMPONENT_COUNT>> _componentsByEntityIndex;
+	static constexpr EntityGeneration NOT_REPORTED = static_cast<EntityGeneration>(-1);
+	std::vector<Observer> _observers;
 };
 
 template<typename T> ComponentContainer<T>& EntityManager::GetContainer() const
 {
+	static_assert(!IsTag<T>, "Tags have no container");
+	assert(_storageMode == StorageMode::Columns);
 	static ComponentID id = GetComponentID<T>();
-	auto ptr = reinterpret_cast<ComponentContainer<T>*>(_containers[id]);
+	auto ptr = static_cast<ComponentContainer<T>*>(_containers[id].get());
 	return *ptr;
 }
 
@@ -70,120 +260,1186 @@ void EntityManager::GetEntities(const std::bitset<MAX_COMPONENT_COUNT>& filter,
 								std::vector<EntityIndex>& entities) const
 {
 	entities.clear();
+	ECS_PROFILE_SCOPE(profile, "query", "GetEntities", filter);
 
-	for (EntityIndex i = 0; i < _firstUsableEntityIndex; ++i)
+	if (_storageMode == StorageMode::Archetypes)
 	{
-		if ((_componentsByEntityIndex[i] & filter) == filter)
+		_archetypes.ForEachArchetype(filter, [&](const Archetype& archetype)
 		{
-			entities.push_back(i);
+			for (std::size_t chunk = 0; chunk < archetype.ChunkCount(); ++chunk)
+			{
+				auto first = archetype.Entities(chunk);
+				entities.insert(entities.end(), first, first + archetype.CountInChunk(chunk));
+			}
+		});
+		ECS_PROFILE_COUNT(profile, entities.size(), entities.size());
+		return;
+	}
+
+	// A sparse type in the filter bounds the result by its owners, so only
+	// those need to be checked instead of every signature.
+	const ComponentContainerBase* smallest = nullptr;
+	for (auto id : _usedComponents)
+	{
+		auto container = _containers[id].get();
+		if (filter[id] && container != nullptr && container->Policy() == StoragePolicy::Sparse &&
+			(smallest == nullptr || container->Owners().size() < smallest->Owners().size()))
+		{
+			smallest = container;
+		}
+	}
+
+	SignatureMatchTable matchTable(_signatures, filter);
+
+	if (smallest != nullptr)
+	{
+		for (auto entity : smallest->Owners())
+		{
+			if (matchTable.Matches(_signatureByEntity[entity]))
+			{
+				entities.push_back(entity);
+			}
 		}
+
+		std::sort(entities.begin(), entities.end());
+		ECS_PROFILE_COUNT(profile, smallest->Owners().size(), entities.size());
+		return;
 	}
+
+	MatchSignatureIDs(_signatureByEntity.data(), _firstUsableEntityIndex, matchTable, OUT entities);
+	ECS_PROFILE_COUNT(profile, matchTable.MatchCount() == 0 ? 0 : _firstUsableEntityIndex, entities.size());
 }
 
-template <typename T> T EntityManager::GetComponent(EntityIndex entity) const
+template <typename Func> void EntityManager::ForEachChunk(const EntityFilter& filter, Func&& func) const
 {
-	auto container = GetContainer<T>();
-	return container.Get(entity);
+	assert(_storageMode == StorageMode::Archetypes);
+
+	_archetypes.ForEachArchetype(filter, [&](const Archetype& archetype)
+	{
+		for (std::size_t chunk = 0; chunk < archetype.ChunkCount(); ++chunk)
+		{
+			if (archetype.CountInChunk(chunk) > 0)
+			{
+				func(ChunkView(archetype, chunk));
+			}
+		}
+	});
 }
 
-template <typename T> bool EntityManager::HasComponent(EntityIndex entity) const
+template <typename ... Ts, typename Func> void EntityManager::Each(Func&& func)
 {
-	static ComponentID id = GetComponentID<T>();
-	return _componentsByEntityIndex[entity][id] == 1;
+	if constexpr (sizeof...(Ts) == 0)
+	{
+		EachDeduced(func, nullptr, 0, typename FunctionTraits<std::decay_t<Func>>::Arguments());
+	}
+	else
+	{
+		EachMatching<std::is_invocable_v<Func&, EntityIndex, Ts&...>, Ts...>(func);
+	}
 }
 
-template <typename T> void EntityManager::RemoveComponent(EntityIndex entity)
+template <typename ... Filters, typename Func> void EntityManager::Each(ChangeVersion since, Func&& func)
 {
-	static ComponentID id = GetComponentID<T>();
-	_componentsByEntityIndex[entity][id] = 0;
+	VersionFilters versionFilters{ since, { MakeVersionFilter(Filters())... } };
+	EachDeduced(func, nullptr, 0, typename FunctionTraits<std::decay_t<Func>>::Arguments(), &versionFilters);
 }
 
-template <typename T> void EntityManager::SetComponent(EntityIndex entity, T&& component)
+template <typename ... Ts, typename Func>
+void EntityManager::ParallelEach(ThreadPool& pool, Func&& func, std::size_t grainSize)
 {
-	static ComponentID id = GetComponentID<T>();
-	
-	auto container = reinterpret_cast<ComponentContainer<T>*>(_containers[id]);
-	_componentsByEntityIndex[entity].set(id, true);
-	container->Set(entity, std::forward<T>(component));
+	if constexpr (sizeof...(Ts) == 0)
+	{
+		EachDeduced(func, &pool, grainSize, typename FunctionTraits<std::decay_t<Func>>::Arguments());
+	}
+	else
+	{
+		ParallelEachMatching<std::is_invocable_v<Func&, EntityIndex, Ts&...>, Ts...>(func, pool, grainSize);
+	}
 }
 
-template <typename... Ts> void EntityManager::SetupContainers()
+template <typename Func, typename First, typename ... Rest>
+void EntityManager::EachDeduced(Func& func, ThreadPool* pool, std::size_t grainSize, TypeList<First, Rest...>,
+								const VersionFilters* versionFilters)
 {
-	_containers.fill(nullptr);
-	auto _ = { (SetupContainer<Ts>(), 0)... };
+	constexpr auto withEntity = std::is_same_v<std::decay_t<First>, EntityIndex>;
+
+	if constexpr (withEntity)
+	{
+		pool == nullptr ? EachMatching<true, std::remove_reference_t<Rest>...>(func, versionFilters)
+						: ParallelEachMatching<true, std::remove_reference_t<Rest>...>(func, *pool, grainSize);
+	}
+	else
+	{
+		pool == nullptr ? EachMatching<false, std::remove_reference_t<First>, std::remove_reference_t<Rest>...>(func, versionFilters)
+						: ParallelEachMatching<false, std::remove_reference_t<First>, std::remove_reference_t<Rest>...>(func, *pool, grainSize);
+	}
 }
 
-template <typename T> void EntityManager::SetupContainer()
+// Containers and chunk columns are resolved once per call; the per-entity
+// loops below only index into them.
+template <bool WithEntity, typename ... Ts, typename Func>
+void EntityManager::EachMatching(Func& func, const VersionFilters* versionFilters)
 {
-	auto id = GetComponentID<T>();
-	_containers[id] = new ComponentContainer<T>();
+	auto filter = MakeFilter<Ts...>();
+	if (versionFilters != nullptr)
+	{
+		for (const auto& versionFilter : versionFilters->filters)
+		{
+			filter.set(versionFilter.id, true);
+		}
+	}
+
+	ECS_PROFILE_SCOPE(profile, "query", "Each", filter);
+
+	if (_storageMode == StorageMode::Archetypes)
+	{
+		ForEachChunk(filter, [&](const ChunkView& chunk)
+		{
+			if (versionFilters == nullptr || PassesVersionFilters(chunk, *versionFilters))
+			{
+				ECS_PROFILE_COUNT(profile, chunk.Count(), chunk.Count());
+				EachInArrays<WithEntity>(func, chunk.Count(), chunk.Entities(), ChunkColumn<Ts>(chunk)...);
+			}
+			else
+			{
+				ECS_PROFILE_COUNT(profile, chunk.Count(), 0);
+			}
+		});
+		return;
+	}
+
+	const auto& entities = SortedQuery(filter).Entities();
+	if (versionFilters == nullptr)
+	{
+		ECS_PROFILE_COUNT(profile, entities.size(), entities.size());
+		EachInColumns<WithEntity, Ts...>(func, entities.data(), entities.size(), ColumnFor<std::remove_const_t<Ts>>()...);
+		return;
+	}
+
+	std::vector<EntityIndex> passing;
+	FilterByVersion(entities, *versionFilters, OUT passing);
+	ECS_PROFILE_COUNT(profile, entities.size(), passing.size());
+	EachInColumns<WithEntity, Ts...>(func, passing.data(), passing.size(), ColumnFor<std::remove_const_t<Ts>>()...);
 }
 
-//TODO: Forward components to CreateEntity;
-//		otherwise it's a bit stupid to create new default component and
-//		then override it - although it actually does make sense,
-//		because in this multi-array setup, many items will be unused and
-//		thus empty. So they _should_ have the default value.
-template <typename... Ts> EntityIndex EntityManager::CreateEntityWithComponents(Ts... components)
+template <bool WithEntity, typename ... Ts, typename Func>
+void EntityManager::ParallelEachMatching(Func& func, ThreadPool& pool, std::size_t grainSize)
 {
-	auto entity = CreateEntity();
+	auto filter = MakeFilter<Ts...>();
+	ECS_PROFILE_SCOPE(profile, "query", "ParallelEach", filter);
+
+	if (_storageMode == StorageMode::Archetypes)
+	{
+		// Chunks are separate allocations with cache-line aligned columns,
+		// so they can be handed out as they are.
+		std::vector<ChunkView> chunks;
+		std::size_t chunkCapacity = 1;
+		ForEachChunk(filter, [&](const ChunkView& chunk)
+		{
+			chunks.push_back(chunk);
+			chunkCapacity = std::max(chunkCapacity, chunk.Capacity());
+			ECS_PROFILE_COUNT(profile, chunk.Count(), chunk.Count());
+		});
 
-	auto _ = { (SetComponent<Ts>(entity, std::forward<Ts>(components)), 0)... };
+		pool.ParallelFor(chunks.size(), std::max<std::size_t>(grainSize / chunkCapacity, 1),
+						 [&](std::size_t begin, std::size_t end)
+		{
+			for (auto i = begin; i < end; ++i)
+			{
+				EachInArrays<WithEntity>(func, chunks[i].Count(), chunks[i].Entities(), ChunkColumn<Ts>(chunks[i])...);
+			}
+		});
+		return;
+	}
 
-	return entity;
+	const auto& entities = SortedQuery(filter).Entities();
+	auto count = entities.size();
+	ECS_PROFILE_COUNT(profile, count, count);
+
+	// Entities in the same cache line of any dense column belong to the same
+	// range: with lineGroup entities per group, every group boundary is a cache
+	// line boundary in every dense column, change versions included. Sparse
+	// components are packed by slot, so neighbouring ranges may still share
+	// their lines.
+	constexpr std::size_t lineGroup = std::max({ CACHE_LINE_SIZE / std::gcd(sizeof(ChangeVersion), CACHE_LINE_SIZE),
+												 (CACHE_LINE_SIZE / std::gcd(sizeof(Ts), CACHE_LINE_SIZE))... });
+	auto line = [&](std::size_t position) { return entities[position] / lineGroup; };
+
+	pool.ParallelFor(count, grainSize, [&](std::size_t begin, std::size_t end)
+	{
+		while (begin > 0 && begin < end && line(begin) == line(begin - 1))
+		{
+			++begin;
+		}
+
+		while (end < count && end > begin && line(end) == line(end - 1))
+		{
+			++end;
+		}
+
+		if (begin < end)
+		{
+			EachInColumns<WithEntity, Ts...>(func, entities.data() + begin, end - begin,
+											 ColumnFor<std::remove_const_t<Ts>>()...);
+		}
+	});
 }
 
-void EntityManager::CleanupContainers()
+template <bool WithEntity, typename ... Ts, typename Func, typename ... Containers>
+void EntityManager::EachInColumns(Func& func, const EntityIndex* entities, std::size_t count, Containers&&... containers)
 {
-	for (auto& container : _containers)
+	// Going through the const Get for const components keeps them unmarked.
+	auto get = [](auto& container, EntityIndex entity, auto* type) -> decltype(auto)
+	{
+		using T = std::remove_pointer_t<decltype(type)>;
+		if constexpr (std::is_const_v<T>)
+		{
+			return std::as_const(container).Get(entity);
+		}
+		else
+		{
+			return container.Get(entity);
+		}
+	};
+
+	for (std::size_t i = 0; i < count; ++i)
 	{
-		delete container;
+		auto entity = entities[i];
+		if constexpr (WithEntity)
+		{
+			func(entity, get(containers, entity, static_cast<Ts*>(nullptr))...);
+		}
+		else
+		{
+			func(get(containers, entity, static_cast<Ts*>(nullptr))...);
+		}
 	}
 }
 
-EntityIndex EntityManager::CreateEntity()
+template <bool WithEntity, typename Func, typename ... Columns>
+void EntityManager::EachInArrays(Func& func, std::size_t count, const EntityIndex* entities, Columns... columns)
 {
-	auto newEntity = _firstUsableEntityIndex;
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		if constexpr (WithEntity)
+		{
+			func(entities[i], columns[i]...);
+		}
+		else
+		{
+			func(columns[i]...);
+		}
+	}
+}
 
-	if (TryReuseEntityIndex(OUT newEntity))
+template <typename T> decltype(auto) EntityManager::ColumnFor() const
+{
+	if constexpr (IsTag<T>)
+	{
+		return TagContainer<T>();
+	}
+	else
 	{
-		SetComponent<EntityState>(newEntity, EntityState::Active);
-		return newEntity;
+		return GetContainer<T>();
 	}
+}
 
-	CreateContainersForNewEntity();
-	SetComponent<EntityState>(newEntity, EntityState::Active);
-	_firstUsableEntityIndex++;
-	return newEntity;
+template <typename T> decltype(auto) EntityManager::ChunkColumn(const ChunkView& chunk)
+{
+	if constexpr (IsTag<std::remove_const_t<T>>)
+	{
+		return TagContainer<std::remove_const_t<T>>();
+	}
+	else
+	{
+		return chunk.Components<T>();
+	}
+}
+
+// A tag has no column to construct in, so the generator writes a scratch value.
+template <typename T> T& EntityManager::ConstructInRow(Archetype& archetype, std::size_t row)
+{
+	if constexpr (IsTag<T>)
+	{
+		thread_local T scratch = TagValue<T>();
+		return scratch;
+	}
+	else
+	{
+		return *new (archetype.Get(GetComponentID<T>(), row)) T();
+	}
+}
+
+template <typename ... Ts>
+void EntityManager::CreateEntities(std::size_t count, OUT std::vector<EntityIndex>& entities, const Ts&... components)
+{
+	CreateEntities<Ts...>(count, OUT entities, [&](std::size_t, Ts&... targets)
+	{
+		auto _ = { (targets = components, 0)... };
+	});
 }
 
-void EntityManager::CreateContainersForNewEntity()
+template <typename ... Ts, typename Generator, typename>
+void EntityManager::CreateEntities(std::size_t count, OUT std::vector<EntityIndex>& entities, Generator&& generator)
 {
-	for (auto container : _containers)
+	entities.clear();
+	entities.reserve(count);
+
+	auto reused = std::min(count, _freeEntityIndices.size());
+	entities.insert(entities.end(), _freeEntityIndices.rbegin(), _freeEntityIndices.rbegin() + reused);
+	_freeEntityIndices.resize(_freeEntityIndices.size() - reused);
+
+	auto fresh = count - entities.size();
+	CreateContainersForNewEntities(fresh);
+	for (std::size_t i = 0; i < fresh; ++i)
+	{
+		entities.push_back(_firstUsableEntityIndex++);
+	}
+
+	auto signature = MakeFilter<EntityState, Ts...>();
+	auto signatureId = _signatures.Intern(signature);
+	for (auto entity : entities)
+	{
+		_signatureByEntity[entity] = signatureId;
+	}
+
+	if (_storageMode == StorageMode::Archetypes)
+	{
+		_archetypes.Insert(entities.data(), count, signature, [&](std::size_t i, Archetype& archetype, std::size_t row)
+		{
+			generator(i, ConstructInRow<Ts>(archetype, row)...);
+		});
+	}
+	else
+	{
+		FillColumns(generator, entities, ColumnFor<Ts>()...);
+
+		for (auto& group : _groups)
+		{
+			if (group->Matches(signature))
+			{
+				for (auto entity : entities)
+				{
+					group->Join(entity);
+				}
+			}
+		}
+	}
+
+	for (auto& query : _queries)
 	{
-		if (container != nullptr)
+		if (query->Matches(signature))
 		{
-			container->AddNew();
+			for (auto entity : entities)
+			{
+				query->Add(entity);
+			}
 		}
 	}
+}
 
-	_componentsByEntityIndex.push_back(std::bitset<MAX_COMPONENT_COUNT>());
+template <typename Generator, typename ... Containers>
+void EntityManager::FillColumns(Generator& generator, const std::vector<EntityIndex>& entities, Containers&&... containers)
+{
+	for (std::size_t i = 0; i < entities.size(); ++i)
+	{
+		auto entity = entities[i];
+		generator(i, containers.Acquire(entity)...);
+		auto _ = { (containers.MarkAdded(entity), 0)... };
+	}
 }
 
-bool EntityManager::TryReuseEntityIndex(OUT EntityIndex& entityIndex)
+template <typename T> T EntityManager::GetComponent(EntityIndex entity) const
 {
-	if (_freeEntityIndices.size() > 0)
+	if constexpr (std::is_same_v<T, EntityState>)
 	{
-		entityIndex = _freeEntityIndices.top();
-		_freeEntityIndices.pop();
-		return true;
+		return _signatureByEntity[entity] == EMPTY_SIGNATURE ? EntityState::Destroyed : EntityState::Active;
+	}
+	else if constexpr (IsTag<T>)
+	{
+		return TagValue<T>();
+	}
+	else if (_storageMode == StorageMode::Archetypes)
+	{
+		return *_archetypes.Find<T>(entity);
+	}
+	else
+	{
+		const auto& container = GetContainer<T>();
+		return container.Get(entity);
 	}
+}
 
-	return false;
+template <typename T> bool EntityManager::HasComponent(EntityIndex entity) const
+{
+	static ComponentID id = GetComponentID<T>();
+	return _signatures.Contains(_signatureByEntity[entity], id);
 }
 
-void EntityManager::DestroyEntity(EntityIndex index)
+template <typename T> void EntityManager::RemoveComponent(EntityIndex entity)
+{
+	static ComponentID id = GetComponentID<T>();
+
+	auto before = GetSignature(entity);
+	if (!before[id])
+	{
+		return;
+	}
+
+	if (_storageMode == StorageMode::Archetypes)
+	{
+		_archetypes.Move(entity, EntityFilter(before).set(id, false));
+	}
+	else if constexpr (!IsTag<T>)
+	{
+		auto group = _groupByComponent[id];
+		if (group != nullptr && group->Contains(entity))
+		{
+			group->Leave(entity);
+		}
+
+		GetContainer<T>().Remove(entity);
+	}
+
+	_signatureByEntity[entity] = _signatures.Without(_signatureByEntity[entity], id);
+	UpdateQueries(entity, id, before);
+}
+
+template <typename T> void EntityManager::SetComponent(EntityIndex entity, T&& component)
+{
+	using Component = std::decay_t<T>;
+	static ComponentID id = GetComponentID<Component>();
+
+	auto before = GetSignature(entity);
+	_signatureByEntity[entity] = _signatures.With(_signatureByEntity[entity], id);
+
+	if (_storageMode == StorageMode::Archetypes)
+	{
+		_archetypes.Set(entity, GetSignature(entity), std::forward<T>(component));
+	}
+	else if constexpr (!IsTag<Component>)
+	{
+		GetContainer<Component>().Set(entity, std::forward<T>(component));
+	}
+
+	if (!before[id])
+	{
+		ComponentAdded<Component>(entity, before);
+	}
+}
+
+template <typename T, typename ... Args> void EntityManager::EmplaceComponent(EntityIndex entity, Args&&... args)
+{
+	static ComponentID id = GetComponentID<T>();
+
+	auto before = GetSignature(entity);
+	_signatureByEntity[entity] = _signatures.With(_signatureByEntity[entity], id);
+
+	if (_storageMode == StorageMode::Archetypes)
+	{
+		_archetypes.Emplace<T>(entity, GetSignature(entity), std::forward<Args>(args)...);
+	}
+	else if constexpr (!IsTag<T>)
+	{
+		GetContainer<T>().Emplace(entity, std::forward<Args>(args)...);
+	}
+
+	if (!before[id])
+	{
+		ComponentAdded<T>(entity, before);
+	}
+}
+
+// Stamps the new T of an entity in columns mode and lets groups and queries
+// know; the signature already has T.
+template <typename T> void EntityManager::ComponentAdded(EntityIndex entity, const EntityFilter& before)
+{
+	static ComponentID id = GetComponentID<T>();
+
+	if constexpr (!IsTag<T>)
+	{
+		if (_storageMode == StorageMode::Columns)
+		{
+			GetContainer<T>().MarkAdded(entity);
+
+			auto group = _groupByComponent[id];
+			if (group != nullptr && group->Matches(GetSignature(entity)))
+			{
+				group->Join(entity);
+			}
+		}
+	}
+
+	UpdateQueries(entity, id, before);
+}
+
+template <typename... Ts> void EntityManager::SetupContainers()
+{
+	auto _ = { (SetupContainer<Ts>(), 0)... };
+}
+
+template <typename T> void EntityManager::SetupContainer()
+{
+	using Component = typename ComponentStorage<T>::Component;
+	_usedComponents.push_back(GetComponentID<Component>());
+
+	if constexpr (IsTag<Component>)
+	{
+		_tags.set(GetComponentID<Component>());
+	}
+	else if (_storageMode == StorageMode::Archetypes)
+	{
+		_archetypes.Register<Component>();
+	}
+	else
+	{
+		auto id = GetComponentID<Component>();
+		_containers[id] = std::make_unique<ComponentContainer<Component>>(ComponentStorage<T>::Policy, _allocator);
+		_containers[id]->SetClock(&_changeVersion);
+	}
+}
+
+// The entity takes its whole signature at once, EntityState included, so an
+// archetype entity is placed only once, and the components are moved into
+// their storage. Dense columns hold a default component for every entity,
+// which is assigned to.
+template <typename... Ts> EntityIndex EntityManager::CreateEntityWithComponents(Ts... components)
 {
-	_componentsByEntityIndex[index].reset();
-	_freeEntityIndices.push(index);
+	auto entity = NewEntityIndex();
+	auto before = GetSignature(entity);
+
+	((_signatureByEntity[entity] = _signatures.With(_signatureByEntity[entity], GetComponentID<Ts>())), ...);
+	assert(GetSignature(entity).count() == sizeof...(Ts) && "Component types must differ");
+	_signatureByEntity[entity] = _signatures.With(_signatureByEntity[entity], GetComponentID<EntityState>());
+	auto after = GetSignature(entity);
+
+	if (_storageMode == StorageMode::Archetypes)
+	{
+		_archetypes.Move(entity, after);
+	}
+
+	auto place = [&](auto& component)
+	{
+		using T = std::decay_t<decltype(component)>;
+
+		if constexpr (!IsTag<T>)
+		{
+			if (_storageMode == StorageMode::Archetypes)
+			{
+				new (_archetypes.Find<T>(entity)) T(std::move(component));
+			}
+			else
+			{
+				auto& container = GetContainer<T>();
+				container.Set(entity, std::move(component));
+				container.MarkAdded(entity);
+			}
+		}
+	};
+	(place(components), ...);
+
+	if (_storageMode == StorageMode::Columns)
+	{
+		JoinGroups(entity, before, after);
+	}
+	UpdateQueries(entity, before);
+
+	return entity;
+}
+
+EntityIndex EntityManager::CreateEntity()
+{
+	auto newEntity = NewEntityIndex();
+	SetComponent<EntityState>(newEntity, EntityState::Active);
+	return newEntity;
+}
+
+EntityIndex EntityManager::NewEntityIndex()
+{
+	auto newEntity = _firstUsableEntityIndex;
+
+	if (!TryReuseEntityIndex(OUT newEntity))
+	{
+		CreateContainersForNewEntities(1);
+		_firstUsableEntityIndex++;
+	}
+
+	return newEntity;
+}
+
+void EntityManager::CreateContainersForNewEntities(std::size_t count)
+{
+	for (auto id : _usedComponents)
+	{
+		if (_containers[id] != nullptr)
+		{
+			_containers[id]->AddNew(count);
+		}
+	}
+
+	if (_storageMode == StorageMode::Archetypes)
+	{
+		_archetypes.AddNew(count);
+	}
+
+	_signatureByEntity.resize(_signatureByEntity.size() + count, EMPTY_SIGNATURE);
+	_generations.resize(_generations.size() + count, _retiredGeneration);
+
+	assert(_generations.size() <= 0xFFFFFFFFu);
+}
+
+bool EntityManager::TryReuseEntityIndex(OUT EntityIndex& entityIndex)
+{
+	if (_freeEntityIndices.size() > 0)
+	{
+		entityIndex = _freeEntityIndices.back();
+		_freeEntityIndices.pop_back();
+		return true;
+	}
+
+	return false;
+}
+
+void EntityManager::DestroyEntity(EntityIndex index)
+{
+	auto before = GetSignature(index);
+
+	if (_storageMode == StorageMode::Archetypes)
+	{
+		_archetypes.Remove(index);
+	}
+	else
+	{
+		LeaveGroups(index, before, EntityFilter());
+
+		for (auto id : _usedComponents)
+		{
+			if (before[id] && _containers[id] != nullptr)
+			{
+				_containers[id]->Remove(index);
+			}
+		}
+	}
+
+	_signatureByEntity[index] = EMPTY_SIGNATURE;
+	_freeEntityIndices.push_back(index);
+	++_generations[index];
+
+	for (auto& query : _queries)
+	{
+		query->Update(index, before, EntityFilter());
+	}
+}
+
+void EntityManager::DestroyEntities(const EntityIndex* entities, std::size_t count)
+{
+	EntityFilter used;
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		used |= GetSignature(entities[i]);
+	}
+
+	if (_storageMode == StorageMode::Archetypes)
+	{
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			_archetypes.Remove(entities[i]);
+		}
+	}
+	else
+	{
+		for (std::size_t i = 0; i < count && !_groups.empty(); ++i)
+		{
+			LeaveGroups(entities[i], GetSignature(entities[i]), EntityFilter());
+		}
+
+		for (auto id : _usedComponents)
+		{
+			if (used[id] && _containers[id] != nullptr)
+			{
+				_containers[id]->Remove(entities, count);
+			}
+		}
+	}
+
+	for (auto& query : _queries)
+	{
+		if (query->Matches(used))
+		{
+			for (std::size_t i = 0; i < count; ++i)
+			{
+				query->Update(entities[i], GetSignature(entities[i]), EntityFilter());
+			}
+		}
+	}
+
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		_signatureByEntity[entities[i]] = EMPTY_SIGNATURE;
+		_freeEntityIndices.push_back(entities[i]);
+		++_generations[entities[i]];
+	}
+}
+
+void EntityManager::DestroyEntities(const std::vector<EntityIndex>& entities)
+{
+	DestroyEntities(entities.data(), entities.size());
+}
+
+EntityHandle EntityManager::Resolve(EntityHandle handle) const
+{
+	while (!IsValid(handle))
+	{
+		auto forwarded = _forwarding.find(handle);
+		if (forwarded == _forwarding.end())
+		{
+			return handle;
+		}
+
+		handle = forwarded->second;
+	}
+
+	return handle;
+}
+
+// Either index may be free. Whatever moves counts as added where it lands,
+// so that change filters and deltas see it, and every handle to either
+// index goes stale; the live entities are forwarded to their new handles.
+void EntityManager::SwapEntities(EntityIndex a, EntityIndex b)
+{
+	auto signatureA = _signatureByEntity[a];
+	auto signatureB = _signatureByEntity[b];
+
+	if (_storageMode == StorageMode::Archetypes)
+	{
+		_archetypes.Swap(a, b);
+	}
+	else
+	{
+		for (auto id : _usedComponents)
+		{
+			if (_containers[id] == nullptr)
+			{
+				continue;
+			}
+
+			auto inA = _signatures.Contains(signatureA, id);
+			auto inB = _signatures.Contains(signatureB, id);
+
+			if (inA || inB)
+			{
+				_containers[id]->Swap(a, b);
+			}
+			if (inA)
+			{
+				_containers[id]->MarkAdded(b);
+			}
+			if (inB)
+			{
+				_containers[id]->MarkAdded(a);
+			}
+		}
+	}
+
+	std::swap(_signatureByEntity[a], _signatureByEntity[b]);
+
+	for (auto& query : _queries)
+	{
+		query->Swap(a, b);
+	}
+
+	auto handleA = GetHandle(a);
+	auto handleB = GetHandle(b);
+	++_generations[a];
+	++_generations[b];
+
+	if (signatureA != EMPTY_SIGNATURE)
+	{
+		_forwarding[handleA] = GetHandle(b);
+	}
+	if (signatureB != EMPTY_SIGNATURE)
+	{
+		_forwarding[handleB] = GetHandle(a);
+	}
+}
+
+// Every index from count on must be free.
+void EntityManager::TruncateEntities(EntityIndex count)
+{
+	if (count >= _firstUsableEntityIndex)
+	{
+		return;
+	}
+
+	for (auto entity = count; entity < _firstUsableEntityIndex; ++entity)
+	{
+		assert(_signatureByEntity[entity] == EMPTY_SIGNATURE);
+		_retiredGeneration = std::max(_retiredGeneration, static_cast<EntityGeneration>(_generations[entity] + 1));
+	}
+
+	_freeEntityIndices.erase(std::remove_if(_freeEntityIndices.begin(), _freeEntityIndices.end(),
+											[count](EntityIndex entity) { return entity >= count; }),
+							 _freeEntityIndices.end());
+
+	for (auto id : _usedComponents)
+	{
+		if (_containers[id] != nullptr)
+		{
+			_containers[id]->Truncate(count);
+		}
+	}
+
+	if (_storageMode == StorageMode::Archetypes)
+	{
+		_archetypes.Truncate(count);
+	}
+
+	for (auto& query : _queries)
+	{
+		query->Truncate(count);
+	}
+
+	_signatureByEntity.resize(count);
+	_signatureByEntity.shrink_to_fit();
+	_generations.resize(count);
+	_generations.shrink_to_fit();
+	_firstUsableEntityIndex = count;
+}
+
+std::vector<ContainerStats> EntityManager::ContainerStatistics() const
+{
+	std::vector<ContainerStats> stats;
+
+	if (_storageMode == StorageMode::Archetypes)
+	{
+		for (auto id : _usedComponents)
+		{
+			if (_tags[id])
+			{
+				continue;
+			}
+
+			ContainerStats container{ id, StoragePolicy::Dense };
+			EntityFilter filter;
+			filter.set(id);
+
+			_archetypes.ForEachArchetype(filter, [&](const Archetype& archetype)
+			{
+				container.live += archetype.Count();
+				container.capacity += archetype.ChunkCount() * archetype.ChunkCapacity();
+			});
+
+			container.slots = container.live;
+			container.bytes = container.capacity * _archetypes.ComponentSize(id);
+			stats.push_back(container);
+		}
+
+		return stats;
+	}
+
+	// Entities are counted per signature, then each signature adds its count
+	// to the components it contains.
+	std::vector<std::size_t> entitiesBySignature(_signatures.Count());
+	for (EntityIndex entity = 0; entity < _firstUsableEntityIndex; ++entity)
+	{
+		++entitiesBySignature[_signatureByEntity[entity]];
+	}
+
+	for (auto id : _usedComponents)
+	{
+		if (_tags[id])
+		{
+			continue;
+		}
+
+		auto& container = *_containers[id];
+		ContainerStats component{ id, container.Policy() };
+
+		for (SignatureID signature = 0; signature < entitiesBySignature.size(); ++signature)
+		{
+			component.live += _signatures.Contains(signature, id) ? entitiesBySignature[signature] : 0;
+		}
+
+		component.slots = container.StoredCount();
+		component.capacity = container.Capacity();
+		component.bytes = container.AllocatedBytes();
+		stats.push_back(component);
+	}
+
+	return stats;
+}
+
+template <typename ... Ts> Group& EntityManager::RegisterGroup()
+{
+	assert(_storageMode == StorageMode::Columns);
+	auto filter = MakeFilter<Ts...>();
+
+	for (auto& group : _groups)
+	{
+		if (group->Filter() == filter)
+		{
+			return *group;
+		}
+	}
+
+	_groups.push_back(std::make_unique<Group>(filter, _containers));
+	auto& group = *_groups.back();
+
+	for (ComponentID id = 0; id < MAX_COMPONENT_COUNT; ++id)
+	{
+		if (filter[id])
+		{
+			assert(_groupByComponent[id] == nullptr);
+			_groupByComponent[id] = &group;
+		}
+	}
+
+	group.Rebuild([&](EntityIndex entity) { return group.Matches(GetSignature(entity)); });
+	return group;
+}
+
+Query& EntityManager::RegisterQuery(const EntityFilter& filter)
+{
+	std::lock_guard<std::mutex> lock(_queryMutex);
+	return FindOrAddQuery(filter);
+}
+
+// Iteration sorts before reading, under the lock, so that concurrent systems
+// iterating the same query never see it being reordered.
+const Query& EntityManager::SortedQuery(const EntityFilter& filter)
+{
+	std::lock_guard<std::mutex> lock(_queryMutex);
+	auto& query = FindOrAddQuery(filter);
+	query.Sort();
+	return query;
+}
+
+Query& EntityManager::FindOrAddQuery(const EntityFilter& filter)
+{
+	assert(filter.any());
+
+	auto existing = _queryByFilter.find(filter);
+	if (existing != _queryByFilter.end())
+	{
+		return *existing->second;
+	}
+
+	_queries.push_back(std::make_unique<Query>(filter));
+	auto& query = *_queries.back();
+	_queryByFilter.emplace(filter, &query);
+
+	for (ComponentID id = 0; id < MAX_COMPONENT_COUNT; ++id)
+	{
+		if (filter[id])
+		{
+			_queriesByComponent[id].push_back(&query);
+		}
+	}
+
+	std::vector<EntityIndex> entities;
+	GetEntities(filter, OUT entities);
+
+	for (auto entity : entities)
+	{
+		query.Add(entity);
+	}
+
+	return query;
+}
+
+bool EntityManager::PassesVersionFilters(const ChunkView& chunk, const VersionFilters& versionFilters) const
+{
+	for (const auto& versionFilter : versionFilters.filters)
+	{
+		auto version = versionFilter.added ? chunk.AddedVersion(versionFilter.id) : chunk.ChangedVersion(versionFilter.id);
+		if (version <= versionFilters.since)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// entities is sorted, so a block of a dense container without any change
+// since then is skipped with one search.
+void EntityManager::FilterByVersion(const std::vector<EntityIndex>& entities, const VersionFilters& versionFilters,
+									OUT std::vector<EntityIndex>& passing) const
+{
+	passing.clear();
+
+	for (std::size_t i = 0; i < entities.size(); )
+	{
+		auto entity = entities[i];
+		auto next = i + 1;
+		auto passes = true;
+
+		for (const auto& versionFilter : versionFilters.filters)
+		{
+			const auto& container = *_containers[versionFilter.id];
+
+			if (container.Policy() == StoragePolicy::Dense && container.RangeVersion(entity) <= versionFilters.since)
+			{
+				auto rangeEnd = (entity / ComponentContainerBase::CHANGE_RANGE_SIZE + 1) * ComponentContainerBase::CHANGE_RANGE_SIZE;
+				next = std::lower_bound(entities.begin() + i, entities.end(), rangeEnd) - entities.begin();
+				passes = false;
+				break;
+			}
+
+			auto version = versionFilter.added ? container.AddedVersion(entity) : container.ChangedVersion(entity);
+			if (version <= versionFilters.since)
+			{
+				passes = false;
+				break;
+			}
+		}
+
+		if (passes)
+		{
+			passing.push_back(entity);
+		}
+
+		i = next;
+	}
+}
+
+void EntityManager::Observe(const EntityFilter& filter, ObserverCallback onMatch, ObserverCallback onUnmatch)
+{
+	auto& query = RegisterQuery(filter);
+	query._observed = true;
+	_observers.push_back(Observer{ &query, std::move(onMatch), std::move(onUnmatch), {}, query.Entities() });
+}
+
+// Touched entities are taken from the queries first, so that callbacks can
+// change signatures without losing what they touch.
+void EntityManager::FlushObservers()
+{
+	std::unordered_map<const Query*, std::vector<EntityIndex>> touched;
+	for (auto& observer : _observers)
+	{
+		auto taken = touched.emplace(observer.query, std::vector<EntityIndex>());
+		if (taken.second)
+		{
+			taken.first->second.swap(observer.query->_touched);
+		}
+	}
+
+	std::vector<EntityIndex> candidates;
+	std::vector<EntityIndex> matched;
+	std::vector<EntityIndex> unmatched;
+
+	for (auto& observer : _observers)
+	{
+		const auto& query = *observer.query;
+		const auto& entities = touched[&query];
+		candidates.assign(entities.begin(), entities.end());
+		candidates.insert(candidates.end(), observer.pending.begin(), observer.pending.end());
+		observer.pending.clear();
+
+		std::sort(candidates.begin(), candidates.end());
+		candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+		matched.clear();
+		unmatched.clear();
+		auto& reported = observer.reported;
+
+		for (auto entity : candidates)
+		{
+			auto was = entity < reported.size() ? reported[entity] : NOT_REPORTED;
+			auto now = query.Contains(entity) ? _generations[entity] : NOT_REPORTED;
+			if (was == now)
+			{
+				continue;
+			}
+
+			if (was != NOT_REPORTED)
+			{
+				unmatched.push_back(entity);
+			}
+			if (now != NOT_REPORTED)
+			{
+				matched.push_back(entity);
+			}
+
+			if (entity >= reported.size())
+			{
+				reported.resize(entity + 1, NOT_REPORTED);
+			}
+			reported[entity] = now;
+		}
+
+		if (observer.onUnmatch && !unmatched.empty())
+		{
+			observer.onUnmatch(unmatched.data(), unmatched.size());
+		}
+		if (observer.onMatch && !matched.empty())
+		{
+			observer.onMatch(matched.data(), matched.size());
+		}
+	}
+}
+
+// For queries that are still empty while entities are restored in bulk.
+void EntityManager::PopulateQueries()
+{
+	std::vector<EntityIndex> entities;
+
+	for (auto& query : _queries)
+	{
+		GetEntities(query->Filter(), OUT entities);
+		for (auto entity : entities)
+		{
+			query->Add(entity);
+		}
+	}
+}
+
+void EntityManager::PopulateGroups()
+{
+	for (auto& group : _groups)
+	{
+		group->Rebuild([&](EntityIndex entity) { return group->Matches(GetSignature(entity)); });
+	}
+}
+
+// Groups have to let go of an entity before its components are removed, and
+// can only take it in once all of them are there.
+void EntityManager::LeaveGroups(EntityIndex entity, const EntityFilter& before, const EntityFilter& after)
+{
+	for (auto& group : _groups)
+	{
+		if (group->Matches(before) && !group->Matches(after))
+		{
+			group->Leave(entity);
+		}
+	}
+}
+
+void EntityManager::JoinGroups(EntityIndex entity, const EntityFilter& before, const EntityFilter& after)
+{
+	for (auto& group : _groups)
+	{
+		if (group->Matches(after) && !group->Matches(before))
+		{
+			group->Join(entity);
+		}
+	}
+}
+
+// Only queries that test the changed component can have changed their mind.
+void EntityManager::UpdateQueries(EntityIndex entity, ComponentID changed, const EntityFilter& before)
+{
+	for (auto query : _queriesByComponent[changed])
+	{
+		query->Update(entity, before, GetSignature(entity));
+	}
+}
+
+// For signatures that changed in more than one component at once.
+void EntityManager::UpdateQueries(EntityIndex entity, const EntityFilter& before)
+{
+	for (auto& query : _queries)
+	{
+		query->Update(entity, before, GetSignature(entity));
+	}
 }
@@ -0,0 +1,37 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+
+#include "Component.h"
+
+using EntityGeneration = std::uint32_t;
+
+// A reference to an entity that can be held across frames. It packs the
+// entity index with the generation of that index at the time the handle was
+// taken; destroying the entity bumps the generation, so stale handles stop
+// validating instead of aliasing whatever entity reuses the index.
+class EntityHandle
+{
+public:
+	constexpr EntityHandle() = default;
+	constexpr EntityHandle(EntityIndex index, EntityGeneration generation)
+		: _value{ (std::uint64_t(generation) << 32) | (std::uint64_t(index) & 0xFFFFFFFFu) } {}
+
+	inline constexpr EntityIndex Index() const { return static_cast<EntityIndex>(_value & 0xFFFFFFFFu); }
+	inline constexpr EntityGeneration Generation() const { return static_cast<EntityGeneration>(_value >> 32); }
+	inline constexpr std::uint64_t Value() const { return _value; }
+
+	inline constexpr bool operator==(const EntityHandle& other) const { return _value == other._value; }
+	inline constexpr bool operator!=(const EntityHandle& other) const { return _value != other._value; }
+
+private:
+	std::uint64_t _value = ~std::uint64_t(0);
+};
+
+namespace std
+{
+	template <> struct hash<EntityHandle>
+	{
+		std::size_t operator()(const EntityHandle& handle) const { return std::hash<std::uint64_t>()(handle.Value()); }
+	};
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include <cstddef>
+
+template <typename ... Ts> struct TypeList { };
+
+// Parameter types of a function pointer or of a (non-generic) lambda / functor.
+template <typename Func> struct FunctionTraits : FunctionTraits<decltype(&Func::operator())> { };
+
+template <typename R, typename ... Args> struct FunctionTraits<R(*)(Args...)>
+{
+	using Arguments = TypeList<Args...>;
+	static constexpr std::size_t Arity = sizeof...(Args);
+};
+
+template <typename C, typename R, typename ... Args> struct FunctionTraits<R(C::*)(Args...)>
+	: FunctionTraits<R(*)(Args...)> { };
+
+template <typename C, typename R, typename ... Args> struct FunctionTraits<R(C::*)(Args...) const>
+	: FunctionTraits<R(*)(Args...)> { };
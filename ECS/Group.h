@@ -0,0 +1,195 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "Component.h"
+#include "FunctionTraits.h"
+
+// The entities that have all of a set of sparse components, kept packed at
+// the front of each of those containers, in the same order. The group owns
+// the containers: it reorders them whenever an entity joins or leaves, so a
+// component type can be owned by at most one group. Registered with an
+// EntityManager, which keeps it up to date as signatures change.
+//
+// Each walks the grouped components as parallel arrays, without looking up
+// entities or signatures:
+//		group.Each([](Position& position, const Velocity& velocity) { ... });
+class Group
+{
+public:
+	// Every component in filter must be stored sparse in containers.
+	Group(const EntityFilter& filter, const std::array<std::unique_ptr<ComponentContainerBase>, MAX_COMPONENT_COUNT>& containers);
+
+	inline const EntityFilter& Filter() const { return _filter; }
+	inline bool Matches(const EntityFilter& signature) const { return (signature & _filter) == _filter; }
+
+	inline std::size_t Size() const { return _size; }
+	// The grouped entities, in the order of their components; the order
+	// changes whenever an entity leaves the group.
+	inline const EntityIndex* Entities() const { return _containers.front()->Owners().data(); }
+	inline bool Contains(EntityIndex entity) const { return _containers.front()->PackedSlot(entity) < _size; }
+
+	// Like EntityManager::Each, restricted to the grouped component types, and
+	// not safe to call while the group changes. Mutable components are marked
+	// as changed.
+	template <typename ... Ts, typename Func> void Each(Func&& func);
+
+private:
+	friend class EntityManager;
+	friend class Hierarchy;
+
+	void Join(EntityIndex entity);
+	void Leave(EntityIndex entity);
+	// Recounts the members from scratch, e.g. after a snapshot was loaded.
+	template <typename Predicate> void Rebuild(Predicate&& belongs);
+
+	template <typename First, typename ... Rest, typename Func> void EachDeduced(Func& func, TypeList<First, Rest...>);
+	template <bool WithEntity, typename ... Ts, typename Func> void EachMatching(Func& func);
+	template <typename T> ComponentContainer<std::remove_const_t<T>>& Container() const;
+
+	EntityFilter _filter;
+	std::vector<ComponentID> _ids;
+	std::vector<ComponentContainerBase*> _containers;
+	std::size_t _size = 0;
+	// Counts joins and leaves, so that orderings on top can tell they are stale.
+	std::uint64_t _changes = 0;
+};
+
+inline Group::Group(const EntityFilter& filter,
+					const std::array<std::unique_ptr<ComponentContainerBase>, MAX_COMPONENT_COUNT>& containers)
+	: _filter{ filter }
+{
+	for (ComponentID id = 0; id < MAX_COMPONENT_COUNT; ++id)
+	{
+		if (filter[id])
+		{
+			assert(containers[id] != nullptr && containers[id]->Policy() == StoragePolicy::Sparse);
+			_ids.push_back(id);
+			_containers.push_back(containers[id].get());
+		}
+	}
+
+	assert(!_containers.empty());
+}
+
+inline void Group::Join(EntityIndex entity)
+{
+	for (auto container : _containers)
+	{
+		container->MoveToSlot(entity, _size);
+	}
+
+	++_size;
+	++_changes;
+}
+
+inline void Group::Leave(EntityIndex entity)
+{
+	--_size;
+	++_changes;
+
+	for (auto container : _containers)
+	{
+		container->MoveToSlot(entity, _size);
+	}
+}
+
+template <typename Predicate> void Group::Rebuild(Predicate&& belongs)
+{
+	_size = 0;
+	++_changes;
+
+	// Joining only swaps with slots before the one being looked at.
+	const auto& owners = _containers.front()->Owners();
+	for (std::size_t slot = 0; slot < owners.size(); ++slot)
+	{
+		if (belongs(owners[slot]))
+		{
+			Join(owners[slot]);
+		}
+	}
+}
+
+template <typename ... Ts, typename Func> void Group::Each(Func&& func)
+{
+	if constexpr (sizeof...(Ts) == 0)
+	{
+		EachDeduced(func, typename FunctionTraits<std::decay_t<Func>>::Arguments());
+	}
+	else
+	{
+		EachMatching<std::is_invocable_v<Func&, EntityIndex, Ts&...>, Ts...>(func);
+	}
+}
+
+template <typename First, typename ... Rest, typename Func> void Group::EachDeduced(Func& func, TypeList<First, Rest...>)
+{
+	if constexpr (std::is_same_v<std::decay_t<First>, EntityIndex>)
+	{
+		EachMatching<true, std::remove_reference_t<Rest>...>(func);
+	}
+	else
+	{
+		EachMatching<false, std::remove_reference_t<First>, std::remove_reference_t<Rest>...>(func);
+	}
+}
+
+// Packed columns are paged, with a power of two of elements per page, so
+// the pages of the smallest ones split all of them into contiguous runs.
+template <bool WithEntity, typename ... Ts, typename Func> void Group::EachMatching(Func& func)
+{
+	constexpr auto run = std::min({ PagedColumn<std::remove_const_t<Ts>>::PAGE_CAPACITY... });
+	auto entities = Entities();
+
+	auto walk = [&](std::size_t first, std::size_t count, Ts*... components)
+	{
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			if constexpr (WithEntity)
+			{
+				func(entities[first + i], components[i]...);
+			}
+			else
+			{
+				func(components[i]...);
+			}
+		}
+	};
+
+	auto mark = [](auto& container, std::size_t first, std::size_t count, auto* type)
+	{
+		if constexpr (!std::is_const_v<std::remove_pointer_t<decltype(type)>>)
+		{
+			container.MarkPackedChanged(first, count);
+		}
+	};
+
+	auto containers = std::forward_as_tuple(Container<Ts>()...);
+	for (std::size_t first = 0; first < _size; first += run)
+	{
+		auto count = std::min(run, _size - first);
+
+		std::apply([&](auto&... columns)
+		{
+			auto _ = { (mark(columns, first, count, static_cast<Ts*>(nullptr)), 0)... };
+			walk(first, count, static_cast<Ts*>(columns.Packed(first))...);
+		}, containers);
+	}
+}
+
+template <typename T> ComponentContainer<std::remove_const_t<T>>& Group::Container() const
+{
+	static ComponentID id = GetComponentID<T>();
+	assert(_filter[id]);
+
+	auto position = std::find(_ids.begin(), _ids.end(), id) - _ids.begin();
+	return static_cast<ComponentContainer<std::remove_const_t<T>>&>(*_containers[position]);
+}
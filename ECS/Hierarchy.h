@@ -0,0 +1,307 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "ECS.h"
+#include "Group.h"
+#include "ThreadPool.h"
+
+// Parent-child links between the members of a group, which are kept in
+// breadth-first order in the grouped containers: roots first, then their
+// children level by level, with siblings next to each other. Propagating a
+// component down the tree, such as a world transform, is then one sweep over
+// the packed components in which every parent comes before its children:
+//		Hierarchy scene(manager, manager.RegisterGroup<Local, Global>());
+//		scene.SetParent(wheel, car);
+//		scene.Propagate<Global, const Local>([](const Global* parent, Global& global, const Local& local)
+//		{
+//			global = parent != nullptr ? *parent * local : Global(local);
+//		});
+//
+// Links hold handles, so a destroyed parent, or one that is not a member,
+// leaves its children as roots. The order is restored in one linear pass the
+// next time members are visited after a link or the group changed. Compacting
+// the world moves entities out from under their links, which then have to be
+// set again.
+class Hierarchy
+{
+public:
+	Hierarchy(const EntityManager& manager, Group& group);
+
+	// Fails if parent is child or one of its descendants. Neither has to be
+	// a member yet.
+	bool SetParent(EntityIndex child, EntityIndex parent);
+	void ClearParent(EntityIndex child);
+	// The handle of the parent of child, or an invalid handle for a root.
+	EntityHandle Parent(EntityIndex child) const;
+
+	// Restores the breadth-first order if anything changed since the last time;
+	// the visiting functions call it. The levels below are those of the last
+	// Update.
+	void Update();
+	inline std::size_t LevelCount() const { return _levels.size() - 1; }
+	// The members of a level occupy the group slots from LevelBegin(level)
+	// to LevelBegin(level + 1).
+	inline std::size_t LevelBegin(std::size_t level) const { return _levels[level]; }
+	std::size_t Depth(EntityIndex entity) const;
+
+	// Calls func(const T* parent, T& component, Ts&... components) for every
+	// member, parents first, where parent is null for roots. T and Ts must be
+	// grouped; T is marked as changed, and so are Ts unless they are const.
+	template <typename T, typename ... Ts, typename Func> void Propagate(Func&& func);
+	// Like Propagate, but splits every level into ranges run on pool, so func
+	// may only write to the member it is called for.
+	template <typename T, typename ... Ts, typename Func>
+	void ParallelPropagate(ThreadPool& pool, Func&& func, std::size_t grainSize = DEFAULT_GRAIN_SIZE);
+
+private:
+	static constexpr std::size_t NO_PARENT = static_cast<std::size_t>(-1);
+
+	struct Link
+	{
+		EntityHandle child;
+		EntityHandle parent;
+	};
+
+	// The parent of entity if its link is still valid, or NO_PARENT.
+	std::size_t LinkedParent(EntityIndex entity) const;
+	template <typename T, typename ... Ts, typename Func> void PropagateRange(Func& func, std::size_t begin, std::size_t end);
+
+	const EntityManager& _manager;
+	Group& _group;
+	std::vector<Link> _links;
+
+	// Per group slot, the slot of its parent, and where each level begins.
+	bool _dirty = true;
+	std::uint64_t _groupChanges = 0;
+	std::vector<std::size_t> _parentSlots;
+	std::vector<std::size_t> _levels{ 0 };
+};
+
+inline Hierarchy::Hierarchy(const EntityManager& manager, Group& group) : _manager{ manager }, _group{ group }
+{
+}
+
+inline bool Hierarchy::SetParent(EntityIndex child, EntityIndex parent)
+{
+	for (auto ancestor = std::size_t(parent); ancestor != NO_PARENT; ancestor = LinkedParent(EntityIndex(ancestor)))
+	{
+		if (ancestor == child)
+		{
+			return false;
+		}
+	}
+
+	if (child >= _links.size())
+	{
+		_links.resize(child + 1);
+	}
+
+	_links[child] = Link{ _manager.GetHandle(child), _manager.GetHandle(parent) };
+	_dirty = true;
+	return true;
+}
+
+inline void Hierarchy::ClearParent(EntityIndex child)
+{
+	if (child < _links.size())
+	{
+		_links[child] = Link();
+		_dirty = true;
+	}
+}
+
+inline EntityHandle Hierarchy::Parent(EntityIndex child) const
+{
+	return LinkedParent(child) != NO_PARENT ? _links[child].parent : EntityHandle();
+}
+
+inline std::size_t Hierarchy::LinkedParent(EntityIndex entity) const
+{
+	if (entity >= _links.size())
+	{
+		return NO_PARENT;
+	}
+
+	const auto& link = _links[entity];
+	if (link.child.Index() != entity || !_manager.IsValid(link.child) || !_manager.IsValid(link.parent))
+	{
+		return NO_PARENT;
+	}
+
+	return link.parent.Index();
+}
+
+inline std::size_t Hierarchy::Depth(EntityIndex entity) const
+{
+	auto slot = _group._containers.front()->PackedSlot(entity);
+	assert(slot < _levels.back());
+	return std::upper_bound(_levels.begin(), _levels.end(), slot) - _levels.begin() - 1;
+}
+
+// Children are bucketed by the slot of their parent, then the levels are laid
+// out by walking the previous level in its new order, which keeps siblings
+// together and in the order they had.
+inline void Hierarchy::Update()
+{
+	if (!_dirty && _groupChanges == _group._changes)
+	{
+		return;
+	}
+
+	auto count = _group.Size();
+	std::vector<EntityIndex> members(_group.Entities(), _group.Entities() + count);
+	const auto& slots = *_group._containers.front();
+
+	std::vector<std::size_t> parents(count);
+	std::vector<std::size_t> childOffsets(count + 1);
+	std::vector<std::size_t> order;
+	order.reserve(count);
+
+	for (std::size_t slot = 0; slot < count; ++slot)
+	{
+		auto parent = LinkedParent(members[slot]);
+		parents[slot] = parent != NO_PARENT && _group.Contains(EntityIndex(parent)) ? slots.PackedSlot(EntityIndex(parent)) : NO_PARENT;
+
+		if (parents[slot] == NO_PARENT)
+		{
+			order.push_back(slot);
+		}
+		else
+		{
+			++childOffsets[parents[slot] + 1];
+		}
+	}
+
+	std::partial_sum(childOffsets.begin(), childOffsets.end(), childOffsets.begin());
+	std::vector<std::size_t> children(count - order.size());
+	auto next = childOffsets;
+	for (std::size_t slot = 0; slot < count; ++slot)
+	{
+		if (parents[slot] != NO_PARENT)
+		{
+			children[next[parents[slot]]++] = slot;
+		}
+	}
+
+	_levels.assign(1, 0);
+	for (std::size_t begin = 0; begin < order.size(); )
+	{
+		auto end = order.size();
+		_levels.push_back(end);
+
+		for (auto position = begin; position < end; ++position)
+		{
+			auto parent = order[position];
+			order.insert(order.end(), children.begin() + childOffsets[parent], children.begin() + childOffsets[parent + 1]);
+		}
+
+		begin = end;
+	}
+
+	assert(order.size() == count && "Links form a cycle");
+
+	std::vector<std::size_t> positions(count);
+	for (std::size_t position = 0; position < count; ++position)
+	{
+		positions[order[position]] = position;
+	}
+
+	_parentSlots.resize(count);
+	for (std::size_t position = 0; position < count; ++position)
+	{
+		auto parent = parents[order[position]];
+		_parentSlots[position] = parent == NO_PARENT ? NO_PARENT : positions[parent];
+
+		for (auto container : _group._containers)
+		{
+			container->MoveToSlot(members[order[position]], position);
+		}
+	}
+
+	_dirty = false;
+	_groupChanges = _group._changes;
+}
+
+template <typename T, typename ... Ts, typename Func> void Hierarchy::Propagate(Func&& func)
+{
+	Update();
+
+	for (std::size_t level = 0; level < LevelCount(); ++level)
+	{
+		PropagateRange<T, Ts...>(func, _levels[level], _levels[level + 1]);
+	}
+}
+
+// Levels are ranges of packed slots, so unlike in EntityManager::ParallelEach,
+// splitting them on slot line groups puts range boundaries on cache lines of
+// every grouped column, versions included.
+template <typename T, typename ... Ts, typename Func>
+void Hierarchy::ParallelPropagate(ThreadPool& pool, Func&& func, std::size_t grainSize)
+{
+	Update();
+
+	constexpr std::size_t lineGroup = std::max({ CACHE_LINE_SIZE / std::gcd(sizeof(ChangeVersion), CACHE_LINE_SIZE),
+												 CACHE_LINE_SIZE / std::gcd(sizeof(T), CACHE_LINE_SIZE),
+												 (CACHE_LINE_SIZE / std::gcd(sizeof(Ts), CACHE_LINE_SIZE))... });
+
+	for (std::size_t level = 0; level < LevelCount(); ++level)
+	{
+		auto begin = _levels[level];
+		auto end = _levels[level + 1];
+		auto firstLine = begin / lineGroup;
+		auto lines = (end + lineGroup - 1) / lineGroup - firstLine;
+
+		pool.ParallelFor(lines, std::max<std::size_t>(grainSize / lineGroup, 1), [&](std::size_t first, std::size_t last)
+		{
+			PropagateRange<T, Ts...>(func, std::max(begin, (firstLine + first) * lineGroup), std::min(end, (firstLine + last) * lineGroup));
+		});
+	}
+}
+
+template <typename T, typename ... Ts, typename Func> void Hierarchy::PropagateRange(Func& func, std::size_t begin, std::size_t end)
+{
+	static_assert(!std::is_const_v<T>, "The propagated component is written");
+	constexpr auto run = std::min({ PagedColumn<T>::PAGE_CAPACITY, PagedColumn<std::remove_const_t<Ts>>::PAGE_CAPACITY... });
+
+	auto& propagated = _group.Container<T>();
+	auto containers = std::forward_as_tuple(_group.Container<Ts>()...);
+
+	auto mark = [](auto& container, std::size_t first, std::size_t count, auto* type)
+	{
+		if constexpr (!std::is_const_v<std::remove_pointer_t<decltype(type)>>)
+		{
+			container.MarkPackedChanged(first, count);
+		}
+	};
+
+	for (auto first = begin; first < end; )
+	{
+		auto count = std::min(run - first % run, end - first);
+		propagated.MarkPackedChanged(first, count);
+
+		std::apply([&](auto&... columns)
+		{
+			auto _ = { 0, (mark(columns, first, count, static_cast<Ts*>(nullptr)), 0)... };
+			auto components = propagated.Packed(first);
+			auto walk = [&](Ts*... others)
+			{
+				for (std::size_t i = 0; i < count; ++i)
+				{
+					auto parent = _parentSlots[first + i];
+					func(parent == NO_PARENT ? nullptr : static_cast<const T*>(propagated.Packed(parent)), components[i], others[i]...);
+				}
+			};
+			walk(static_cast<Ts*>(columns.Packed(first))...);
+		}, containers);
+
+		first += count;
+	}
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Allocator.h"
+
+// Hands out memory by bumping an offset through a list of blocks. Nothing is
+// freed on its own; Reset rewinds to the first block and keeps all of them,
+// so once warmed up a frame's worth of allocations never touches the heap.
+// As the allocator of an EntityManager it suits worlds that are built up and
+// torn down as a whole, since storage given back is not reused.
+class LinearArena final : public Allocator
+{
+public:
+	static constexpr std::size_t DEFAULT_BLOCK_SIZE = 64 * 1024;
+
+	explicit LinearArena(std::size_t blockSize = DEFAULT_BLOCK_SIZE, Allocator& upstream = DefaultAllocator())
+		: _blockSize{ blockSize }, _upstream{ upstream } {}
+	~LinearArena();
+
+	LinearArena(const LinearArena&) = delete;
+	LinearArena& operator=(const LinearArena&) = delete;
+
+	void* Allocate(std::size_t size, std::size_t alignment) override;
+	inline void Deallocate(void*, std::size_t, std::size_t) override {}
+	void Reset();
+
+	inline std::size_t BlockCount() const { return _blocks.size(); }
+
+private:
+	struct Block
+	{
+		std::byte* memory;
+		std::size_t size;
+	};
+
+	std::vector<Block> _blocks;
+	std::size_t _current = 0;
+	std::size_t _offset = 0;
+	std::size_t _blockSize;
+	Allocator& _upstream;
+};
+
+inline LinearArena::~LinearArena()
+{
+	for (const auto& block : _blocks)
+	{
+		_upstream.Deallocate(block.memory, block.size, CACHE_LINE_SIZE);
+	}
+}
+
+inline void* LinearArena::Allocate(std::size_t size, std::size_t alignment)
+{
+	for (; _current < _blocks.size(); ++_current, _offset = 0)
+	{
+		auto& block = _blocks[_current];
+		auto base = reinterpret_cast<std::uintptr_t>(block.memory);
+		auto aligned = (base + _offset + alignment - 1) & ~(std::uintptr_t(alignment) - 1);
+
+		if (aligned + size <= base + block.size)
+		{
+			_offset = aligned + size - base;
+			return reinterpret_cast<void*>(aligned);
+		}
+	}
+
+	auto blockSize = std::max(_blockSize, size + alignment);
+	_blocks.push_back(Block{ static_cast<std::byte*>(_upstream.Allocate(blockSize, CACHE_LINE_SIZE)), blockSize });
+	_current = _blocks.size() - 1;
+	_offset = 0;
+
+	return Allocate(size, alignment);
+}
+
+inline void LinearArena::Reset()
+{
+	_current = 0;
+	_offset = 0;
+}
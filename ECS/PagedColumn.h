@@ -0,0 +1,149 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "Allocator.h"
+
+constexpr std::size_t COLUMN_PAGE_SIZE = 64 * 1024;
+
+// A growable array split into fixed-size pages from an Allocator. Growing
+// adds pages instead of reallocating, so no growth step copies the column
+// and elements never move. Pages hold a power of two of elements, at least
+// one cache line's worth, and start on a cache line: entities that share a
+// cache line in one column share a page, as they would in a flat array.
+template <typename T> class PagedColumn
+{
+public:
+	static constexpr std::size_t PAGE_SHIFT = []
+	{
+		std::size_t shift = 6;
+		while ((std::size_t(2) << shift) * sizeof(T) <= COLUMN_PAGE_SIZE)
+		{
+			++shift;
+		}
+		return shift;
+	}();
+	static constexpr std::size_t PAGE_CAPACITY = std::size_t(1) << PAGE_SHIFT;
+	static constexpr std::size_t PAGE_ALIGNMENT = alignof(T) > CACHE_LINE_SIZE ? alignof(T) : CACHE_LINE_SIZE;
+
+	explicit PagedColumn(Allocator& allocator) : _allocator{ &allocator } {}
+	~PagedColumn();
+
+	PagedColumn(const PagedColumn&) = delete;
+	PagedColumn& operator=(const PagedColumn&) = delete;
+
+	inline std::size_t size() const { return _size; }
+	inline std::size_t Capacity() const { return _pages.size() * PAGE_CAPACITY; }
+	inline const T& operator[](std::size_t index) const { return _pages[index >> PAGE_SHIFT][index & (PAGE_CAPACITY - 1)]; }
+	inline T& operator[](std::size_t index) { return _pages[index >> PAGE_SHIFT][index & (PAGE_CAPACITY - 1)]; }
+
+	// Appends count value-initialized elements.
+	void Grow(std::size_t count);
+	template <typename ... Args> T& EmplaceBack(Args&&... args);
+	void PopBack();
+
+	// Pages stay allocated when elements are popped, for the next growth,
+	// unless the column is shrunk: Shrink pops elements down to size and
+	// gives back every page past them.
+	void Shrink(std::size_t size);
+	inline std::size_t PageCount() const { return _pages.size(); }
+	inline T* Page(std::size_t page) const { return _pages[page]; }
+
+	// Makes an empty column use count elements laid out in memory as whole
+	// pages, e.g. a mapped snapshot. The memory must outlive the column and
+	// is never handed to the allocator; growth past it adds owned pages.
+	void Borrow(T* memory, std::size_t count);
+
+private:
+	void EnsureCapacity(std::size_t size);
+
+	Allocator* _allocator;
+	std::vector<T*> _pages;
+	std::size_t _borrowedPages = 0;
+	std::size_t _size = 0;
+};
+
+template <typename T> PagedColumn<T>::~PagedColumn()
+{
+	for (std::size_t i = 0; i < _size; ++i)
+	{
+		(*this)[i].~T();
+	}
+
+	for (auto page = _borrowedPages; page < _pages.size(); ++page)
+	{
+		_allocator->Deallocate(_pages[page], PAGE_CAPACITY * sizeof(T), PAGE_ALIGNMENT);
+	}
+}
+
+template <typename T> void PagedColumn<T>::Borrow(T* memory, std::size_t count)
+{
+	assert(_size == 0 && _pages.empty());
+
+	for (std::size_t first = 0; first < count; first += PAGE_CAPACITY)
+	{
+		_pages.push_back(memory + first);
+	}
+
+	_borrowedPages = _pages.size();
+	_size = count;
+}
+
+template <typename T> void PagedColumn<T>::Grow(std::size_t count)
+{
+	EnsureCapacity(_size + count);
+
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		new (&(*this)[_size]) T();
+		++_size;
+	}
+}
+
+template <typename T>
+template <typename ... Args> T& PagedColumn<T>::EmplaceBack(Args&&... args)
+{
+	EnsureCapacity(_size + 1);
+
+	auto element = new (&(*this)[_size]) T(std::forward<Args>(args)...);
+	++_size;
+	return *element;
+}
+
+template <typename T> void PagedColumn<T>::PopBack()
+{
+	--_size;
+	(*this)[_size].~T();
+}
+
+template <typename T> void PagedColumn<T>::Shrink(std::size_t size)
+{
+	while (_size > size)
+	{
+		PopBack();
+	}
+
+	auto pages = (size + PAGE_CAPACITY - 1) / PAGE_CAPACITY;
+	while (_pages.size() > pages)
+	{
+		if (_pages.size() > _borrowedPages)
+		{
+			_allocator->Deallocate(_pages.back(), PAGE_CAPACITY * sizeof(T), PAGE_ALIGNMENT);
+		}
+		_pages.pop_back();
+	}
+
+	_borrowedPages = std::min(_borrowedPages, pages);
+}
+
+template <typename T> void PagedColumn<T>::EnsureCapacity(std::size_t size)
+{
+	while (_pages.size() * PAGE_CAPACITY < size)
+	{
+		_pages.push_back(static_cast<T*>(_allocator->Allocate(PAGE_CAPACITY * sizeof(T), PAGE_ALIGNMENT)));
+	}
+}
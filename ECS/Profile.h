@@ -0,0 +1,393 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "Component.h"
+
+// Instrumentation is opt-in: define ECS_PROFILE (cmake -DECS_PROFILE=ON) to
+// have EntityManager time its scans and Each calls, and Scheduler its
+// systems. Without it the ECS_PROFILE_* macros expand to nothing, so their
+// arguments are not even evaluated. The Profiler itself is always there, for
+// timings recorded by hand and for container statistics.
+#if defined(ECS_PROFILE)
+#define ECS_PROFILE_SCOPE(scope, ...) ProfileScope scope(__VA_ARGS__)
+#define ECS_PROFILE_COUNT(scope, scanned, matched) scope.Count(scanned, matched)
+#else
+#define ECS_PROFILE_SCOPE(scope, ...)
+#define ECS_PROFILE_COUNT(scope, scanned, matched)
+#endif
+
+using ProfileClock = std::chrono::steady_clock;
+
+// A query is a filter scanned or iterated by name, e.g. GetEntities or Each.
+struct QueryStats
+{
+	const char* name;
+	EntityFilter filter;
+	std::size_t calls = 0;
+	std::size_t scanned = 0;
+	std::size_t matched = 0;
+	double seconds = 0.0;
+};
+
+// Timings of a system on one thread; a system that ran on several threads
+// has one entry per thread.
+struct SystemStats
+{
+	const char* name;
+	std::size_t thread = 0;
+	std::size_t calls = 0;
+	double seconds = 0.0;
+};
+
+// Storage of one component type. live counts the entities that have it;
+// slots the constructed elements, which for dense columns is one per entity
+// index, live or not; capacity the allocated elements.
+struct ContainerStats
+{
+	ComponentID id;
+	StoragePolicy policy;
+	std::size_t live = 0;
+	std::size_t slots = 0;
+	std::size_t capacity = 0;
+	std::size_t bytes = 0;
+
+	inline double FillRatio() const { return capacity == 0 ? 0.0 : static_cast<double>(live) / capacity; }
+};
+
+struct ProfileStats
+{
+	std::vector<QueryStats> queries;
+	std::vector<SystemStats> systems;
+};
+
+// Collects timed events per thread without locking, except the first time a
+// thread records something. Stats, WriteChromeTrace and Clear must not run
+// while other threads record.
+class Profiler
+{
+public:
+	Profiler() : _epoch{ ProfileClock::now() } {}
+
+	Profiler(const Profiler&) = delete;
+	Profiler& operator=(const Profiler&) = delete;
+
+	void Record(const char* category, const char* name, const EntityFilter& filter, std::size_t scanned,
+				std::size_t matched, ProfileClock::time_point start, ProfileClock::time_point end);
+	// Adds a counter sample per container to the trace.
+	void RecordContainers(const std::vector<ContainerStats>& containers);
+
+	// Returns a pointer that stays valid as long as the profiler, for names
+	// that are not string literals.
+	const char* Intern(const std::string& name);
+
+	ProfileStats Stats() const;
+	// Writes Chrome trace-event JSON, for chrome://tracing or Perfetto.
+	void WriteChromeTrace(std::ostream& out) const;
+	void Clear();
+
+private:
+	struct Event
+	{
+		const char* category;
+		const char* name;
+		EntityFilter filter;
+		std::size_t scanned;
+		std::size_t matched;
+		ProfileClock::time_point start;
+		ProfileClock::duration duration;
+	};
+
+	struct ThreadEvents
+	{
+		std::thread::id owner;
+		std::size_t thread;
+		std::vector<Event> events;
+	};
+
+	struct CounterSample
+	{
+		ProfileClock::time_point time;
+		std::vector<ContainerStats> containers;
+	};
+
+	ThreadEvents& CurrentThreadEvents();
+	double Microseconds(ProfileClock::time_point time) const;
+	static void WriteJsonString(std::ostream& out, const char* text);
+
+	ProfileClock::time_point _epoch;
+	mutable std::mutex _mutex;
+	std::vector<std::unique_ptr<ThreadEvents>> _threads;
+	std::vector<CounterSample> _counters;
+	std::unordered_set<std::string> _names;
+};
+
+inline Profiler& DefaultProfiler()
+{
+	static Profiler profiler;
+	return profiler;
+}
+
+// Records the time from construction to destruction with DefaultProfiler,
+// along with the entities counted in between.
+class ProfileScope
+{
+public:
+	ProfileScope(const char* category, const char* name, const EntityFilter& filter = EntityFilter())
+		: _category{ category }, _name{ name }, _filter{ filter }, _start{ ProfileClock::now() } {}
+	~ProfileScope()
+	{
+		DefaultProfiler().Record(_category, _name, _filter, _scanned, _matched, _start, ProfileClock::now());
+	}
+
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+
+	inline void Count(std::size_t scanned, std::size_t matched)
+	{
+		_scanned += scanned;
+		_matched += matched;
+	}
+
+private:
+	const char* _category;
+	const char* _name;
+	EntityFilter _filter;
+	std::size_t _scanned = 0;
+	std::size_t _matched = 0;
+	ProfileClock::time_point _start;
+};
+
+inline void Profiler::Record(const char* category, const char* name, const EntityFilter& filter,
+							 std::size_t scanned, std::size_t matched, ProfileClock::time_point start,
+							 ProfileClock::time_point end)
+{
+	CurrentThreadEvents().events.push_back(Event{ category, name, filter, scanned, matched, start, end - start });
+}
+
+inline void Profiler::RecordContainers(const std::vector<ContainerStats>& containers)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_counters.push_back(CounterSample{ ProfileClock::now(), containers });
+}
+
+inline const char* Profiler::Intern(const std::string& name)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _names.insert(name).first->c_str();
+}
+
+// The events of a thread are only ever touched by that thread while
+// recording, so the lock is only taken to find them the first time.
+inline Profiler::ThreadEvents& Profiler::CurrentThreadEvents()
+{
+	thread_local const Profiler* cachedProfiler = nullptr;
+	thread_local ThreadEvents* cachedEvents = nullptr;
+
+	if (cachedProfiler == this)
+	{
+		return *cachedEvents;
+	}
+
+	std::lock_guard<std::mutex> lock(_mutex);
+	auto id = std::this_thread::get_id();
+	ThreadEvents* events = nullptr;
+
+	for (auto& thread : _threads)
+	{
+		if (thread->owner == id)
+		{
+			events = thread.get();
+		}
+	}
+
+	if (events == nullptr)
+	{
+		_threads.push_back(std::make_unique<ThreadEvents>(ThreadEvents{ id, _threads.size(), {} }));
+		events = _threads.back().get();
+	}
+
+	cachedProfiler = this;
+	cachedEvents = events;
+	return *events;
+}
+
+inline ProfileStats Profiler::Stats() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	// Names are compared by content: the same literal may have different
+	// addresses in different translation units.
+	struct QueryKeyHash
+	{
+		std::size_t operator()(const std::pair<std::string, EntityFilter>& key) const
+		{
+			return std::hash<std::string>()(key.first) ^ std::hash<EntityFilter>()(key.second);
+		}
+	};
+	struct SystemKeyHash
+	{
+		std::size_t operator()(const std::pair<std::string, std::size_t>& key) const
+		{
+			return std::hash<std::string>()(key.first) ^ (key.second * 0x9E3779B97F4A7C15ull);
+		}
+	};
+
+	std::unordered_map<std::pair<std::string, EntityFilter>, std::size_t, QueryKeyHash> queryIndices;
+	std::unordered_map<std::pair<std::string, std::size_t>, std::size_t, SystemKeyHash> systemIndices;
+	ProfileStats stats;
+
+	for (auto& thread : _threads)
+	{
+		for (auto& event : thread->events)
+		{
+			std::chrono::duration<double> seconds = event.duration;
+
+			if (std::strcmp(event.category, "system") == 0)
+			{
+				auto key = std::make_pair(std::string(event.name), thread->thread);
+				auto inserted = systemIndices.emplace(key, stats.systems.size());
+				if (inserted.second)
+				{
+					stats.systems.push_back(SystemStats{ event.name, thread->thread });
+				}
+
+				auto& system = stats.systems[inserted.first->second];
+				++system.calls;
+				system.seconds += seconds.count();
+				continue;
+			}
+
+			auto key = std::make_pair(std::string(event.name), event.filter);
+			auto inserted = queryIndices.emplace(key, stats.queries.size());
+			if (inserted.second)
+			{
+				stats.queries.push_back(QueryStats{ event.name, event.filter });
+			}
+
+			auto& query = stats.queries[inserted.first->second];
+			++query.calls;
+			query.scanned += event.scanned;
+			query.matched += event.matched;
+			query.seconds += seconds.count();
+		}
+	}
+
+	return stats;
+}
+
+inline void Profiler::WriteChromeTrace(std::ostream& out) const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	char number[64];
+	auto separator = "\n";
+
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+	for (auto& thread : _threads)
+	{
+		out << separator << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread->thread
+			<< ",\"args\":{\"name\":\"Thread " << thread->thread << "\"}}";
+		separator = ",\n";
+
+		for (auto& event : thread->events)
+		{
+			std::chrono::duration<double, std::micro> duration = event.duration;
+
+			out << separator << "{\"name\":";
+			WriteJsonString(out, event.name);
+			out << ",\"cat\":";
+			WriteJsonString(out, event.category);
+			std::snprintf(number, sizeof(number), ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f", Microseconds(event.start),
+						  duration.count());
+			out << number << ",\"pid\":1,\"tid\":" << thread->thread;
+
+			if (std::strcmp(event.category, "system") != 0)
+			{
+				out << ",\"args\":{\"scanned\":" << event.scanned << ",\"matched\":" << event.matched
+					<< ",\"filter\":\"";
+				auto first = true;
+				for (std::size_t id = 0; id < event.filter.size(); ++id)
+				{
+					if (event.filter[id])
+					{
+						out << (first ? "" : ",") << id;
+						first = false;
+					}
+				}
+				out << "\"}";
+			}
+
+			out << "}";
+		}
+	}
+
+	for (auto& sample : _counters)
+	{
+		std::snprintf(number, sizeof(number), "%.3f", Microseconds(sample.time));
+
+		for (auto& container : sample.containers)
+		{
+			out << separator << "{\"name\":\"Component " << container.id << "\",\"cat\":\"container\",\"ph\":\"C\",\"ts\":"
+				<< number << ",\"pid\":1,\"args\":{\"live\":" << container.live << ",\"slots\":" << container.slots
+				<< ",\"capacity\":" << container.capacity << ",\"bytes\":" << container.bytes << "}}";
+			separator = ",\n";
+		}
+	}
+
+	out << "\n]}\n";
+}
+
+inline void Profiler::Clear()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	// Threads keep their event lists, which they may have cached.
+	for (auto& thread : _threads)
+	{
+		thread->events.clear();
+	}
+
+	_counters.clear();
+	_epoch = ProfileClock::now();
+}
+
+inline double Profiler::Microseconds(ProfileClock::time_point time) const
+{
+	std::chrono::duration<double, std::micro> sinceEpoch = time - _epoch;
+	return sinceEpoch.count();
+}
+
+inline void Profiler::WriteJsonString(std::ostream& out, const char* text)
+{
+	out << '"';
+	for (auto c = text; *c != '\0'; ++c)
+	{
+		if (*c == '"' || *c == '\\')
+		{
+			out << '\\' << *c;
+		}
+		else if (static_cast<unsigned char>(*c) < 0x20)
+		{
+			char escaped[8];
+			std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned char>(*c));
+			out << escaped;
+		}
+		else
+		{
+			out << *c;
+		}
+	}
+	out << '"';
+}
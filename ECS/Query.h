@@ -0,0 +1,162 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "Component.h"
+
+// The set of entities whose signature contains a filter. Registered with an
+// EntityManager, which keeps it up to date as signatures change, so reading
+// it does not scan anything.
+class Query
+{
+public:
+	explicit Query(const EntityFilter& filter) : _filter{ filter } {}
+
+	inline const EntityFilter& Filter() const { return _filter; }
+	inline bool Matches(const EntityFilter& signature) const { return (signature & _filter) == _filter; }
+
+	// Unordered unless sorted by the manager; the order changes whenever an
+	// entity leaves the query.
+	inline const std::vector<EntityIndex>& Entities() const { return _entities; }
+	inline bool Contains(EntityIndex entity) const
+	{
+		return entity < _positionByEntity.size() && _positionByEntity[entity] != NOT_CONTAINED;
+	}
+
+private:
+	friend class EntityManager;
+
+	static constexpr std::size_t NOT_CONTAINED = static_cast<std::size_t>(-1);
+
+	void Update(EntityIndex entity, const EntityFilter& before, const EntityFilter& after);
+	void Add(EntityIndex entity);
+	void Remove(EntityIndex entity);
+	void Sort();
+	// Compaction support: a and b trade places, and indices from count on,
+	// none of which may be contained, are dropped.
+	void Swap(EntityIndex a, EntityIndex b);
+	void Truncate(std::size_t count);
+
+	EntityFilter _filter;
+	bool _sorted = true;
+	std::vector<EntityIndex> _entities;
+	std::vector<std::size_t> _positionByEntity;
+
+	// Observer support: once observed, every entity that joins or leaves is
+	// noted in touched, possibly more than once, until the manager flushes.
+	bool _observed = false;
+	std::vector<EntityIndex> _touched;
+};
+
+inline void Query::Update(EntityIndex entity, const EntityFilter& before, const EntityFilter& after)
+{
+	auto matchedBefore = Matches(before);
+	auto matchesNow = Matches(after);
+
+	if (matchesNow && !matchedBefore)
+	{
+		Add(entity);
+	}
+	else if (matchedBefore && !matchesNow)
+	{
+		Remove(entity);
+	}
+}
+
+inline void Query::Add(EntityIndex entity)
+{
+	if (entity >= _positionByEntity.size())
+	{
+		_positionByEntity.resize(entity + 1, NOT_CONTAINED);
+	}
+
+	_sorted = _sorted && (_entities.empty() || _entities.back() < entity);
+	_positionByEntity[entity] = _entities.size();
+	_entities.push_back(entity);
+
+	if (_observed)
+	{
+		_touched.push_back(entity);
+	}
+}
+
+inline void Query::Remove(EntityIndex entity)
+{
+	auto position = _positionByEntity[entity];
+	auto last = _entities.back();
+	_sorted = _sorted && position == _entities.size() - 1;
+
+	_entities[position] = last;
+	_positionByEntity[last] = position;
+
+	_entities.pop_back();
+	_positionByEntity[entity] = NOT_CONTAINED;
+
+	if (_observed)
+	{
+		_touched.push_back(entity);
+	}
+}
+
+inline void Query::Sort()
+{
+	if (_sorted)
+	{
+		return;
+	}
+
+	std::sort(_entities.begin(), _entities.end());
+
+	for (std::size_t position = 0; position < _entities.size(); ++position)
+	{
+		_positionByEntity[_entities[position]] = position;
+	}
+
+	_sorted = true;
+}
+
+inline void Query::Swap(EntityIndex a, EntityIndex b)
+{
+	auto containsA = Contains(a);
+	auto containsB = Contains(b);
+
+	if (!containsA && !containsB)
+	{
+		return;
+	}
+
+	auto needed = std::max(a, b) + 1;
+	if (_positionByEntity.size() < needed)
+	{
+		_positionByEntity.resize(needed, NOT_CONTAINED);
+	}
+
+	std::swap(_positionByEntity[a], _positionByEntity[b]);
+	if (containsA)
+	{
+		_entities[_positionByEntity[b]] = b;
+	}
+	if (containsB)
+	{
+		_entities[_positionByEntity[a]] = a;
+	}
+
+	if (_observed)
+	{
+		_touched.push_back(a);
+		_touched.push_back(b);
+	}
+
+	_sorted = false;
+}
+
+inline void Query::Truncate(std::size_t count)
+{
+	if (_positionByEntity.size() > count)
+	{
+		_positionByEntity.resize(count);
+		_positionByEntity.shrink_to_fit();
+	}
+}
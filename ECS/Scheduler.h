@@ -0,0 +1,182 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "ECS.h"
+#include "ThreadPool.h"
+
+// Access declarations for System<...>, e.g. System<Read<Velocity>, Write<Position>>.
+template <typename T> struct Read { };
+template <typename T> struct Write { };
+
+// Declares that a system may touch anything, including structural changes
+// such as creating entities or adding components; it runs on its own.
+struct Exclusive { };
+
+struct ComponentAccess
+{
+	EntityFilter reads;
+	EntityFilter writes;
+	bool exclusive = false;
+
+	inline bool ConflictsWith(const ComponentAccess& other) const
+	{
+		return exclusive || other.exclusive ||
+			(writes & (other.reads | other.writes)).any() ||
+			(other.writes & reads).any();
+	}
+};
+
+template <typename T> struct AccessDeclaration;
+
+template <typename T> struct AccessDeclaration<Read<T>>
+{
+	static void AddTo(ComponentAccess& access) { access.reads.set(GetComponentID<T>(), true); }
+};
+
+template <typename T> struct AccessDeclaration<Write<T>>
+{
+	static void AddTo(ComponentAccess& access) { access.writes.set(GetComponentID<T>(), true); }
+};
+
+template <> struct AccessDeclaration<Exclusive>
+{
+	static void AddTo(ComponentAccess& access) { access.exclusive = true; }
+};
+
+// A unit of work together with the components it reads and writes. func is
+// either called with the EntityManager, or - if it takes components - passed
+// to EntityManager::Each. Declared access is not checked against what func
+// actually does.
+template <typename ... Accesses> class System
+{
+public:
+	template <typename Func> explicit System(Func&& func);
+
+	ComponentAccess Access() const;
+	inline const std::function<void(EntityManager&)>& Run() const { return _run; }
+
+private:
+	std::function<void(EntityManager&)> _run;
+};
+
+template <typename ... Accesses>
+template <typename Func> System<Accesses...>::System(Func&& func)
+{
+	if constexpr (std::is_invocable_v<Func&, EntityManager&>)
+	{
+		_run = std::forward<Func>(func);
+	}
+	else
+	{
+		_run = [each = std::forward<Func>(func)](EntityManager& manager) mutable { manager.Each(each); };
+	}
+}
+
+template <typename ... Accesses> ComponentAccess System<Accesses...>::Access() const
+{
+	ComponentAccess access;
+	auto _ = { (AccessDeclaration<Accesses>::AddTo(access), 0)... };
+	return access;
+}
+
+// Runs registered systems on a thread pool. Two systems conflict if one writes
+// what the other reads or writes; conflicting systems run in the order they
+// were added, all others run concurrently.
+class Scheduler
+{
+public:
+	Scheduler(EntityManager& manager, ThreadPool& pool) : _manager{ manager }, _pool{ pool } {}
+
+	// name labels the system in profiles; it defaults to "System <index>".
+	template <typename ... Accesses> std::size_t Add(System<Accesses...> system, std::string name = std::string());
+	void Run();
+
+	inline std::size_t SystemCount() const { return _systems.size(); }
+	inline const std::vector<std::size_t>& Dependencies(std::size_t system) const { return _systems[system].dependencies; }
+
+private:
+	struct ScheduledSystem
+	{
+		std::function<void(EntityManager&)> run;
+		std::string name;
+		ComponentAccess access;
+		std::vector<std::size_t> dependencies;
+		std::vector<std::size_t> dependents;
+	};
+
+	void Start(std::size_t system, TaskGroup& group);
+
+	EntityManager& _manager;
+	ThreadPool& _pool;
+	std::vector<ScheduledSystem> _systems;
+	std::vector<std::atomic<std::size_t>> _remainingDependencies;
+};
+
+template <typename ... Accesses> std::size_t Scheduler::Add(System<Accesses...> system, std::string name)
+{
+	auto index = _systems.size();
+	if (name.empty())
+	{
+		name = "System " + std::to_string(index);
+	}
+
+	_systems.push_back(ScheduledSystem{ system.Run(), std::move(name), system.Access(), {}, {} });
+	auto& added = _systems.back();
+
+	for (std::size_t earlier = 0; earlier < index; ++earlier)
+	{
+		if (added.access.ConflictsWith(_systems[earlier].access))
+		{
+			added.dependencies.push_back(earlier);
+			_systems[earlier].dependents.push_back(index);
+		}
+	}
+
+	_remainingDependencies = std::vector<std::atomic<std::size_t>>(_systems.size());
+	return index;
+}
+
+inline void Scheduler::Run()
+{
+	for (std::size_t i = 0; i < _systems.size(); ++i)
+	{
+		_remainingDependencies[i].store(_systems[i].dependencies.size(), std::memory_order_relaxed);
+	}
+
+	TaskGroup group;
+
+	for (std::size_t i = 0; i < _systems.size(); ++i)
+	{
+		if (_systems[i].dependencies.empty())
+		{
+			Start(i, group);
+		}
+	}
+
+	_pool.Wait(group);
+}
+
+inline void Scheduler::Start(std::size_t system, TaskGroup& group)
+{
+	_pool.Submit(group, [this, system, &group]
+	{
+		{
+			ECS_PROFILE_SCOPE(profile, "system", DefaultProfiler().Intern(_systems[system].name));
+			_systems[system].run(_manager);
+		}
+
+		for (auto dependent : _systems[system].dependents)
+		{
+			if (_remainingDependencies[dependent].fetch_sub(1, std::memory_order_acq_rel) == 1)
+			{
+				Start(dependent, group);
+			}
+		}
+	});
+}
@@ -0,0 +1,420 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "Component.h"
+
+// Kernel selection happens at compile time: AVX2 when the compiler targets it
+// (/arch:AVX2, -mavx2), SSE2 on any x64 build, scalar otherwise or when
+// ECS_NO_SIMD is defined.
+#if !defined(ECS_NO_SIMD) && defined(__AVX2__)
+#define ECS_SIMD_AVX2
+#include <immintrin.h>
+#elif !defined(ECS_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define ECS_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+
+// A signature of up to 32 components packed into one word, as World stores
+// them, so that they can be scanned several at a time.
+using SignatureWord = std::uint32_t;
+
+// EntityManager stores an interned ID per entity instead, see SignatureTable.
+using SignatureID = std::uint32_t;
+constexpr SignatureID EMPTY_SIGNATURE = 0;
+
+// Gives every distinct signature a small ID, so that an entity stores four
+// bytes whatever MAX_COMPONENT_COUNT is. IDs are never given back; a world
+// only ever uses a few hundred distinct signatures. Adding or removing a
+// component is cached per signature and component, like the edges of an
+// archetype graph, so that it costs a lookup instead of hashing the bitset.
+class SignatureTable
+{
+public:
+	SignatureTable() { Intern(EntityFilter()); }
+
+	SignatureID Intern(const EntityFilter& signature);
+	SignatureID With(SignatureID id, ComponentID component);
+	SignatureID Without(SignatureID id, ComponentID component);
+
+	// Valid until the next new signature is interned.
+	inline const EntityFilter& Get(SignatureID id) const { return _signatures[id]; }
+	inline bool Contains(SignatureID id, ComponentID component) const { return _signatures[id][component]; }
+	inline std::size_t Count() const { return _signatures.size(); }
+
+private:
+	SignatureID Follow(SignatureID id, ComponentID component, bool add);
+
+	std::vector<EntityFilter> _signatures;
+	std::unordered_map<EntityFilter, SignatureID> _idBySignature;
+	std::unordered_map<std::uint64_t, SignatureID> _edges;
+};
+
+inline SignatureID SignatureTable::Intern(const EntityFilter& signature)
+{
+	auto existing = _idBySignature.find(signature);
+	if (existing != _idBySignature.end())
+	{
+		return existing->second;
+	}
+
+	auto id = static_cast<SignatureID>(_signatures.size());
+	_signatures.push_back(signature);
+	_idBySignature.emplace(signature, id);
+	return id;
+}
+
+inline SignatureID SignatureTable::With(SignatureID id, ComponentID component)
+{
+	return Contains(id, component) ? id : Follow(id, component, true);
+}
+
+inline SignatureID SignatureTable::Without(SignatureID id, ComponentID component)
+{
+	return Contains(id, component) ? Follow(id, component, false) : id;
+}
+
+inline SignatureID SignatureTable::Follow(SignatureID id, ComponentID component, bool add)
+{
+	auto key = (std::uint64_t(id) << 32) | (std::uint64_t(component) << 1) | (add ? 1 : 0);
+
+	auto edge = _edges.find(key);
+	if (edge != _edges.end())
+	{
+		return edge->second;
+	}
+
+	auto target = Intern(EntityFilter(_signatures[id]).set(component, add));
+	_edges.emplace(key, target);
+	return target;
+}
+
+// Whether each signature of a table contains a filter, as 0 or ~0 per ID so
+// that the AVX2 kernel can gather it. Built per scan: there are far fewer
+// signatures than entities, and a filter no signature contains skips the
+// scan altogether.
+class SignatureMatchTable
+{
+public:
+	SignatureMatchTable(const SignatureTable& signatures, const EntityFilter& filter);
+
+	inline bool Matches(SignatureID id) const { return _matches[id] != 0; }
+	inline const std::int32_t* Data() const { return _matches.data(); }
+	inline std::size_t MatchCount() const { return _matchCount; }
+
+private:
+	std::vector<std::int32_t> _matches;
+	std::size_t _matchCount = 0;
+};
+
+inline SignatureMatchTable::SignatureMatchTable(const SignatureTable& signatures, const EntityFilter& filter)
+	: _matches(signatures.Count(), 0)
+{
+	for (SignatureID id = 0; id < _matches.size(); ++id)
+	{
+		if ((signatures.Get(id) & filter) == filter)
+		{
+			_matches[id] = -1;
+			++_matchCount;
+		}
+	}
+}
+
+inline bool MatchesSignature(SignatureWord signature, SignatureWord filter)
+{
+	return (signature & filter) == filter;
+}
+
+// All of these append every i in [0, count) with a matching signature to
+// matches; MatchSignatures and MatchSignatureIDs use the best kernel this
+// build was compiled for.
+inline void MatchSignaturesScalar(const SignatureWord* signatures, std::size_t count, SignatureWord filter,
+								  OUT std::vector<EntityIndex>& matches)
+{
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		if (MatchesSignature(signatures[i], filter))
+		{
+			matches.push_back(i);
+		}
+	}
+}
+
+inline void MatchSignatureIDsScalar(const SignatureID* signatures, std::size_t count, const SignatureMatchTable& table,
+									OUT std::vector<EntityIndex>& matches)
+{
+	for (std::size_t i = 0; i < count; ++i)
+	{
+		if (table.Matches(signatures[i]))
+		{
+			matches.push_back(i);
+		}
+	}
+}
+
+#if defined(ECS_SIMD_AVX2) || defined(ECS_SIMD_SSE2)
+
+namespace SignatureMatchDetail
+{
+#if defined(ECS_SIMD_AVX2)
+	constexpr std::size_t LANES = 8;
+#else
+	constexpr std::size_t LANES = 4;
+#endif
+
+	// Signatures are matched in blocks small enough to stay in L1 between the
+	// counting pass and the compaction pass. Counting first means the output
+	// only has to grow by the number of matches, not by the block size.
+	constexpr std::size_t BLOCK_SIZE = 2048;
+
+	// For every lane mask: the matching lanes moved to the front, and how many there are.
+	struct CompressTable
+	{
+		alignas(32) std::uint32_t lanes[1 << LANES][LANES] = {};
+		std::uint8_t counts[1 << LANES] = {};
+
+		constexpr CompressTable()
+		{
+			for (std::size_t mask = 0; mask < (1 << LANES); ++mask)
+			{
+				std::uint8_t count = 0;
+				for (std::uint32_t lane = 0; lane < LANES; ++lane)
+				{
+					if (mask & (std::size_t(1) << lane))
+					{
+						lanes[mask][count++] = lane;
+					}
+				}
+				counts[mask] = count;
+			}
+		}
+	};
+
+	inline constexpr CompressTable COMPRESS_TABLE{};
+
+#if defined(ECS_SIMD_AVX2)
+	inline int MatchMask(const SignatureWord* signatures, __m256i filter)
+	{
+		auto words = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(signatures));
+		auto equal = _mm256_cmpeq_epi32(_mm256_and_si256(words, filter), filter);
+		return _mm256_movemask_ps(_mm256_castsi256_ps(equal));
+	}
+
+	inline int MatchMask(const SignatureID* signatures, const std::int32_t* table)
+	{
+		auto ids = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(signatures));
+		auto matched = _mm256_i32gather_epi32(reinterpret_cast<const int*>(table), ids, sizeof(std::int32_t));
+		return _mm256_movemask_ps(_mm256_castsi256_ps(matched));
+	}
+
+	inline std::size_t CountMatches(const SignatureWord* signatures, std::size_t count, SignatureWord filter)
+	{
+		auto wideFilter = _mm256_set1_epi32(static_cast<int>(filter));
+		auto matched = _mm256_setzero_si256();
+
+		for (std::size_t i = 0; i < count; i += LANES)
+		{
+			auto words = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(signatures + i));
+			matched = _mm256_sub_epi32(matched, _mm256_cmpeq_epi32(_mm256_and_si256(words, wideFilter), wideFilter));
+		}
+
+		alignas(32) std::uint32_t lanes[LANES];
+		_mm256_store_si256(reinterpret_cast<__m256i*>(lanes), matched);
+
+		std::size_t total = 0;
+		for (auto lane : lanes)
+		{
+			total += lane;
+		}
+		return total;
+	}
+
+	// Writes up to LANES indices past the last match; out needs that much slack.
+	template <typename MaskAt>
+	inline std::size_t CompactLanes(std::size_t count, MaskAt maskAt, EntityIndex first, EntityIndex* out)
+	{
+		std::size_t written = 0;
+
+		for (std::size_t i = 0; i < count; i += LANES)
+		{
+			auto mask = maskAt(i);
+			auto lanes = _mm256_load_si256(reinterpret_cast<const __m256i*>(COMPRESS_TABLE.lanes[mask]));
+			auto offsets = _mm256_add_epi32(lanes, _mm256_set1_epi32(static_cast<int>(i)));
+
+			if constexpr (sizeof(EntityIndex) == 8)
+			{
+				auto base = _mm256_set1_epi64x(static_cast<long long>(first));
+				auto low = _mm256_add_epi64(_mm256_cvtepu32_epi64(_mm256_castsi256_si128(offsets)), base);
+				auto high = _mm256_add_epi64(_mm256_cvtepu32_epi64(_mm256_extracti128_si256(offsets, 1)), base);
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + written), low);
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + written + 4), high);
+			}
+			else
+			{
+				auto base = _mm256_set1_epi32(static_cast<int>(first));
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + written), _mm256_add_epi32(offsets, base));
+			}
+
+			written += COMPRESS_TABLE.counts[mask];
+		}
+
+		return written;
+	}
+
+	inline std::size_t Compact(const SignatureWord* signatures, std::size_t count, SignatureWord filter,
+							   EntityIndex first, EntityIndex* out)
+	{
+		auto wideFilter = _mm256_set1_epi32(static_cast<int>(filter));
+		return CompactLanes(count, [&](std::size_t i) { return MatchMask(signatures + i, wideFilter); }, first, out);
+	}
+#else
+	inline int MatchMask(const SignatureWord* signatures, __m128i filter)
+	{
+		auto words = _mm_loadu_si128(reinterpret_cast<const __m128i*>(signatures));
+		auto equal = _mm_cmpeq_epi32(_mm_and_si128(words, filter), filter);
+		return _mm_movemask_ps(_mm_castsi128_ps(equal));
+	}
+
+	// No gather in SSE2; table entries are all ones or all zeros, so each
+	// lookup masks in its own lane's bit.
+	inline int MatchMask(const SignatureID* signatures, const std::int32_t* table)
+	{
+		return (table[signatures[0]] & 1) | (table[signatures[1]] & 2) | (table[signatures[2]] & 4) | (table[signatures[3]] & 8);
+	}
+
+	inline std::size_t CountMatches(const SignatureWord* signatures, std::size_t count, SignatureWord filter)
+	{
+		auto wideFilter = _mm_set1_epi32(static_cast<int>(filter));
+		std::size_t total = 0;
+
+		for (std::size_t i = 0; i < count; i += LANES)
+		{
+			total += COMPRESS_TABLE.counts[MatchMask(signatures + i, wideFilter)];
+		}
+
+		return total;
+	}
+
+	// SSE2 has no variable lane shuffle, so the compressed lanes are stored
+	// individually - but unconditionally, without a branch per entity.
+	template <typename MaskAt>
+	inline std::size_t CompactLanes(std::size_t count, MaskAt maskAt, EntityIndex first, EntityIndex* out)
+	{
+		std::size_t written = 0;
+
+		for (std::size_t i = 0; i < count; i += LANES)
+		{
+			auto mask = maskAt(i);
+			const auto& lanes = COMPRESS_TABLE.lanes[mask];
+			auto base = first + i;
+
+			out[written + 0] = base + lanes[0];
+			out[written + 1] = base + lanes[1];
+			out[written + 2] = base + lanes[2];
+			out[written + 3] = base + lanes[3];
+			written += COMPRESS_TABLE.counts[mask];
+		}
+
+		return written;
+	}
+
+	inline std::size_t Compact(const SignatureWord* signatures, std::size_t count, SignatureWord filter,
+							   EntityIndex first, EntityIndex* out)
+	{
+		auto wideFilter = _mm_set1_epi32(static_cast<int>(filter));
+		return CompactLanes(count, [&](std::size_t i) { return MatchMask(signatures + i, wideFilter); }, first, out);
+	}
+#endif
+
+	inline std::size_t Compact(const SignatureID* signatures, std::size_t count, const std::int32_t* table,
+							   EntityIndex first, EntityIndex* out)
+	{
+		return CompactLanes(count, [&](std::size_t i) { return MatchMask(signatures + i, table); }, first, out);
+	}
+
+	// Filter is a SignatureWord to match words, or the data of a SignatureMatchTable to match IDs.
+	template <typename Filter, typename Matches>
+	inline void MatchInBlocks(const std::uint32_t* signatures, std::size_t count, Filter filter, Matches matches,
+							  OUT std::vector<EntityIndex>& out)
+	{
+		auto vectorized = count - count % LANES;
+
+		for (std::size_t first = 0; first < vectorized; first += BLOCK_SIZE)
+		{
+			auto blockSize = std::min(BLOCK_SIZE, vectorized - first);
+
+			// Looking IDs up costs more than masking words, so they are
+			// compacted in one pass into a buffer instead of counted first.
+			if constexpr (std::is_pointer_v<Filter>)
+			{
+				EntityIndex buffer[BLOCK_SIZE + LANES];
+				auto matched = Compact(signatures + first, blockSize, filter, first, buffer);
+				out.insert(out.end(), buffer, buffer + matched);
+			}
+			else
+			{
+				auto matched = CountMatches(signatures + first, blockSize, filter);
+
+				if (matched == 0)
+				{
+					continue;
+				}
+
+				auto offset = out.size();
+				out.resize(offset + matched + LANES);
+				Compact(signatures + first, blockSize, filter, first, out.data() + offset);
+				out.resize(offset + matched);
+			}
+		}
+
+		for (auto i = vectorized; i < count; ++i)
+		{
+			if (matches(signatures[i]))
+			{
+				out.push_back(i);
+			}
+		}
+	}
+}
+
+inline void MatchSignatures(const SignatureWord* signatures, std::size_t count, SignatureWord filter,
+							OUT std::vector<EntityIndex>& matches)
+{
+	SignatureMatchDetail::MatchInBlocks(signatures, count, filter,
+										[filter](SignatureWord signature) { return MatchesSignature(signature, filter); },
+										OUT matches);
+}
+
+inline void MatchSignatureIDs(const SignatureID* signatures, std::size_t count, const SignatureMatchTable& table,
+							  OUT std::vector<EntityIndex>& matches)
+{
+	if (table.MatchCount() > 0)
+	{
+		SignatureMatchDetail::MatchInBlocks(signatures, count, table.Data(),
+											[&table](SignatureID signature) { return table.Matches(signature); },
+											OUT matches);
+	}
+}
+
+#else
+
+inline void MatchSignatures(const SignatureWord* signatures, std::size_t count, SignatureWord filter,
+							OUT std::vector<EntityIndex>& matches)
+{
+	MatchSignaturesScalar(signatures, count, filter, OUT matches);
+}
+
+inline void MatchSignatureIDs(const SignatureID* signatures, std::size_t count, const SignatureMatchTable& table,
+							  OUT std::vector<EntityIndex>& matches)
+{
+	if (table.MatchCount() > 0)
+	{
+		MatchSignatureIDsScalar(signatures, count, table, OUT matches);
+	}
+}
+
+#endif
@@ -0,0 +1,436 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "ECS.h"
+
+constexpr std::uint32_t SNAPSHOT_MAGIC = 0x53534345;	// "ECSS"
+// 3: tags, EntityState included, are columns without any data.
+constexpr std::uint32_t SNAPSHOT_FORMAT_VERSION = 3;
+
+enum class SnapshotLoad
+{
+	Map,	// map the file and let raw columns use it in place; pages are copied on first write
+	Copy	// read the file and copy everything into the manager's own storage
+};
+
+// Saves an EntityManager in StorageMode::Columns to a binary file and loads
+// it back into a fresh one with the same UsedComponents. Every block in the
+// file starts on a cache line and raw columns are stored as whole pages, so
+// a mapped snapshot can serve as column storage without copying anything.
+// Change versions are not saved; loaded components count as unchanged.
+class Snapshot
+{
+public:
+	// Fails in archetype mode, if a component type is neither trivially
+	// copyable nor has a SnapshotHook, or if the file can't be written.
+	static bool Save(const EntityManager& manager, const std::string& path);
+	// Fails unless manager has no entities yet, was set up with the same
+	// component types in the same order, and the file is a valid snapshot.
+	// Only a SnapshotHook failing to read leaves components behind, in which
+	// case manager should be discarded.
+	static bool Load(EntityManager& manager, const std::string& path, SnapshotLoad mode = SnapshotLoad::Map);
+
+private:
+	struct Header
+	{
+		std::uint32_t magic;
+		std::uint32_t formatVersion;
+		std::uint64_t entityCount;
+		std::uint64_t freeCount;
+		std::uint32_t columnCount;
+		std::uint32_t signatureCount;
+		std::uint64_t columnsOffset;
+		std::uint64_t freeListOffset;
+		std::uint64_t generationsOffset;
+		std::uint64_t signatureTableOffset;
+		std::uint64_t signaturesOffset;
+	};
+
+	struct ColumnRecord
+	{
+		std::uint32_t policy;
+		std::uint32_t elementSize;
+		std::uint32_t raw;
+		std::uint64_t count;
+		std::uint64_t ownersOffset;
+		std::uint64_t dataOffset;
+		std::uint64_t dataSize;
+	};
+
+	// Signatures are stored with one bit per column, in words of this many
+	// bits, so that the component IDs of the saving process don't matter.
+	static constexpr std::size_t COLUMN_BITS_PER_WORD = 64;
+	static inline std::size_t ColumnWords(std::size_t columnCount)
+	{
+		return (columnCount + COLUMN_BITS_PER_WORD - 1) / COLUMN_BITS_PER_WORD;
+	}
+
+	static std::uint64_t Align(std::ostream& out);
+	static std::shared_ptr<const std::byte> ReadFile(const std::string& path, SnapshotLoad mode, OUT std::size_t& size);
+};
+
+inline bool Snapshot::Save(const EntityManager& manager, const std::string& path)
+{
+	if (manager._storageMode != StorageMode::Columns)
+	{
+		return false;
+	}
+
+	for (auto id : manager._usedComponents)
+	{
+		if (manager._containers[id] != nullptr && !manager._containers[id]->CanSnapshot())
+		{
+			return false;
+		}
+	}
+
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	if (!out)
+	{
+		return false;
+	}
+
+	Header header{};
+	header.magic = SNAPSHOT_MAGIC;
+	header.formatVersion = SNAPSHOT_FORMAT_VERSION;
+	header.entityCount = manager._firstUsableEntityIndex;
+	header.freeCount = manager._freeEntityIndices.size();
+	header.columnCount = static_cast<std::uint32_t>(manager._usedComponents.size());
+	header.signatureCount = static_cast<std::uint32_t>(manager._signatures.Count());
+
+	// Header and column table are written again once all offsets are known.
+	std::vector<ColumnRecord> columns(header.columnCount);
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	header.columnsOffset = Align(out);
+	out.write(reinterpret_cast<const char*>(columns.data()), columns.size() * sizeof(ColumnRecord));
+
+	header.freeListOffset = Align(out);
+	for (auto entity : manager._freeEntityIndices)
+	{
+		auto value = static_cast<std::uint64_t>(entity);
+		out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+	}
+
+	header.generationsOffset = Align(out);
+	out.write(reinterpret_cast<const char*>(manager._generations.data()), manager._generations.size() * sizeof(EntityGeneration));
+
+	header.signatureTableOffset = Align(out);
+	std::vector<std::uint64_t> words(ColumnWords(header.columnCount));
+	for (SignatureID id = 0; id < header.signatureCount; ++id)
+	{
+		std::fill(words.begin(), words.end(), 0);
+		for (std::size_t column = 0; column < header.columnCount; ++column)
+		{
+			if (manager._signatures.Contains(id, manager._usedComponents[column]))
+			{
+				words[column / COLUMN_BITS_PER_WORD] |= std::uint64_t(1) << (column % COLUMN_BITS_PER_WORD);
+			}
+		}
+		out.write(reinterpret_cast<const char*>(words.data()), words.size() * sizeof(std::uint64_t));
+	}
+
+	header.signaturesOffset = Align(out);
+	out.write(reinterpret_cast<const char*>(manager._signatureByEntity.data()),
+			  manager._signatureByEntity.size() * sizeof(SignatureID));
+
+	for (std::size_t i = 0; i < columns.size(); ++i)
+	{
+		auto id = manager._usedComponents[i];
+		if (manager._containers[id] == nullptr)
+		{
+			continue;
+		}
+
+		const auto& container = *manager._containers[id];
+		auto& column = columns[i];
+
+		column.policy = static_cast<std::uint32_t>(container.Policy());
+		column.elementSize = static_cast<std::uint32_t>(container.ElementSize());
+		column.raw = container.IsRaw() ? 1 : 0;
+		column.count = container.StoredCount();
+
+		if (container.Policy() == StoragePolicy::Sparse)
+		{
+			column.ownersOffset = Align(out);
+			for (auto owner : container.Owners())
+			{
+				auto value = static_cast<std::uint64_t>(owner);
+				out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+			}
+		}
+
+		column.dataOffset = Align(out);
+		container.WriteComponents(out);
+		column.dataSize = static_cast<std::uint64_t>(out.tellp()) - column.dataOffset;
+	}
+
+	out.seekp(0);
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	out.seekp(header.columnsOffset);
+	out.write(reinterpret_cast<const char*>(columns.data()), columns.size() * sizeof(ColumnRecord));
+
+	return out.good();
+}
+
+inline bool Snapshot::Load(EntityManager& manager, const std::string& path, SnapshotLoad mode)
+{
+	if (manager._storageMode != StorageMode::Columns || manager._firstUsableEntityIndex != 0)
+	{
+		return false;
+	}
+
+	std::size_t size = 0;
+	auto memory = ReadFile(path, mode, OUT size);
+	if (!memory || size < sizeof(Header))
+	{
+		return false;
+	}
+
+	auto base = memory.get();
+	auto fits = [size](std::uint64_t offset, std::uint64_t bytes) { return offset <= size && bytes <= size - offset; };
+	// Divides rather than multiplies, so that huge counts can't wrap around.
+	auto fitsArray = [size](std::uint64_t offset, std::uint64_t count, std::uint64_t elementSize)
+	{
+		return offset <= size && (elementSize == 0 || count <= (size - offset) / elementSize);
+	};
+
+	Header header;
+	std::memcpy(&header, base, sizeof(header));
+
+	if (header.magic != SNAPSHOT_MAGIC || header.formatVersion != SNAPSHOT_FORMAT_VERSION ||
+		header.columnCount != manager._usedComponents.size() || header.signatureCount == 0 ||
+		!fitsArray(header.columnsOffset, header.columnCount, sizeof(ColumnRecord)) ||
+		!fitsArray(header.freeListOffset, header.freeCount, sizeof(std::uint64_t)) ||
+		!fitsArray(header.generationsOffset, header.entityCount, sizeof(EntityGeneration)) ||
+		!fitsArray(header.signatureTableOffset, header.signatureCount, ColumnWords(header.columnCount) * sizeof(std::uint64_t)) ||
+		!fitsArray(header.signaturesOffset, header.entityCount, sizeof(SignatureID)))
+	{
+		return false;
+	}
+
+	std::vector<ColumnRecord> columns(header.columnCount);
+	std::memcpy(columns.data(), base + header.columnsOffset, columns.size() * sizeof(ColumnRecord));
+
+	for (std::size_t i = 0; i < columns.size(); ++i)
+	{
+		const auto& column = columns[i];
+		if (manager._containers[manager._usedComponents[i]] == nullptr)
+		{
+			if (column.count != 0 || column.elementSize != 0)
+			{
+				return false;
+			}
+			continue;
+		}
+
+		const auto& container = *manager._containers[manager._usedComponents[i]];
+		auto dense = container.Policy() == StoragePolicy::Dense;
+
+		if (column.policy != static_cast<std::uint32_t>(container.Policy()) ||
+			column.elementSize != container.ElementSize() || (column.raw != 0) != container.IsRaw() ||
+			!container.CanSnapshot() || (dense && column.count != header.entityCount) ||
+			(!dense && column.count > header.entityCount) || !fits(column.dataOffset, column.dataSize) ||
+			(container.IsRaw() && !container.FitsComponents(column.dataSize, column.count)) ||
+			(!dense && !fitsArray(column.ownersOffset, column.count, sizeof(std::uint64_t))))
+		{
+			return false;
+		}
+	}
+
+	// Sparse owners and free indices are written into per-entity storage.
+	auto indicesFit = [&](std::uint64_t offset, std::uint64_t count)
+	{
+		for (std::uint64_t i = 0; i < count; ++i)
+		{
+			std::uint64_t value;
+			std::memcpy(&value, base + offset + i * sizeof(value), sizeof(value));
+			if (value >= header.entityCount)
+			{
+				return false;
+			}
+		}
+		return true;
+	};
+
+	for (std::size_t i = 0; i < columns.size(); ++i)
+	{
+		auto container = manager._containers[manager._usedComponents[i]].get();
+		if (container != nullptr && container->Policy() == StoragePolicy::Sparse && !indicesFit(columns[i].ownersOffset, columns[i].count))
+		{
+			return false;
+		}
+	}
+
+	if (header.freeCount > header.entityCount || !indicesFit(header.freeListOffset, header.freeCount))
+	{
+		return false;
+	}
+
+	for (EntityIndex entity = 0; entity < header.entityCount; ++entity)
+	{
+		SignatureID saved;
+		std::memcpy(&saved, base + header.signaturesOffset + entity * sizeof(SignatureID), sizeof(saved));
+		if (saved >= header.signatureCount)
+		{
+			return false;
+		}
+	}
+
+	// Interned in saved order into an empty table, the IDs normally stay the same.
+	std::vector<SignatureID> idBySavedId(header.signatureCount);
+	std::vector<std::uint64_t> words(ColumnWords(header.columnCount));
+	for (SignatureID saved = 0; saved < header.signatureCount; ++saved)
+	{
+		std::memcpy(words.data(), base + header.signatureTableOffset + saved * words.size() * sizeof(std::uint64_t),
+					words.size() * sizeof(std::uint64_t));
+
+		EntityFilter signature;
+		for (std::size_t column = 0; column < header.columnCount; ++column)
+		{
+			signature.set(manager._usedComponents[column], (words[column / COLUMN_BITS_PER_WORD] >> (column % COLUMN_BITS_PER_WORD)) & 1);
+		}
+		idBySavedId[saved] = manager._signatures.Intern(signature);
+	}
+
+	auto borrow = mode == SnapshotLoad::Map;
+
+	// Columns read through a SnapshotHook go first: only they can still fail.
+	for (auto raw : { false, true })
+	{
+		for (std::size_t i = 0; i < columns.size(); ++i)
+		{
+			const auto& column = columns[i];
+			auto container = manager._containers[manager._usedComponents[i]].get();
+			if (container == nullptr || container->IsRaw() != raw)
+			{
+				continue;
+			}
+
+			if (!container->ReadComponents(base + column.dataOffset, column.dataSize, column.count, borrow))
+			{
+				return false;
+			}
+
+			if (container->Policy() == StoragePolicy::Sparse)
+			{
+				std::vector<EntityIndex> owners(column.count);
+				for (std::size_t owner = 0; owner < owners.size(); ++owner)
+				{
+					std::uint64_t value;
+					std::memcpy(&value, base + column.ownersOffset + owner * sizeof(value), sizeof(value));
+					owners[owner] = static_cast<EntityIndex>(value);
+				}
+				container->RestoreOwners(owners);
+			}
+		}
+	}
+
+	manager._firstUsableEntityIndex = static_cast<EntityIndex>(header.entityCount);
+
+	manager._freeEntityIndices.resize(header.freeCount);
+	for (std::size_t i = 0; i < manager._freeEntityIndices.size(); ++i)
+	{
+		std::uint64_t value;
+		std::memcpy(&value, base + header.freeListOffset + i * sizeof(value), sizeof(value));
+		manager._freeEntityIndices[i] = static_cast<EntityIndex>(value);
+	}
+
+	manager._generations.resize(header.entityCount);
+	std::memcpy(manager._generations.data(), base + header.generationsOffset, header.entityCount * sizeof(EntityGeneration));
+
+	manager._signatureByEntity.resize(header.entityCount);
+	std::memcpy(manager._signatureByEntity.data(), base + header.signaturesOffset, header.entityCount * sizeof(SignatureID));
+	for (auto& signature : manager._signatureByEntity)
+	{
+		signature = idBySavedId[signature];
+	}
+
+	manager.PopulateQueries();
+	manager.PopulateGroups();
+
+	if (borrow)
+	{
+		manager._snapshotMemory = memory;
+	}
+
+	return true;
+}
+
+inline std::uint64_t Snapshot::Align(std::ostream& out)
+{
+	static const char zeros[CACHE_LINE_SIZE] = {};
+
+	auto position = static_cast<std::uint64_t>(out.tellp());
+	auto padding = (CACHE_LINE_SIZE - position % CACHE_LINE_SIZE) % CACHE_LINE_SIZE;
+	out.write(zeros, padding);
+	return position + padding;
+}
+
+inline std::shared_ptr<const std::byte> Snapshot::ReadFile(const std::string& path, SnapshotLoad mode, OUT std::size_t& size)
+{
+#if defined(__unix__) || defined(__APPLE__)
+	if (mode == SnapshotLoad::Map)
+	{
+		auto file = open(path.c_str(), O_RDONLY);
+		if (file < 0)
+		{
+			return nullptr;
+		}
+
+		struct stat status;
+		auto mapped = MAP_FAILED;
+		if (fstat(file, &status) == 0 && status.st_size > 0)
+		{
+			size = static_cast<std::size_t>(status.st_size);
+			// Private and writable: the first write to a page copies it.
+			mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+		}
+		close(file);
+
+		if (mapped == MAP_FAILED)
+		{
+			return nullptr;
+		}
+
+		return std::shared_ptr<const std::byte>(static_cast<const std::byte*>(mapped), [size](const std::byte* memory)
+		{
+			munmap(const_cast<std::byte*>(memory), size);
+		});
+	}
+#endif
+
+	std::ifstream in(path, std::ios::binary | std::ios::ate);
+	if (!in)
+	{
+		return nullptr;
+	}
+
+	size = static_cast<std::size_t>(in.tellg());
+	auto buffer = static_cast<std::byte*>(DefaultAllocator().Allocate(std::max<std::size_t>(size, 1), CACHE_LINE_SIZE));
+	std::shared_ptr<const std::byte> memory(buffer, [size](const std::byte* memory)
+	{
+		DefaultAllocator().Deallocate(const_cast<std::byte*>(memory), std::max<std::size_t>(size, 1), CACHE_LINE_SIZE);
+	});
+
+	in.seekg(0);
+	if (!in.read(reinterpret_cast<char*>(buffer), size))
+	{
+		return nullptr;
+	}
+
+	return memory;
+}
@@ -0,0 +1,249 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "ECS.h"
+
+// A uniform hash grid over the entities that have a position component T,
+// which needs float members x, y and z; 2D worlds leave z at 0. Update only
+// looks at the positions written since the previous Update, through
+// Changed<T>, and a position that stays in its cell costs a comparison.
+// Entities that lost T or were destroyed are swept out in a pass over the
+// grid that only runs if the number of entities with T says some were.
+// Cells work best at about the size of typical query radii:
+//		SpatialGrid<Position> grid(manager, 10.0f);
+//		grid.Update();
+//		grid.QueryRadius(center, 5.0f, OUT nearby);
+template <typename T>
+class SpatialGrid
+{
+public:
+	SpatialGrid(EntityManager& manager, float cellSize);
+
+	// Counts as a system run: calls NextVersion on the manager.
+	void Update();
+	inline std::size_t Size() const { return _count; }
+	inline std::size_t CellCount() const { return _cells.size(); }
+
+	// The entities inside a box or sphere, bounds included, as of the last
+	// Update. entities receives them sorted, like GetEntities in columns mode.
+	void QueryBox(const T& min, const T& max, OUT std::vector<EntityIndex>& entities) const;
+	void QueryRadius(const T& center, float radius, OUT std::vector<EntityIndex>& entities) const;
+
+private:
+	using CellKey = std::uint64_t;
+	static constexpr CellKey NO_CELL = ~CellKey(0);
+
+	struct Entry
+	{
+		CellKey cell = NO_CELL;
+		std::size_t slot = 0;
+		float x = 0.0f, y = 0.0f, z = 0.0f;
+	};
+
+	// Keys pack three 21-bit coordinates; mixing spreads neighbouring cells.
+	struct CellHash
+	{
+		std::size_t operator()(CellKey key) const
+		{
+			key ^= key >> 33;
+			key *= 0xff51afd7ed558ccdull;
+			key ^= key >> 33;
+			return static_cast<std::size_t>(key);
+		}
+	};
+
+	inline std::int64_t Coordinate(float value) const { return static_cast<std::int64_t>(std::floor(value * _inverseCellSize)); }
+	static CellKey Key(std::int64_t x, std::int64_t y, std::int64_t z);
+	void Place(EntityIndex entity, const T& position);
+	void Erase(EntityIndex entity);
+	// Calls accept(entry) for every entity in a cell overlapping the box;
+	// keys that wrap around may bring in far away cells.
+	template <typename Accept>
+	void Collect(const T& min, const T& max, Accept&& accept, OUT std::vector<EntityIndex>& entities) const;
+
+	EntityManager& _manager;
+	// Every entity with T, to tell whether any were lost since the last Update.
+	Query& _withPosition;
+	float _inverseCellSize;
+	ChangeVersion _lastUpdate = 0;
+
+	std::vector<Entry> _entries;
+	std::unordered_map<CellKey, std::vector<EntityIndex>, CellHash> _cells;
+	std::size_t _count = 0;
+};
+
+template <typename T>
+SpatialGrid<T>::SpatialGrid(EntityManager& manager, float cellSize)
+	: _manager{ manager }, _withPosition{ manager.RegisterQuery(MakeFilter<T>()) }, _inverseCellSize{ 1.0f / cellSize }
+{
+	assert(cellSize > 0.0f);
+}
+
+template <typename T>
+typename SpatialGrid<T>::CellKey SpatialGrid<T>::Key(std::int64_t x, std::int64_t y, std::int64_t z)
+{
+	constexpr std::uint64_t mask = (std::uint64_t(1) << 21) - 1;
+	return (std::uint64_t(x) & mask) | ((std::uint64_t(y) & mask) << 21) | ((std::uint64_t(z) & mask) << 42);
+}
+
+template <typename T> void SpatialGrid<T>::Update()
+{
+	auto since = _lastUpdate;
+	_lastUpdate = _manager.NextVersion();
+
+	_manager.Each<Changed<T>>(since, [this](EntityIndex entity, const T& position)
+	{
+		Place(entity, position);
+	});
+
+	if (_count == _withPosition.Entities().size())
+	{
+		return;
+	}
+
+	for (EntityIndex entity = 0; entity < _entries.size(); ++entity)
+	{
+		if (_entries[entity].cell != NO_CELL && !_withPosition.Contains(entity))
+		{
+			Erase(entity);
+		}
+	}
+
+	assert(_count == _withPosition.Entities().size());
+}
+
+// Changed<T> also visits entities that took over the index of a tracked one.
+template <typename T> void SpatialGrid<T>::Place(EntityIndex entity, const T& position)
+{
+	if (entity >= _entries.size())
+	{
+		_entries.resize(entity + 1);
+	}
+
+	auto cell = Key(Coordinate(position.x), Coordinate(position.y), Coordinate(position.z));
+	auto& entry = _entries[entity];
+	entry.x = position.x;
+	entry.y = position.y;
+	entry.z = position.z;
+
+	if (entry.cell == cell)
+	{
+		return;
+	}
+
+	if (entry.cell != NO_CELL)
+	{
+		Erase(entity);
+	}
+
+	auto& members = _cells[cell];
+	entry.cell = cell;
+	entry.slot = members.size();
+	members.push_back(entity);
+	++_count;
+}
+
+template <typename T> void SpatialGrid<T>::Erase(EntityIndex entity)
+{
+	auto& entry = _entries[entity];
+	auto found = _cells.find(entry.cell);
+	auto& members = found->second;
+
+	members[entry.slot] = members.back();
+	_entries[members[entry.slot]].slot = entry.slot;
+	members.pop_back();
+
+	if (members.empty())
+	{
+		_cells.erase(found);
+	}
+
+	entry.cell = NO_CELL;
+	--_count;
+}
+
+template <typename T>
+void SpatialGrid<T>::QueryBox(const T& min, const T& max, OUT std::vector<EntityIndex>& entities) const
+{
+	Collect(min, max, [&](const Entry& entry)
+	{
+		return entry.x >= min.x && entry.x <= max.x && entry.y >= min.y && entry.y <= max.y &&
+			   entry.z >= min.z && entry.z <= max.z;
+	}, entities);
+}
+
+template <typename T>
+void SpatialGrid<T>::QueryRadius(const T& center, float radius, OUT std::vector<EntityIndex>& entities) const
+{
+	T min = center;
+	T max = center;
+	min.x -= radius; min.y -= radius; min.z -= radius;
+	max.x += radius; max.y += radius; max.z += radius;
+
+	Collect(min, max, [&](const Entry& entry)
+	{
+		auto dx = entry.x - center.x;
+		auto dy = entry.y - center.y;
+		auto dz = entry.z - center.z;
+		return dx * dx + dy * dy + dz * dz <= radius * radius;
+	}, entities);
+}
+
+// A box covering more cells than are occupied walks the occupied ones instead.
+template <typename T>
+template <typename Accept>
+void SpatialGrid<T>::Collect(const T& min, const T& max, Accept&& accept, OUT std::vector<EntityIndex>& entities) const
+{
+	entities.clear();
+
+	auto x0 = Coordinate(min.x), y0 = Coordinate(min.y), z0 = Coordinate(min.z);
+	auto x1 = Coordinate(max.x), y1 = Coordinate(max.y), z1 = Coordinate(max.z);
+
+	auto collect = [&](const std::vector<EntityIndex>& members)
+	{
+		for (auto entity : members)
+		{
+			if (accept(_entries[entity]))
+			{
+				entities.push_back(entity);
+			}
+		}
+	};
+
+	auto covered = double(x1 - x0 + 1) * double(y1 - y0 + 1) * double(z1 - z0 + 1);
+	if (covered > double(_cells.size()))
+	{
+		for (const auto& cell : _cells)
+		{
+			collect(cell.second);
+		}
+	}
+	else
+	{
+		for (auto z = z0; z <= z1; ++z)
+		{
+			for (auto y = y0; y <= y1; ++y)
+			{
+				for (auto x = x0; x <= x1; ++x)
+				{
+					auto found = _cells.find(Key(x, y, z));
+					if (found != _cells.end())
+					{
+						collect(found->second);
+					}
+				}
+			}
+		}
+	}
+
+	std::sort(entities.begin(), entities.end());
+
+	// Wrapped keys can visit a cell twice.
+	entities.erase(std::unique(entities.begin(), entities.end()), entities.end());
+}
@@ -0,0 +1,248 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Counts the unfinished tasks submitted under it, so they can be waited for together.
+class TaskGroup
+{
+public:
+	inline bool IsDone() const { return _pending.load(std::memory_order_acquire) == 0; }
+
+private:
+	friend class ThreadPool;
+	std::atomic<std::size_t> _pending{ 0 };
+};
+
+// A persistent pool of worker threads with one task deque each. Workers take
+// their own newest task first and steal the oldest task of another worker
+// when they run dry, so large ranges split early get stolen first.
+class ThreadPool
+{
+public:
+	explicit ThreadPool(std::size_t workerCount = DefaultWorkerCount());
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// Workers plus the calling thread, which helps while it waits.
+	inline std::size_t ThreadCount() const { return _workers.size() + 1; }
+	// The calling thread's slot in [0, ThreadCount()): its worker number, or
+	// the last slot for any thread outside the pool.
+	inline std::size_t ThreadIndex() const { return CurrentQueue(); }
+
+	void Submit(TaskGroup& group, std::function<void()> task);
+	void Wait(TaskGroup& group);
+
+	// Calls func(begin, end) on disjoint ranges covering [0, count), each
+	// at most grainSize long, in parallel. Returns once all are done.
+	template <typename Func> void ParallelFor(std::size_t count, std::size_t grainSize, Func&& func);
+
+	static std::size_t DefaultWorkerCount();
+
+private:
+	struct Task
+	{
+		std::function<void()> run;
+		TaskGroup* group;
+	};
+
+	struct WorkQueue
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	template <typename Func>
+	void Split(TaskGroup& group, std::size_t begin, std::size_t end, std::size_t grainSize, Func& func);
+
+	std::size_t CurrentQueue() const;
+	bool TryRunTask(std::size_t queue);
+	void WorkerLoop(std::size_t queue);
+
+	// One queue per worker plus a last one for the threads outside the pool.
+	std::vector<std::unique_ptr<WorkQueue>> _queues;
+	std::vector<std::thread> _workers;
+
+	std::mutex _sleepMutex;
+	std::condition_variable _wakeUp;
+	std::atomic<std::size_t> _queuedTasks{ 0 };
+	bool _stopping = false;
+
+	static thread_local const ThreadPool* t_pool;
+	static thread_local std::size_t t_queue;
+};
+
+inline thread_local const ThreadPool* ThreadPool::t_pool = nullptr;
+inline thread_local std::size_t ThreadPool::t_queue = 0;
+
+inline std::size_t ThreadPool::DefaultWorkerCount()
+{
+	auto hardware = static_cast<std::size_t>(std::thread::hardware_concurrency());
+	return hardware > 1 ? hardware - 1 : 1;
+}
+
+inline ThreadPool::ThreadPool(std::size_t workerCount)
+{
+	for (std::size_t i = 0; i <= workerCount; ++i)
+	{
+		_queues.push_back(std::make_unique<WorkQueue>());
+	}
+
+	for (std::size_t i = 0; i < workerCount; ++i)
+	{
+		_workers.emplace_back([this, i] { WorkerLoop(i); });
+	}
+}
+
+inline ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(_sleepMutex);
+		_stopping = true;
+	}
+
+	_wakeUp.notify_all();
+
+	for (auto& worker : _workers)
+	{
+		worker.join();
+	}
+}
+
+inline void ThreadPool::Submit(TaskGroup& group, std::function<void()> task)
+{
+	group._pending.fetch_add(1, std::memory_order_relaxed);
+
+	auto& queue = *_queues[CurrentQueue()];
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.tasks.push_back(Task{ std::move(task), &group });
+	}
+
+	_queuedTasks.fetch_add(1, std::memory_order_release);
+
+	// Taking the lock makes sure a worker that just found nothing to do is
+	// either still awake to see the task or already waiting for this notify.
+	{
+		std::lock_guard<std::mutex> lock(_sleepMutex);
+	}
+	_wakeUp.notify_one();
+}
+
+inline void ThreadPool::Wait(TaskGroup& group)
+{
+	auto queue = CurrentQueue();
+
+	while (!group.IsDone())
+	{
+		if (!TryRunTask(queue))
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+template <typename Func> void ThreadPool::ParallelFor(std::size_t count, std::size_t grainSize, Func&& func)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	TaskGroup group;
+	Split(group, 0, count, std::max<std::size_t>(grainSize, 1), func);
+	Wait(group);
+}
+
+// Hands the upper half of the range to the pool until the rest fits the
+// grain size, then runs it. Thieves thereby get the biggest pieces.
+template <typename Func>
+void ThreadPool::Split(TaskGroup& group, std::size_t begin, std::size_t end, std::size_t grainSize, Func& func)
+{
+	while (end - begin > grainSize)
+	{
+		auto middle = begin + (end - begin) / 2;
+		Submit(group, [this, &group, middle, end, grainSize, &func]
+		{
+			Split(group, middle, end, grainSize, func);
+		});
+		end = middle;
+	}
+
+	func(begin, end);
+}
+
+inline std::size_t ThreadPool::CurrentQueue() const
+{
+	return t_pool == this ? t_queue : _queues.size() - 1;
+}
+
+inline bool ThreadPool::TryRunTask(std::size_t queue)
+{
+	Task task;
+	auto found = false;
+
+	{
+		auto& own = *_queues[queue];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.tasks.empty())
+		{
+			task = std::move(own.tasks.back());
+			own.tasks.pop_back();
+			found = true;
+		}
+	}
+
+	for (std::size_t i = 1; !found && i < _queues.size(); ++i)
+	{
+		auto& victim = *_queues[(queue + i) % _queues.size()];
+		std::lock_guard<std::mutex> lock(victim.mutex);
+		if (!victim.tasks.empty())
+		{
+			task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			found = true;
+		}
+	}
+
+	if (!found)
+	{
+		return false;
+	}
+
+	_queuedTasks.fetch_sub(1, std::memory_order_relaxed);
+	task.run();
+	task.group->_pending.fetch_sub(1, std::memory_order_acq_rel);
+	return true;
+}
+
+inline void ThreadPool::WorkerLoop(std::size_t queue)
+{
+	t_pool = this;
+	t_queue = queue;
+
+	while (true)
+	{
+		if (TryRunTask(queue))
+		{
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(_sleepMutex);
+		_wakeUp.wait(lock, [this] { return _stopping || _queuedTasks.load(std::memory_order_acquire) > 0; });
+
+		if (_stopping)
+		{
+			return;
+		}
+	}
+}
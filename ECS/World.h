@@ -0,0 +1,365 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "Component.h"
+#include "EntityHandle.h"
+#include "FunctionTraits.h"
+#include "SignatureMatch.h"
+
+// The position of T among Ts, with Sparse<T> counting as T, or sizeof...(Ts)
+// if T is not among them.
+template <typename T, typename ... Ts> constexpr ComponentID ComponentIndex()
+{
+	constexpr bool matches[] = { std::is_same_v<T, typename ComponentStorage<Ts>::Component>..., false };
+	for (ComponentID i = 0; i < sizeof...(Ts); ++i)
+	{
+		if (matches[i])
+		{
+			return i;
+		}
+	}
+	return sizeof...(Ts);
+}
+
+// An entity store typed on its component list, as an alternative to an
+// EntityManager in column mode:
+//		World<EntityState, Position, Sparse<Velocity>> world;
+// A component's ID is its position in the list, so IDs are the same in every
+// binary, and containers live in a tuple, so GetContainer<T> compiles down to
+// a member access. Filters are constant masks; Each matches them against
+// the packed signatures instead of keeping queries, which limits a World to
+// 32 component types. Tags, EntityState included, get a TagContainer and
+// live in the signatures only; entities are Active from creation if
+// EntityState is in the list.
+template <typename ... Ts>
+class World
+{
+public:
+	static_assert(sizeof...(Ts) > 0 && sizeof...(Ts) <= sizeof(SignatureWord) * 8, "A World needs 1 to 32 components");
+
+	template <typename T>
+	static constexpr ComponentID ID = ComponentIndex<std::remove_cv_t<std::remove_reference_t<T>>, Ts...>();
+
+	template <typename ... Us> static constexpr SignatureWord Mask()
+	{
+		static_assert(((ID<Us> < sizeof...(Ts)) && ...), "Not a component of this World");
+		return (SignatureWord(0) | ... | (SignatureWord(1) << ID<Us>));
+	}
+
+	// All component storage is taken from allocator, which must outlive the world.
+	explicit World(Allocator& allocator = DefaultAllocator());
+
+	World(const World&) = delete;
+	World& operator=(const World&) = delete;
+
+	inline int EntityCount() const { return static_cast<int>(_signatures.size() - _freeEntityIndices.size()); }
+	inline EntityFilter GetSignature(EntityIndex entity) const { return EntityFilter(_signatures[entity]); }
+	EntityIndex CreateEntity();
+	void DestroyEntity(EntityIndex entity);
+
+	inline EntityHandle GetHandle(EntityIndex entity) const { return EntityHandle(entity, _generations[entity]); }
+	inline bool IsValid(EntityHandle handle) const
+	{
+		return handle.Index() < _generations.size() && _generations[handle.Index()] == handle.Generation();
+	}
+
+	template <typename T> bool HasComponent(EntityIndex entity) const;
+	template <typename T> void SetComponent(EntityIndex entity, T&& component);
+	template <typename T, typename ... Args> void EmplaceComponent(EntityIndex entity, Args&&... args);
+	template <typename T> void RemoveComponent(EntityIndex entity);
+	template <typename T> T GetComponent(EntityIndex entity) const;
+	template <typename ... Us> EntityIndex CreateEntityWithComponents(Us... components);
+	template <typename T> ContainerFor<T>& GetContainer();
+	template <typename T> const ContainerFor<T>& GetContainer() const;
+
+	// Containers grow once for all new entities. entities receives the created indices.
+	template <typename ... Us>
+	void CreateEntities(std::size_t count, OUT std::vector<EntityIndex>& entities, const Us&... components);
+
+	// As EntityManager::Each: component types come from func's parameters or
+	// are given explicitly, with an optional leading EntityIndex parameter.
+	template <typename ... Us, typename Func> void Each(Func&& func);
+
+	// See EntityManager::Version and NextVersion.
+	inline ChangeVersion Version() const { return _changeVersion; }
+	inline ChangeVersion NextVersion() { return _changeVersion++; }
+
+private:
+	template <typename T> struct Column
+	{
+		explicit Column(Allocator& allocator) : container{ ComponentStorage<T>::Policy, allocator } {}
+		ContainerFor<typename ComponentStorage<T>::Component> container;
+	};
+
+	static constexpr bool HAS_ENTITY_STATE = ComponentIndex<EntityState, Ts...>() < sizeof...(Ts);
+
+	template <typename> static inline Allocator& ForColumn(Allocator& allocator) { return allocator; }
+
+	// Calls func(id, container) for every component type.
+	template <typename Func> void ForEachContainer(Func&& func);
+	template <typename Func, std::size_t ... Is> void ForEachContainer(Func& func, std::index_sequence<Is...>);
+
+	EntityIndex NewEntities(std::size_t count);
+	template <typename Func, typename First, typename ... Rest> void EachDeduced(Func& func, TypeList<First, Rest...>);
+	template <bool WithEntity, typename ... Us, typename Func> void EachMatching(Func& func);
+
+	ChangeVersion _changeVersion = 1;
+	std::tuple<Column<Ts>...> _columns;
+
+	std::vector<SignatureWord> _signatures;
+	std::vector<EntityGeneration> _generations;
+	std::vector<EntityIndex> _freeEntityIndices;
+};
+
+template <typename ... Ts>
+World<Ts...>::World(Allocator& allocator)
+	: _columns{ ForColumn<Ts>(allocator)... }
+{
+	ForEachContainer([this](ComponentID, auto& container) { container.SetClock(&_changeVersion); });
+}
+
+template <typename ... Ts>
+template <typename T> ContainerFor<T>& World<Ts...>::GetContainer()
+{
+	static_assert(ID<T> < sizeof...(Ts), "Not a component of this World");
+	return std::get<ID<T>>(_columns).container;
+}
+
+template <typename ... Ts>
+template <typename T> const ContainerFor<T>& World<Ts...>::GetContainer() const
+{
+	static_assert(ID<T> < sizeof...(Ts), "Not a component of this World");
+	return std::get<ID<T>>(_columns).container;
+}
+
+template <typename ... Ts>
+template <typename Func> void World<Ts...>::ForEachContainer(Func&& func)
+{
+	ForEachContainer(func, std::index_sequence_for<Ts...>());
+}
+
+template <typename ... Ts>
+template <typename Func, std::size_t ... Is> void World<Ts...>::ForEachContainer(Func& func, std::index_sequence<Is...>)
+{
+	auto _ = { (func(ComponentID(Is), std::get<Is>(_columns).container), 0)... };
+}
+
+template <typename ... Ts> EntityIndex World<Ts...>::CreateEntity()
+{
+	EntityIndex entity;
+	if (!_freeEntityIndices.empty())
+	{
+		entity = _freeEntityIndices.back();
+		_freeEntityIndices.pop_back();
+	}
+	else
+	{
+		entity = NewEntities(1);
+	}
+
+	if constexpr (HAS_ENTITY_STATE)
+	{
+		_signatures[entity] = Mask<EntityState>();
+	}
+
+	return entity;
+}
+
+// Appends count entities without components and returns the first.
+template <typename ... Ts> EntityIndex World<Ts...>::NewEntities(std::size_t count)
+{
+	auto first = _signatures.size();
+
+	ForEachContainer([count](ComponentID, auto& container) { container.AddNew(count); });
+	_signatures.resize(first + count, 0);
+	_generations.resize(first + count, 0);
+
+	assert(_generations.size() <= 0xFFFFFFFFu);
+	return first;
+}
+
+template <typename ... Ts>
+template <typename ... Us> EntityIndex World<Ts...>::CreateEntityWithComponents(Us... components)
+{
+	auto entity = CreateEntity();
+	auto _ = { (SetComponent(entity, std::move(components)), 0)... };
+	return entity;
+}
+
+template <typename ... Ts>
+template <typename ... Us>
+void World<Ts...>::CreateEntities(std::size_t count, OUT std::vector<EntityIndex>& entities, const Us&... components)
+{
+	entities.clear();
+	entities.reserve(count);
+
+	auto reused = std::min(count, _freeEntityIndices.size());
+	entities.insert(entities.end(), _freeEntityIndices.rbegin(), _freeEntityIndices.rbegin() + reused);
+	_freeEntityIndices.resize(_freeEntityIndices.size() - reused);
+
+	auto fresh = count - reused;
+	auto first = NewEntities(fresh);
+	for (std::size_t i = 0; i < fresh; ++i)
+	{
+		entities.push_back(first + i);
+	}
+
+	auto mask = Mask<Us...>();
+	if constexpr (HAS_ENTITY_STATE)
+	{
+		mask |= Mask<EntityState>();
+	}
+
+	auto write = [this](EntityIndex entity, const auto& component)
+	{
+		using T = std::decay_t<decltype(component)>;
+		if constexpr (!IsTag<T>)
+		{
+			GetContainer<T>().Acquire(entity) = component;
+			GetContainer<T>().MarkAdded(entity);
+		}
+	};
+
+	for (auto entity : entities)
+	{
+		_signatures[entity] = mask;
+		auto _ = { 0, (write(entity, components), 0)... };
+	}
+}
+
+template <typename ... Ts> void World<Ts...>::DestroyEntity(EntityIndex entity)
+{
+	auto signature = _signatures[entity];
+	ForEachContainer([entity, signature](ComponentID id, auto& container)
+	{
+		if ((signature >> id) & 1)
+		{
+			container.Remove(entity);
+		}
+	});
+
+	_signatures[entity] = 0;
+	_freeEntityIndices.push_back(entity);
+	++_generations[entity];
+}
+
+template <typename ... Ts>
+template <typename T> bool World<Ts...>::HasComponent(EntityIndex entity) const
+{
+	return (_signatures[entity] & Mask<T>()) != 0;
+}
+
+template <typename ... Ts>
+template <typename T> T World<Ts...>::GetComponent(EntityIndex entity) const
+{
+	return GetContainer<T>().Get(entity);
+}
+
+template <typename ... Ts>
+template <typename T> void World<Ts...>::SetComponent(EntityIndex entity, T&& component)
+{
+	using Component = std::decay_t<T>;
+	auto& container = GetContainer<Component>();
+	auto added = !HasComponent<Component>(entity);
+
+	_signatures[entity] |= Mask<Component>();
+	container.Set(entity, std::forward<T>(component));
+
+	if (added)
+	{
+		container.MarkAdded(entity);
+	}
+}
+
+template <typename ... Ts>
+template <typename T, typename ... Args> void World<Ts...>::EmplaceComponent(EntityIndex entity, Args&&... args)
+{
+	auto& container = GetContainer<T>();
+	auto added = !HasComponent<T>(entity);
+
+	_signatures[entity] |= Mask<T>();
+	container.Emplace(entity, std::forward<Args>(args)...);
+
+	if (added)
+	{
+		container.MarkAdded(entity);
+	}
+}
+
+template <typename ... Ts>
+template <typename T> void World<Ts...>::RemoveComponent(EntityIndex entity)
+{
+	if (HasComponent<T>(entity))
+	{
+		GetContainer<T>().Remove(entity);
+		_signatures[entity] &= ~Mask<T>();
+	}
+}
+
+template <typename ... Ts>
+template <typename ... Us, typename Func> void World<Ts...>::Each(Func&& func)
+{
+	if constexpr (sizeof...(Us) == 0)
+	{
+		EachDeduced(func, typename FunctionTraits<std::decay_t<Func>>::Arguments());
+	}
+	else
+	{
+		EachMatching<std::is_invocable_v<Func&, EntityIndex, Us&...>, Us...>(func);
+	}
+}
+
+template <typename ... Ts>
+template <typename Func, typename First, typename ... Rest> void World<Ts...>::EachDeduced(Func& func, TypeList<First, Rest...>)
+{
+	if constexpr (std::is_same_v<std::decay_t<First>, EntityIndex>)
+	{
+		EachMatching<true, std::remove_reference_t<Rest>...>(func);
+	}
+	else
+	{
+		EachMatching<false, std::remove_reference_t<First>, std::remove_reference_t<Rest>...>(func);
+	}
+}
+
+template <typename ... Ts>
+template <bool WithEntity, typename ... Us, typename Func> void World<Ts...>::EachMatching(Func& func)
+{
+	constexpr auto mask = Mask<std::remove_const_t<Us>...>();
+
+	std::vector<EntityIndex> entities;
+	MatchSignatures(_signatures.data(), _signatures.size(), mask, OUT entities);
+
+	// Const components go through the const Get and are not marked as changed.
+	auto get = [this](EntityIndex entity, auto* type) -> decltype(auto)
+	{
+		using T = std::remove_pointer_t<decltype(type)>;
+		auto& container = GetContainer<std::remove_const_t<T>>();
+		if constexpr (std::is_const_v<T>)
+		{
+			return std::as_const(container).Get(entity);
+		}
+		else
+		{
+			return container.Get(entity);
+		}
+	};
+
+	for (auto entity : entities)
+	{
+		if constexpr (WithEntity)
+		{
+			func(entity, get(entity, static_cast<Us*>(nullptr))...);
+		}
+		else
+		{
+			func(get(entity, static_cast<Us*>(nullptr))...);
+		}
+	}
+}
@@ -0,0 +1,572 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../ECS/ECS.h"
+#include "../ECS/Profile.h"
+
+// Runs every benchmark at 10^3 to 10^7 entities in both storage modes and
+// prints one record per benchmark, storage mode and entity count:
+//		ECSBenchmark [--format json|csv] [--output file] [--min-entities n] [--max-entities n]
+//					 [--repetitions n] [--warmup n] [--threads n] [--storage columns|archetypes|both]
+//					 [--filter substring] [--trace file]
+// Each record has the median, mean, min, max and standard deviation of the
+// repetitions, after warmup runs that are not recorded, and the median time
+// per item. Results are checked once per record, so a wrong answer fails the
+// run with a non-zero exit code instead of producing a fast number.
+// --trace writes container statistics, and with ECS_PROFILE the timings of
+// every query, as a Chrome trace.
+
+namespace
+{
+	struct Position
+	{
+		float x, y, z;
+	};
+
+	struct Velocity
+	{
+		float x, y, z;
+	};
+
+	struct Health
+	{
+		float value;
+	};
+
+	struct Target
+	{
+		EntityIndex entity;
+	};
+
+	struct Player
+	{
+		int id;
+	};
+
+	using Components = UsedComponents<EntityState, Position, Velocity, Health, Target, Player>;
+
+	struct Options
+	{
+		std::string format = "json";
+		std::string output;
+		std::string filter;
+		std::string trace;
+		std::size_t minEntities = 1000;
+		std::size_t maxEntities = 10000000;
+		std::size_t repetitions = 10;
+		std::size_t warmup = 1;
+		std::size_t threads = ThreadPool::DefaultWorkerCount() + 1;
+		std::vector<StorageMode> storageModes = { StorageMode::Columns, StorageMode::Archetypes };
+	};
+
+	struct Result
+	{
+		std::string benchmark;
+		StorageMode storageMode;
+		std::size_t entities;
+		// What one repetition processes, e.g. the entities an Each visits.
+		std::size_t items;
+		std::vector<double> seconds;
+	};
+
+	const char* StorageName(StorageMode storageMode)
+	{
+		return storageMode == StorageMode::Columns ? "columns" : "archetypes";
+	}
+
+	void Check(bool condition, const std::string& what)
+	{
+		if (!condition)
+		{
+			std::cerr << "Check failed: " << what << "\n";
+			std::exit(1);
+		}
+	}
+
+	template <typename Func> double Time(Func&& func)
+	{
+		auto start = std::chrono::steady_clock::now();
+		func();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		return elapsed.count();
+	}
+
+	// repetition() runs one untimed setup and one timed body and returns the
+	// seconds the body took.
+	template <typename Repetition> std::vector<double> Repeat(const Options& options, Repetition&& repetition)
+	{
+		std::vector<double> seconds;
+		for (std::size_t i = 0; i < options.warmup + options.repetitions; ++i)
+		{
+			auto elapsed = repetition();
+			if (i >= options.warmup)
+			{
+				seconds.push_back(elapsed);
+			}
+		}
+
+		std::sort(seconds.begin(), seconds.end());
+		return seconds;
+	}
+
+	// Every entity has a Position and a Velocity; Health, Target and Player
+	// are on every 2nd, 10th and 100th one, so the world holds a handful of
+	// interleaved signatures as a game would.
+	void Populate(EntityManager& manager, std::size_t count)
+	{
+		std::vector<EntityIndex> entities;
+		manager.CreateEntities<Position, Velocity>(count, OUT entities, [](std::size_t i, Position& position, Velocity& velocity)
+		{
+			position = Position{ static_cast<float>(i), 0.0f, 0.0f };
+			velocity = Velocity{ 1.0f, 2.0f, 3.0f };
+		});
+
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			if (i % 2 == 0)
+			{
+				manager.SetComponent(entities[i], Health{ 100.0f });
+			}
+			if (i % 10 == 0)
+			{
+				manager.SetComponent(entities[i], Target{ entities[(i + 1) % count] });
+			}
+			if (i % 100 == 0)
+			{
+				manager.SetComponent(entities[i], Player{ static_cast<int>(i / 100) });
+			}
+		}
+	}
+
+	template <typename T> std::size_t Expected(std::size_t count)
+	{
+		if constexpr (std::is_same_v<T, Health>)
+		{
+			return (count + 1) / 2;
+		}
+		else if constexpr (std::is_same_v<T, Target>)
+		{
+			return (count + 9) / 10;
+		}
+		else if constexpr (std::is_same_v<T, Player>)
+		{
+			return (count + 99) / 100;
+		}
+		else
+		{
+			return count;
+		}
+	}
+
+	Result CreateBulk(const Options& options, StorageMode storageMode, std::size_t count)
+	{
+		auto seconds = Repeat(options, [&]
+		{
+			EntityManager manager(Components(), storageMode);
+			std::vector<EntityIndex> entities;
+			auto elapsed = Time([&]
+			{
+				manager.CreateEntities(count, OUT entities, Position{ 0.0f, 0.0f, 0.0f }, Velocity{ 1.0f, 2.0f, 3.0f });
+			});
+
+			Check(manager.EntityCount() == static_cast<int>(count), "create_bulk entity count");
+			return elapsed;
+		});
+
+		return { "create_bulk", storageMode, count, count, seconds };
+	}
+
+	// Destroys and recreates a tenth of a populated world per repetition, at
+	// a different offset each time, so freed indices get reused out of order.
+	Result Churn(const Options& options, StorageMode storageMode, std::size_t count)
+	{
+		EntityManager manager(Components(), storageMode);
+		Populate(manager, count);
+
+		std::vector<EntityIndex> live(count);
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			live[i] = static_cast<EntityIndex>(i);
+		}
+
+		auto churned = std::max<std::size_t>(count / 10, 1);
+		std::vector<std::size_t> slots;
+		std::vector<EntityIndex> victims;
+		std::vector<EntityIndex> created;
+		std::size_t round = 0;
+
+		auto seconds = Repeat(options, [&]
+		{
+			slots.clear();
+			victims.clear();
+			for (std::size_t i = round++ % 10; slots.size() < churned; i += 10)
+			{
+				slots.push_back(i % count);
+				victims.push_back(live[i % count]);
+			}
+
+			auto elapsed = Time([&]
+			{
+				manager.DestroyEntities(victims);
+				manager.CreateEntities(churned, OUT created, Position{ 0.0f, 0.0f, 0.0f }, Velocity{ 1.0f, 2.0f, 3.0f });
+			});
+
+			for (std::size_t i = 0; i < churned; ++i)
+			{
+				live[slots[i]] = created[i];
+			}
+
+			Check(manager.EntityCount() == static_cast<int>(count), "churn entity count");
+			return elapsed;
+		});
+
+		return { "churn", storageMode, count, 2 * churned, seconds };
+	}
+
+	template <typename T>
+	Result Filter(const Options& options, EntityManager& manager, StorageMode storageMode, std::size_t count,
+				  const std::string& name)
+	{
+		EntityFilter filter;
+		filter.set(GetComponentID<T>());
+
+		std::vector<EntityIndex> entities;
+		auto seconds = Repeat(options, [&]
+		{
+			entities.clear();
+			return Time([&] { manager.GetEntities(filter, OUT entities); });
+		});
+
+		Check(entities.size() == Expected<T>(count), name + " match count");
+		return { name, storageMode, count, count, seconds };
+	}
+
+	Result EachOne(const Options& options, EntityManager& manager, StorageMode storageMode, std::size_t count)
+	{
+		auto seconds = Repeat(options, [&]
+		{
+			return Time([&] { manager.Each([](Position& position) { position.y += 1.0f; }); });
+		});
+
+		std::size_t visited = 0;
+		manager.Each([&](const Position&) { ++visited; });
+		Check(visited == count, "each_1 visited count");
+		return { "each_1", storageMode, count, count, seconds };
+	}
+
+	Result EachTwo(const Options& options, EntityManager& manager, StorageMode storageMode, std::size_t count)
+	{
+		auto seconds = Repeat(options, [&]
+		{
+			return Time([&]
+			{
+				manager.Each([](Position& position, const Velocity& velocity)
+				{
+					position.x += velocity.x * 0.5f;
+					position.y += velocity.y * 0.5f;
+					position.z += velocity.z * 0.5f;
+				});
+			});
+		});
+
+		std::size_t visited = 0;
+		manager.Each([&](const Position&, const Velocity&) { ++visited; });
+		Check(visited == count, "each_2 visited count");
+		return { "each_2", storageMode, count, count, seconds };
+	}
+
+	// Health is on every other entity, so this also measures skipping.
+	Result EachThree(const Options& options, EntityManager& manager, StorageMode storageMode, std::size_t count)
+	{
+		auto seconds = Repeat(options, [&]
+		{
+			return Time([&]
+			{
+				manager.Each([](const Position& position, const Velocity& velocity, Health& health)
+				{
+					health.value -= (position.x + velocity.x) * 0.001f;
+				});
+			});
+		});
+
+		std::size_t visited = 0;
+		manager.Each([&](const Position&, const Velocity&, const Health&) { ++visited; });
+		Check(visited == Expected<Health>(count), "each_3 visited count");
+		return { "each_3", storageMode, count, Expected<Health>(count), seconds };
+	}
+
+	Result ParallelEachTwo(const Options& options, ThreadPool& pool, EntityManager& manager, StorageMode storageMode,
+						   std::size_t count)
+	{
+		auto seconds = Repeat(options, [&]
+		{
+			return Time([&]
+			{
+				manager.ParallelEach(pool, [](Position& position, const Velocity& velocity)
+				{
+					position.x += velocity.x * 0.5f;
+					position.y += velocity.y * 0.5f;
+					position.z += velocity.z * 0.5f;
+				});
+			});
+		});
+
+		std::atomic<std::size_t> visited{ 0 };
+		manager.ParallelEach(pool, [&](const Position&, const Velocity&) { ++visited; });
+		Check(visited == count, "parallel_each_2 visited count");
+		return { "parallel_each_2", storageMode, count, count, seconds };
+	}
+
+	struct Summary
+	{
+		double median, mean, min, max, stddev;
+	};
+
+	Summary Summarize(const std::vector<double>& sorted)
+	{
+		Summary summary{};
+		if (sorted.empty())
+		{
+			return summary;
+		}
+
+		auto n = sorted.size();
+		summary.median = n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+		summary.min = sorted.front();
+		summary.max = sorted.back();
+
+		for (auto seconds : sorted)
+		{
+			summary.mean += seconds;
+		}
+		summary.mean /= n;
+
+		for (auto seconds : sorted)
+		{
+			summary.stddev += (seconds - summary.mean) * (seconds - summary.mean);
+		}
+		summary.stddev = n > 1 ? std::sqrt(summary.stddev / (n - 1)) : 0.0;
+		return summary;
+	}
+
+	void WriteCsv(std::ostream& out, const std::vector<Result>& results)
+	{
+		out << "benchmark,storage,entities,items,repetitions,median_ns,mean_ns,min_ns,max_ns,stddev_ns,ns_per_item\n";
+		for (auto& result : results)
+		{
+			auto summary = Summarize(result.seconds);
+			char line[512];
+			std::snprintf(line, sizeof(line), "%s,%s,%zu,%zu,%zu,%.0f,%.0f,%.0f,%.0f,%.0f,%.4f\n",
+						  result.benchmark.c_str(), StorageName(result.storageMode), result.entities, result.items,
+						  result.seconds.size(), summary.median * 1e9, summary.mean * 1e9, summary.min * 1e9,
+						  summary.max * 1e9, summary.stddev * 1e9, summary.median * 1e9 / result.items);
+			out << line;
+		}
+	}
+
+	void WriteJson(std::ostream& out, const std::vector<Result>& results, const Options& options)
+	{
+		out << "{\n\t\"threads\": " << options.threads << ",\n\t\"warmup\": " << options.warmup << ",\n\t\"results\": [";
+		for (std::size_t i = 0; i < results.size(); ++i)
+		{
+			auto& result = results[i];
+			auto summary = Summarize(result.seconds);
+			char record[512];
+			std::snprintf(record, sizeof(record),
+						  "%s\n\t\t{ \"benchmark\": \"%s\", \"storage\": \"%s\", \"entities\": %zu, \"items\": %zu, "
+						  "\"repetitions\": %zu, \"median_ns\": %.0f, \"mean_ns\": %.0f, \"min_ns\": %.0f, "
+						  "\"max_ns\": %.0f, \"stddev_ns\": %.0f, \"ns_per_item\": %.4f }",
+						  i == 0 ? "" : ",", result.benchmark.c_str(), StorageName(result.storageMode),
+						  result.entities, result.items, result.seconds.size(), summary.median * 1e9,
+						  summary.mean * 1e9, summary.min * 1e9, summary.max * 1e9, summary.stddev * 1e9,
+						  summary.median * 1e9 / result.items);
+			out << record;
+		}
+		out << "\n\t]\n}\n";
+	}
+
+	bool ParseOptions(int argc, char** argv, OUT Options& options)
+	{
+		for (int i = 1; i < argc; ++i)
+		{
+			std::string option = argv[i];
+			if (i + 1 >= argc)
+			{
+				return false;
+			}
+
+			std::string value = argv[++i];
+			if (option == "--format" && (value == "json" || value == "csv"))
+			{
+				options.format = value;
+			}
+			else if (option == "--output")
+			{
+				options.output = value;
+			}
+			else if (option == "--trace")
+			{
+				options.trace = value;
+			}
+			else if (option == "--filter")
+			{
+				options.filter = value;
+			}
+			else if (option == "--min-entities")
+			{
+				options.minEntities = std::strtoull(value.c_str(), nullptr, 10);
+			}
+			else if (option == "--max-entities")
+			{
+				options.maxEntities = std::strtoull(value.c_str(), nullptr, 10);
+			}
+			else if (option == "--repetitions")
+			{
+				options.repetitions = std::strtoull(value.c_str(), nullptr, 10);
+			}
+			else if (option == "--warmup")
+			{
+				options.warmup = std::strtoull(value.c_str(), nullptr, 10);
+			}
+			else if (option == "--threads")
+			{
+				options.threads = std::max<std::size_t>(std::strtoull(value.c_str(), nullptr, 10), 1);
+			}
+			else if (option == "--storage" && value == "columns")
+			{
+				options.storageModes = { StorageMode::Columns };
+			}
+			else if (option == "--storage" && value == "archetypes")
+			{
+				options.storageModes = { StorageMode::Archetypes };
+			}
+			else if (!(option == "--storage" && value == "both"))
+			{
+				return false;
+			}
+		}
+
+		return options.minEntities > 0 && options.minEntities <= options.maxEntities && options.repetitions > 0;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	if (!ParseOptions(argc, argv, OUT options))
+	{
+		std::cerr << "Usage: " << argv[0] << " [--format json|csv] [--output file] [--min-entities n]"
+				  << " [--max-entities n] [--repetitions n] [--warmup n] [--threads n]"
+				  << " [--storage columns|archetypes|both] [--filter substring] [--trace file]\n";
+		return 2;
+	}
+
+	ThreadPool pool(options.threads - 1);
+	std::vector<Result> results;
+	auto selected = [&](const char* name) { return std::strstr(name, options.filter.c_str()) != nullptr; };
+
+	for (auto count = options.minEntities; count <= options.maxEntities; count *= 10)
+	{
+		for (auto storageMode : options.storageModes)
+		{
+			std::cerr << "Running " << StorageName(storageMode) << " at " << count << " entities\n";
+
+			if (selected("create_bulk"))
+			{
+				results.push_back(CreateBulk(options, storageMode, count));
+			}
+			if (selected("churn"))
+			{
+				results.push_back(Churn(options, storageMode, count));
+			}
+
+			EntityManager manager(Components(), storageMode);
+			Populate(manager, count);
+			if (!options.trace.empty())
+			{
+				DefaultProfiler().RecordContainers(manager.ContainerStatistics());
+			}
+
+			if (selected("filter_100"))
+			{
+				results.push_back(Filter<Position>(options, manager, storageMode, count, "filter_100"));
+			}
+			if (selected("filter_50"))
+			{
+				results.push_back(Filter<Health>(options, manager, storageMode, count, "filter_50"));
+			}
+			if (selected("filter_10"))
+			{
+				results.push_back(Filter<Target>(options, manager, storageMode, count, "filter_10"));
+			}
+			if (selected("filter_1"))
+			{
+				results.push_back(Filter<Player>(options, manager, storageMode, count, "filter_1"));
+			}
+			if (selected("each_1"))
+			{
+				results.push_back(EachOne(options, manager, storageMode, count));
+			}
+			if (selected("each_2"))
+			{
+				results.push_back(EachTwo(options, manager, storageMode, count));
+			}
+			if (selected("each_3"))
+			{
+				results.push_back(EachThree(options, manager, storageMode, count));
+			}
+			if (selected("parallel_each_2"))
+			{
+				results.push_back(ParallelEachTwo(options, pool, manager, storageMode, count));
+			}
+		}
+
+		if (count > options.maxEntities / 10)
+		{
+			break;
+		}
+	}
+
+	std::ofstream file;
+	if (!options.output.empty())
+	{
+		file.open(options.output);
+		if (!file)
+		{
+			std::cerr << "Cannot write " << options.output << "\n";
+			return 1;
+		}
+	}
+
+	auto& out = options.output.empty() ? std::cout : file;
+	if (options.format == "csv")
+	{
+		WriteCsv(out, results);
+	}
+	else
+	{
+		WriteJson(out, results, options);
+	}
+
+	if (!options.trace.empty())
+	{
+		std::ofstream trace(options.trace);
+		DefaultProfiler().WriteChromeTrace(trace);
+		if (!trace)
+		{
+			std::cerr << "Cannot write " << options.trace << "\n";
+			return 1;
+		}
+	}
+
+	return 0;
+}
@@ -3,14 +3,48 @@
 #include <string>
 #include <iostream>
 #include <chrono>
+#include <cstdio>
 #include <functional>
 #include <future>
+#include <sstream>
+#include <atomic>
+#include <tuple>
+#include <utility>
 
 #include "CppUnitTest.h"
 #include "../ECS/ECS.h"
+#include "../ECS/CommandBuffer.h"
+#include "../ECS/Compaction.h"
+#include "../ECS/Delta.h"
+#include "../ECS/Group.h"
+#include "../ECS/Hierarchy.h"
+#include "../ECS/LinearArena.h"
+#include "../ECS/Profile.h"
+#include "../ECS/Scheduler.h"
+#include "../ECS/Snapshot.h"
+#include "../ECS/SpatialGrid.h"
+#include "../ECS/World.h"
 
 using namespace Microsoft::VisualStudio::CppUnitTestFramework;
 
+template <> struct SnapshotHook<std::vector<int>>
+{
+	static void Write(std::ostream& out, const std::vector<int>& values)
+	{
+		auto size = values.size();
+		out.write(reinterpret_cast<const char*>(&size), sizeof(size));
+		out.write(reinterpret_cast<const char*>(values.data()), size * sizeof(int));
+	}
+
+	static void Read(std::istream& in, std::vector<int>& values)
+	{
+		std::size_t size = 0;
+		in.read(reinterpret_cast<char*>(&size), sizeof(size));
+		values.resize(size);
+		in.read(reinterpret_cast<char*>(values.data()), size * sizeof(int));
+	}
+};
+
 namespace ECSTest
 {
 	constexpr std::size_t MANY = 1000;
@@ -34,6 +68,16 @@ namespace ECSTest
 		float x, y, z;
 	};
 
+	template <std::size_t N> struct Tag
+	{
+		std::size_t value = N;
+	};
+
+	template <std::size_t ... Ns> UsedComponents<EntityState, Tag<Ns>...> MakeTags(std::index_sequence<Ns...>)
+	{
+		return {};
+	}
+
 	Position operator*(const Velocity& velocity, float scalar)
 	{
 		return Position{ velocity.x * scalar, velocity.y * scalar, velocity.z * scalar };
@@ -54,6 +98,39 @@ namespace ECSTest
 		int otherValue;
 	};
 
+	struct Frozen {};
+	struct Visible {};
+
+	struct LocalOffset
+	{
+		float x = 0.0f;
+	};
+
+	struct WorldOffset
+	{
+		float x = 0.0f;
+	};
+
+	// Move-only; live counts the buffers that hold memory.
+	struct Buffer
+	{
+		Buffer() = default;
+		explicit Buffer(std::size_t count) : data{ std::make_unique<int[]>(count) }, size{ count } { ++live; }
+		Buffer(Buffer&& other) noexcept : data{ std::move(other.data) }, size{ std::exchange(other.size, 0) } {}
+		Buffer& operator=(Buffer&& other) noexcept
+		{
+			live -= data ? 1 : 0;
+			data = std::move(other.data);
+			size = std::exchange(other.size, 0);
+			return *this;
+		}
+		~Buffer() { live -= data ? 1 : 0; }
+
+		std::unique_ptr<int[]> data;
+		std::size_t size = 0;
+		static inline int live = 0;
+	};
+
 	TEST_CLASS(UnitTest01)
 	{
 	public:
@@ -470,6 +547,1794 @@ namespace ECSTest
 			Assert::IsTrue(entities.size() == 2);		// should find onlyDerived and both
 		}
 
+		TEST_METHOD(ArchetypeStorageKeepsComponents)
+		{
+			using IntVec = std::vector<int>;
+			UsedComponents<EntityState, int, Position, IntVec> usedComponents;
+			EntityManager manager(usedComponents, StorageMode::Archetypes);
+
+			auto first = manager.CreateEntityWithComponents<int, IntVec>(1, IntVec(3, 7));
+			auto second = manager.CreateEntityWithComponents<int>(2);
+			auto third = manager.CreateEntityWithComponents<int, Position>(3, Position(1.0f, 2.0f, 3.0f));
+
+			Assert::IsTrue(manager.EntityCount() == 3);
+			Assert::IsTrue(manager.HasComponent<IntVec>(first));
+			Assert::IsFalse(manager.HasComponent<IntVec>(second));
+			Assert::IsTrue(manager.GetComponent<int>(second) == 2);
+			Assert::IsTrue(manager.GetComponent<IntVec>(first).size() == 3);
+			Assert::IsTrue(manager.GetComponent<EntityState>(third) == EntityState::Active);
+
+			manager.SetComponent(second, std::move(Position(4.0f, 5.0f, 6.0f)));
+			Assert::IsTrue(manager.GetComponent<int>(second) == 2);
+			Assert::IsTrue(manager.GetComponent<Position>(second).y == 5.0f);
+
+			manager.RemoveComponent<int>(first);
+			Assert::IsFalse(manager.HasComponent<int>(first));
+			Assert::IsTrue(manager.GetComponent<IntVec>(first)[2] == 7);
+
+			manager.DestroyEntity(second);
+			Assert::IsTrue(manager.GetComponent<int>(third) == 3);
+			Assert::IsTrue(manager.GetComponent<Position>(third).z == 3.0f);
+
+			auto reused = manager.CreateEntityWithComponents<int>(99);
+			Assert::IsTrue(reused == second);
+			Assert::IsFalse(manager.HasComponent<Position>(reused));
+			Assert::IsTrue(manager.GetComponent<int>(reused) == 99);
+
+			EntityFilter filter;
+			filter.set(GetComponentID<EntityState>(), true);
+			filter.set(GetComponentID<int>(), true);
+			std::vector<EntityIndex> entities;
+			manager.GetEntities(filter, OUT entities);
+			Assert::IsTrue(entities.size() == 2);
+		}
+
+		TEST_METHOD(ArchetypeChunkIteration)
+		{
+			UsedComponents<EntityState, int, Position, Velocity> usedComponents;
+			EntityManager manager(usedComponents, StorageMode::Archetypes);
+
+			for (int i = 0; i < MANY; ++i)
+			{
+				if (i % 4 == 0)
+				{
+					manager.CreateEntityWithComponents<int>(i);
+				}
+				else
+				{
+					manager.CreateEntityWithComponents<Position, Velocity>(Position(i * 1.0f, 0.0f, 0.0f),
+																		   Velocity(1.0f, 0.0f, 0.0f));
+				}
+			}
+
+			EntityFilter filter;
+			filter.set(GetComponentID<Position>(), true);
+			filter.set(GetComponentID<Velocity>(), true);
+
+			std::size_t visited = 0;
+			std::function<void()> doUpdate = [&]
+			{
+				manager.ForEachChunk(filter, [&](const ChunkView& chunk)
+				{
+					auto positions = chunk.Components<Position>();
+					auto velocities = chunk.Components<Velocity>();
+
+					for (std::size_t i = 0; i < chunk.Count(); ++i)
+					{
+						positions[i] = positions[i] + velocities[i] * 0.5f;
+					}
+
+					visited += chunk.Count();
+				});
+			};
+
+			Measure(doUpdate, "Chunked update of position by deltaT * velocity: ");
+
+			Assert::IsTrue(visited == MANY - MANY / 4, std::to_wstring(visited).c_str());
+
+			for (int i = 0; i < MANY; ++i)
+			{
+				if (i % 4 != 0)
+				{
+					Assert::IsTrue(manager.GetComponent<Position>(i).x == i + 0.5f);
+				}
+			}
+		}
+
+		TEST_METHOD(SparseComponentsOnlyStoreOwners)
+		{
+			UsedComponents<EntityState, int, Sparse<Velocity>> usedComponents;
+			EntityManager manager(usedComponents);
+
+			for (int i = 0; i < MANY; ++i)
+			{
+				if (i % 100 == 0)
+				{
+					manager.CreateEntityWithComponents<int, Velocity>(i, Velocity(i * 1.0f, 0.0f, 0.0f));
+				}
+				else
+				{
+					manager.CreateEntityWithComponents<int>(i);
+				}
+			}
+
+			auto& velContainer = manager.GetContainer<Velocity>();
+			Assert::IsTrue(velContainer.Policy() == StoragePolicy::Sparse);
+			Assert::IsTrue(velContainer.Owners().size() == MANY / 100);
+			Assert::IsTrue(manager.GetComponent<Velocity>(300).x == 300.0f);
+			Assert::IsFalse(manager.HasComponent<Velocity>(301));
+
+			EntityFilter filter;
+			filter.set(GetComponentID<int>(), true);
+			filter.set(GetComponentID<Velocity>(), true);
+			std::vector<EntityIndex> entities;
+			manager.GetEntities(filter, OUT entities);
+			Assert::IsTrue(entities.size() == MANY / 100);
+			Assert::IsTrue(entities[3] == 300);
+
+			manager.RemoveComponent<Velocity>(0);
+			manager.DestroyEntity(500);
+			Assert::IsTrue(velContainer.Owners().size() == MANY / 100 - 2);
+			Assert::IsTrue(manager.GetComponent<Velocity>(900).x == 900.0f);
+
+			manager.SetComponent(501, std::move(Velocity(5.0f, 0.0f, 0.0f)));
+			manager.GetEntities(filter, OUT entities);
+			Assert::IsTrue(entities.size() == MANY / 100 - 1);
+			Assert::IsTrue(std::is_sorted(entities.begin(), entities.end()));
+
+			float sum = 0.0f;
+			for (auto owner : velContainer.Owners())
+			{
+				sum += velContainer.Get(owner).x;
+			}
+
+			Assert::IsTrue(sum == 4500.0f - 500.0f + 5.0f);
+		}
+
+		TEST_METHOD(RegisteredQueriesFollowSignatureChanges)
+		{
+			UsedComponents<EntityState, int, Position> usedComponents;
+			EntityManager manager(usedComponents);
+
+			for (int i = 0; i < 100; ++i)
+			{
+				manager.CreateEntityWithComponents<int>(i);
+			}
+
+			EntityFilter filter;
+			filter.set(GetComponentID<int>(), true);
+			filter.set(GetComponentID<Position>(), true);
+			auto& query = manager.RegisterQuery(filter);
+			Assert::IsTrue(query.Entities().empty());
+
+			for (std::size_t i = 0; i < 100; i += 2)
+			{
+				manager.SetComponent(i, std::move(Position(0.0f, 0.0f, 0.0f)));
+			}
+
+			Assert::IsTrue(query.Entities().size() == 50);
+			Assert::IsTrue(query.Contains(10));
+			Assert::IsFalse(query.Contains(11));
+
+			manager.RemoveComponent<int>(10);
+			manager.RemoveComponent<int>(10);
+			manager.DestroyEntity(20);
+			manager.DestroyEntity(21);
+			Assert::IsTrue(query.Entities().size() == 48);
+			Assert::IsFalse(query.Contains(10));
+			Assert::IsFalse(query.Contains(20));
+
+			auto entity = manager.CreateEntityWithComponents<int, Position>(7, Position(1.0f, 1.0f, 1.0f));
+			Assert::IsTrue(query.Contains(entity));
+
+			std::vector<EntityIndex> scanned;
+			manager.GetEntities(filter, OUT scanned);
+			auto cached = query.Entities();
+			std::sort(cached.begin(), cached.end());
+			Assert::IsTrue(cached == scanned);
+
+			auto& late = manager.RegisterQuery(filter);
+			Assert::IsTrue(late.Entities().size() == 49);
+		}
+
+		TEST_METHOD(VectorizedSignatureMatching)
+		{
+			constexpr std::size_t count = 1000 * MANY + 5;
+
+			std::vector<SignatureWord> signatures(count);
+			for (std::size_t i = 0; i < count; ++i)
+			{
+				signatures[i] = static_cast<SignatureWord>(i * 2654435761u);
+			}
+
+			for (SignatureWord filter : { 0x1u, 0x3u, 0x80000101u, 0xFFFFFFFFu })
+			{
+				std::vector<EntityIndex> scalar;
+				std::vector<EntityIndex> vectorized;
+
+				std::function<void()> doScalar = [&]
+				{
+					scalar.clear();
+					MatchSignaturesScalar(signatures.data(), count, filter, OUT scalar);
+				};
+				std::function<void()> doVectorized = [&]
+				{
+					vectorized.clear();
+					MatchSignatures(signatures.data(), count, filter, OUT vectorized);
+				};
+
+				auto selectivity = " (filter " + std::to_string(filter) + ")";
+				Measure(doScalar, "Scalar signature match" + selectivity);
+				Measure(doVectorized, "Vectorized signature match" + selectivity);
+
+				Assert::IsTrue(scalar == vectorized, std::to_wstring(vectorized.size()).c_str());
+			}
+		}
+
+		TEST_METHOD(ManyComponentTypes)
+		{
+			EntityManager manager(MakeTags(std::make_index_sequence<48>()));
+			Assert::IsTrue(GetComponentID<Tag<47>>() >= 48);
+
+			auto& query = manager.RegisterQuery(MakeFilter<Tag<40>, Tag<47>>());
+			for (std::size_t i = 0; i < 10 * MANY; ++i)
+			{
+				auto entity = manager.CreateEntityWithComponents(Tag<1>());
+				if (i % 2 == 0)
+				{
+					manager.SetComponent(entity, Tag<40>());
+				}
+				if (i % 3 == 0)
+				{
+					manager.SetComponent(entity, Tag<47>());
+				}
+			}
+
+			std::vector<EntityIndex> entities;
+			manager.GetEntities(MakeFilter<Tag<40>, Tag<47>>(), OUT entities);
+			Assert::IsTrue(entities.size() == (10 * MANY + 5) / 6);
+			Assert::IsTrue(query.Entities().size() == entities.size());
+
+			manager.RemoveComponent<Tag<47>>(entities.front());
+			Assert::IsFalse(manager.HasComponent<Tag<47>>(entities.front()));
+			Assert::IsTrue(manager.HasComponent<Tag<40>>(entities.front()));
+			Assert::IsTrue(query.Entities().size() == entities.size() - 1);
+
+			std::size_t sum = 0;
+			manager.Each([&](const Tag<40>& a, const Tag<47>& b) { sum += a.value + b.value; });
+			Assert::IsTrue(sum == (entities.size() - 1) * 87);
+
+			manager.GetEntities(MakeFilter<Tag<46>>(), OUT entities);
+			Assert::IsTrue(entities.empty());
+
+			// The ID kernels against the scalar one, with a table of 64 signatures.
+			SignatureTable table;
+			for (std::size_t i = 1; i < 64; ++i)
+			{
+				EntityFilter signature;
+				signature.set(i % 7).set(100 + i % 5).set(150 + i);
+				table.Intern(signature);
+			}
+
+			constexpr std::size_t count = 1000 * MANY + 5;
+			std::vector<SignatureID> signatures(count);
+			for (std::size_t i = 0; i < count; ++i)
+			{
+				signatures[i] = static_cast<SignatureID>((i * 2654435761u) % table.Count());
+			}
+
+			for (auto components : { std::vector<ComponentID>{ 1 }, { 1, 102 }, { 203 }, { 255 } })
+			{
+				EntityFilter filter;
+				for (auto id : components)
+				{
+					filter.set(id);
+				}
+				SignatureMatchTable matchTable(table, filter);
+
+				std::vector<EntityIndex> scalar;
+				std::vector<EntityIndex> vectorized;
+				std::function<void()> doScalar = [&] { scalar.clear(); MatchSignatureIDsScalar(signatures.data(), count, matchTable, OUT scalar); };
+				std::function<void()> doVectorized = [&] { vectorized.clear(); MatchSignatureIDs(signatures.data(), count, matchTable, OUT vectorized); };
+
+				auto selectivity = " (" + std::to_string(matchTable.MatchCount()) + " of 64 signatures match)";
+				Measure(doScalar, "Scalar signature ID match" + selectivity);
+				Measure(doVectorized, "Vectorized signature ID match" + selectivity);
+
+				Assert::IsTrue(scalar == vectorized, std::to_wstring(vectorized.size()).c_str());
+			}
+		}
+
+		TEST_METHOD(EachYieldsComponentReferences)
+		{
+			for (auto storageMode : { StorageMode::Columns, StorageMode::Archetypes })
+			{
+				UsedComponents<EntityState, int, Position, Velocity> usedComponents;
+				EntityManager manager(usedComponents, storageMode);
+
+				for (int i = 0; i < MANY; ++i)
+				{
+					if (i % 2 == 0)
+					{
+						manager.CreateEntityWithComponents<Position, Velocity>(Position(i * 1.0f, 0.0f, 0.0f),
+																			   Velocity(1.0f, 2.0f, 0.0f));
+					}
+					else
+					{
+						manager.CreateEntityWithComponents<Position, int>(Position(i * 1.0f, 0.0f, 0.0f), i);
+					}
+				}
+
+				std::function<void()> doUpdate = [&]
+				{
+					manager.Each([](Position& position, const Velocity& velocity)
+					{
+						position = position + velocity * 0.5f;
+					});
+				};
+
+				Measure(doUpdate, "Each<Position, Velocity> update: ");
+
+				std::size_t visited = 0;
+				manager.Each<Position, int>([&](EntityIndex entity, const Position& position, int& value)
+				{
+					Assert::IsTrue(position.x == value * 1.0f);
+					Assert::IsTrue(entity == static_cast<EntityIndex>(value));
+					value = -value;
+					++visited;
+				});
+
+				Assert::IsTrue(visited == MANY / 2);
+
+				for (int i = 0; i < MANY; ++i)
+				{
+					if (i % 2 == 0)
+					{
+						Assert::IsTrue(manager.GetComponent<Position>(i).x == i + 0.5f);
+						Assert::IsTrue(manager.GetComponent<Position>(i).y == 1.0f);
+					}
+					else
+					{
+						Assert::IsTrue(manager.GetComponent<int>(i) == -i);
+					}
+				}
+			}
+		}
+
+		TEST_METHOD(ThreadPoolParallelFor)
+		{
+			ThreadPool pool(3);
+			Assert::IsTrue(pool.ThreadCount() == 4);
+
+			std::vector<int> values(100 * MANY + 7, 1);
+			std::atomic<std::size_t> ranges{ 0 };
+
+			pool.ParallelFor(values.size(), 1000, [&](std::size_t begin, std::size_t end)
+			{
+				Assert::IsTrue(end - begin <= 1000);
+				for (auto i = begin; i < end; ++i)
+				{
+					values[i] += static_cast<int>(i);
+				}
+				++ranges;
+			});
+
+			Assert::IsTrue(ranges >= values.size() / 1000);
+			for (std::size_t i = 0; i < values.size(); ++i)
+			{
+				Assert::IsTrue(values[i] == static_cast<int>(i) + 1);
+			}
+
+			TaskGroup group;
+			std::atomic<int> nested{ 0 };
+			for (int i = 0; i < 8; ++i)
+			{
+				pool.Submit(group, [&]
+				{
+					pool.ParallelFor(64, 4, [&](std::size_t begin, std::size_t end) { nested += static_cast<int>(end - begin); });
+				});
+			}
+
+			pool.Wait(group);
+			Assert::IsTrue(group.IsDone());
+			Assert::IsTrue(nested == 8 * 64);
+		}
+
+		TEST_METHOD(ParallelEachUpdatesEveryEntityOnce)
+		{
+			ThreadPool pool(3);
+
+			for (auto storageMode : { StorageMode::Columns, StorageMode::Archetypes })
+			{
+				UsedComponents<EntityState, int, Position, Velocity> usedComponents;
+				EntityManager manager(usedComponents, storageMode);
+
+				for (int i = 0; i < 10 * MANY; ++i)
+				{
+					manager.CreateEntityWithComponents<Position, Velocity, int>(Position(i * 1.0f, 0.0f, 0.0f),
+																				Velocity(1.0f, 0.0f, 0.0f), 0);
+				}
+
+				for (std::size_t i = 0; i < 10 * MANY; i += 7)
+				{
+					manager.RemoveComponent<Velocity>(i);
+				}
+
+				std::function<void()> doUpdate = [&]
+				{
+					manager.ParallelEach(pool, [](Position& position, const Velocity& velocity, int& updates)
+					{
+						position = position + velocity * 0.5f;
+						++updates;
+					}, 256);
+				};
+
+				Measure(doUpdate, "ParallelEach<Position, Velocity> update: ");
+
+				std::atomic<std::size_t> visited{ 0 };
+				manager.ParallelEach<Velocity>(pool, [&](EntityIndex, Velocity&) { ++visited; }, 100);
+				Assert::IsTrue(visited == 10 * MANY - (10 * MANY + 6) / 7, std::to_wstring(visited).c_str());
+
+				for (std::size_t i = 0; i < 10 * MANY; ++i)
+				{
+					auto moved = i % 7 != 0;
+					Assert::IsTrue(manager.GetComponent<int>(i) == (moved ? 1 : 0));
+					Assert::IsTrue(manager.GetComponent<Position>(i).x == i + (moved ? 0.5f : 0.0f));
+				}
+			}
+		}
+
+		TEST_METHOD(SchedulerOrdersConflictingSystems)
+		{
+			UsedComponents<EntityState, int, float, Position, Velocity> usedComponents;
+			EntityManager manager(usedComponents);
+			ThreadPool pool(3);
+			Scheduler scheduler(manager, pool);
+
+			for (int i = 0; i < MANY; ++i)
+			{
+				manager.CreateEntityWithComponents<Position, Velocity, int, float>(Position(0.0f, 0.0f, 0.0f),
+																				   Velocity(1.0f, 0.0f, 0.0f), 0, 0.0f);
+			}
+
+			auto integrate = scheduler.Add(System<Read<Velocity>, Write<Position>>(
+				[](Position& position, const Velocity& velocity) { position = position + velocity * 1.0f; }));
+
+			auto copyX = scheduler.Add(System<Read<Position>, Write<int>>(
+				[](const Position& position, int& value) { value = static_cast<int>(position.x); }));
+
+			auto countUp = scheduler.Add(System<Write<float>>([](EntityManager& manager)
+			{
+				manager.Each([](float& value) { value += 1.0f; });
+			}));
+
+			auto accelerate = scheduler.Add(System<Write<Velocity>>([](Velocity& velocity) { velocity.x *= 2.0f; }));
+
+			auto spawn = scheduler.Add(System<Exclusive>([](EntityManager& manager) { manager.CreateEntity(); }));
+
+			Assert::IsTrue(scheduler.SystemCount() == 5);
+			Assert::IsTrue(scheduler.Dependencies(integrate).empty());
+			Assert::IsTrue(scheduler.Dependencies(copyX) == std::vector<std::size_t>{ integrate });
+			Assert::IsTrue(scheduler.Dependencies(countUp).empty());
+			Assert::IsTrue(scheduler.Dependencies(accelerate) == std::vector<std::size_t>{ integrate });
+			Assert::IsTrue(scheduler.Dependencies(spawn).size() == 4);
+
+			std::function<void()> doFrames = [&]
+			{
+				for (int frame = 0; frame < 3; ++frame)
+				{
+					scheduler.Run();
+				}
+			};
+
+			Measure(doFrames, "Three scheduled frames of five systems: ");
+
+			// x advances by 1, 2 and 4 over the three frames
+			for (int i = 0; i < MANY; ++i)
+			{
+				Assert::IsTrue(manager.GetComponent<Position>(i).x == 7.0f);
+				Assert::IsTrue(manager.GetComponent<int>(i) == 7);
+				Assert::IsTrue(manager.GetComponent<float>(i) == 3.0f);
+				Assert::IsTrue(manager.GetComponent<Velocity>(i).x == 8.0f);
+			}
+
+			Assert::IsTrue(manager.EntityCount() == MANY + 3);
+		}
+
+		TEST_METHOD(BulkCreateAndDestroy)
+		{
+			for (auto storageMode : { StorageMode::Columns, StorageMode::Archetypes })
+			{
+				UsedComponents<EntityState, int, Position, Sparse<Velocity>> usedComponents;
+				EntityManager manager(usedComponents, storageMode);
+				auto& query = manager.RegisterQuery(MakeFilter<Position, Velocity>());
+
+				std::vector<EntityIndex> first;
+				std::function<void()> doCreate = [&]
+				{
+					manager.CreateEntities(10 * MANY, OUT first, Position(1.0f, 2.0f, 3.0f), 5);
+				};
+
+				Measure(doCreate, "Bulk creation of 10 * MANY entities: ");
+
+				Assert::IsTrue(manager.EntityCount() == 10 * MANY);
+				Assert::IsTrue(first.size() == 10 * MANY);
+				Assert::IsTrue(manager.HasComponent<EntityState>(first[7]));
+				Assert::IsTrue(manager.GetComponent<Position>(first[7]).y == 2.0f);
+				Assert::IsTrue(manager.GetComponent<int>(first.back()) == 5);
+				Assert::IsTrue(query.Entities().empty());
+
+				std::vector<EntityIndex> doomed(first.begin(), first.begin() + MANY);
+				manager.DestroyEntities(doomed);
+				Assert::IsTrue(manager.EntityCount() == 9 * MANY);
+				Assert::IsFalse(manager.HasComponent<Position>(first[0]));
+
+				std::vector<EntityIndex> second;
+				manager.CreateEntities<Position, Velocity>(2 * MANY, OUT second,
+					[](std::size_t i, Position& position, Velocity& velocity)
+				{
+					position = Position(i * 1.0f, 0.0f, 0.0f);
+					velocity = Velocity(0.0f, i * 1.0f, 0.0f);
+				});
+
+				Assert::IsTrue(manager.EntityCount() == 11 * MANY);
+				Assert::IsTrue(query.Entities().size() == 2 * MANY);
+				Assert::IsFalse(manager.HasComponent<int>(second[0]));
+
+				for (std::size_t i = 0; i < second.size(); ++i)
+				{
+					Assert::IsTrue(i >= MANY || second[i] < MANY);
+					Assert::IsTrue(i < MANY || second[i] >= 10 * MANY);
+					Assert::IsTrue(manager.GetComponent<Position>(second[i]).x == i * 1.0f);
+					Assert::IsTrue(manager.GetComponent<Velocity>(second[i]).y == i * 1.0f);
+				}
+
+				manager.DestroyEntities(second.data(), MANY / 2);
+				Assert::IsTrue(query.Entities().size() == 2 * MANY - MANY / 2);
+
+				std::vector<EntityIndex> scanned;
+				manager.GetEntities(MakeFilter<Position, Velocity>(), OUT scanned);
+				Assert::IsTrue(scanned.size() == 2 * MANY - MANY / 2);
+			}
+		}
+
+		TEST_METHOD(StaleHandlesAreDetected)
+		{
+			UsedComponents<EntityState, int> usedComponents;
+			EntityManager manager(usedComponents);
+
+			auto entity = manager.CreateEntityWithComponents<int>(1);
+			auto other = manager.CreateEntityWithComponents<int>(2);
+			auto handle = manager.GetHandle(entity);
+			Assert::IsTrue(handle.Index() == entity);
+			Assert::IsTrue(manager.IsValid(handle));
+			Assert::IsTrue(manager.IsValid(manager.GetHandle(other)));
+
+			manager.DestroyEntity(entity);
+			Assert::IsFalse(manager.IsValid(handle));
+
+			auto reused = manager.CreateEntityWithComponents<int>(3);
+			Assert::IsTrue(reused == entity);
+			Assert::IsFalse(manager.IsValid(handle));
+			Assert::IsTrue(manager.IsValid(manager.GetHandle(reused)));
+			Assert::IsTrue(manager.GetHandle(reused) != handle);
+
+			std::vector<EntityIndex> entities;
+			manager.CreateEntities(4, OUT entities, 7);
+			std::vector<EntityHandle> handles;
+			for (auto created : entities)
+			{
+				handles.push_back(manager.GetHandle(created));
+			}
+
+			manager.DestroyEntities(entities.data(), 2);
+			Assert::IsFalse(manager.IsValid(handles[0]));
+			Assert::IsFalse(manager.IsValid(handles[1]));
+			Assert::IsTrue(manager.IsValid(handles[2]));
+			Assert::IsTrue(manager.IsValid(handles[3]));
+			Assert::IsTrue(manager.EntityCount() == 4);
+		}
+
+		TEST_METHOD(CommandBuffersPlayBackDeterministically)
+		{
+			auto simulate = [](std::size_t workerCount)
+			{
+				UsedComponents<EntityState, int, float> usedComponents;
+				EntityManager manager(usedComponents);
+				ThreadPool pool(workerCount);
+				CommandQueue commands(manager, pool);
+
+				for (int i = 0; i < int(MANY); ++i)
+				{
+					manager.CreateEntityWithComponents<int>(i);
+				}
+
+				manager.ParallelEach(pool, [&](EntityIndex entity, int& value)
+				{
+					auto& local = commands.Local();
+					if (value % 3 == 0)
+					{
+						local.DestroyEntity(entity);
+					}
+					else if (value % 3 == 1)
+					{
+						auto child = local.CreateEntity(entity);
+						local.SetComponent(child, value * 10);
+						local.SetComponent(child, 1.0f);
+					}
+					else
+					{
+						local.RemoveComponent<int>(entity);
+						local.SetComponent(entity, float(value));
+					}
+				}, 16);
+
+				// Already destroyed above; playback must drop the second destroy.
+				commands.Local().DestroyEntity(0);
+				commands.Playback();
+
+				Assert::IsTrue(manager.EntityCount() == int(MANY - (MANY + 2) / 3 + (MANY + 1) / 3));
+				Assert::IsTrue(manager.HasComponent<float>(2) && !manager.HasComponent<int>(2));
+
+				std::vector<std::tuple<unsigned long, int, float>> state;
+				for (EntityIndex entity = 0; entity < MANY; ++entity)
+				{
+					auto signature = manager.GetSignature(entity);
+					state.emplace_back(signature.to_ulong(),
+									   manager.HasComponent<int>(entity) ? manager.GetComponent<int>(entity) : -1,
+									   manager.HasComponent<float>(entity) ? manager.GetComponent<float>(entity) : -1.0f);
+				}
+				return state;
+			};
+
+			auto serial = simulate(0);
+			Assert::IsTrue(serial == simulate(3));
+			Assert::IsTrue(serial == simulate(7));
+		}
+
+		TEST_METHOD(PluggableAllocatorsBackComponentStorage)
+		{
+			PoolAllocator pool(COLUMN_PAGE_SIZE);
+			LinearArena arena(1024 * 1024);
+			HugePageAllocator hugePages;
+			std::vector<Allocator*> allocators = { &DefaultAllocator(), &pool, &arena, &hugePages };
+
+			for (auto allocator : allocators)
+			{
+				for (auto storageMode : { StorageMode::Columns, StorageMode::Archetypes })
+				{
+					UsedComponents<EntityState, int, Position, Sparse<Velocity>> usedComponents;
+					EntityManager manager(usedComponents, storageMode, *allocator);
+
+					std::vector<EntityIndex> entities;
+					manager.CreateEntities<Position>(10 * MANY, OUT entities, [](std::size_t i, Position& position)
+					{
+						position = Position(i * 1.0f, 0.0f, 0.0f);
+					});
+
+					for (std::size_t i = 0; i < entities.size(); i += 7)
+					{
+						manager.SetComponent(entities[i], Velocity(1.0f, 0.0f, 0.0f));
+					}
+
+					manager.DestroyEntities(entities.data(), MANY);
+
+					float sum = 0.0f;
+					manager.Each([&](const Position& position, const Velocity& velocity) { sum += velocity.x; });
+					Assert::IsTrue(sum == float((10 * MANY + 6) / 7 - (MANY + 6) / 7));
+					Assert::IsTrue(manager.GetComponent<Position>(entities.back()).x == 10 * MANY - 1.0f);
+				}
+			}
+
+			// Growth adds pages instead of moving the column.
+			UsedComponents<EntityState, Position> usedComponents;
+			EntityManager manager(usedComponents, StorageMode::Columns, hugePages);
+			auto first = manager.CreateEntity();
+			manager.SetComponent(first, Position(1.0f, 2.0f, 3.0f));
+			auto address = &manager.GetContainer<Position>().Get(first);
+			Assert::IsTrue(reinterpret_cast<std::uintptr_t>(address) % CACHE_LINE_SIZE == 0);
+
+			std::vector<EntityIndex> entities;
+			manager.CreateEntities(100 * MANY, OUT entities, Position());
+			Assert::IsTrue(&manager.GetContainer<Position>().Get(first) == address);
+			Assert::IsTrue(manager.GetComponent<Position>(first).z == 3.0f);
+		}
+
+		TEST_METHOD(ChangeFiltersVisitOnlyTouchedEntities)
+		{
+			for (auto storageMode : { StorageMode::Columns, StorageMode::Archetypes })
+			{
+				UsedComponents<EntityState, Position, Velocity, Sparse<int>> usedComponents;
+				EntityManager manager(usedComponents, storageMode);
+
+				std::vector<EntityIndex> entities;
+				manager.CreateEntities(100 * MANY, OUT entities, Position(), Velocity());
+
+				auto lastRun = manager.NextVersion();
+				manager.SetComponent(entities[10], Position(1.0f, 0.0f, 0.0f));
+				manager.SetComponent(entities[50 * MANY], Position(2.0f, 0.0f, 0.0f));
+				manager.SetComponent(entities[7], 7);
+
+				std::vector<EntityIndex> changed;
+				std::function<void()> doFiltered = [&]
+				{
+					manager.Each<Changed<Position>>(lastRun, [&](EntityIndex entity, const Position&)
+					{
+						changed.push_back(entity);
+					});
+				};
+
+				Measure(doFiltered, "Each<Changed<Position>> with 2 of 100 * MANY changed");
+
+				Assert::IsTrue(std::find(changed.begin(), changed.end(), entities[10]) != changed.end());
+				Assert::IsTrue(std::find(changed.begin(), changed.end(), entities[50 * MANY]) != changed.end());
+				Assert::IsTrue(changed.size() < 10 * MANY);
+				if (storageMode == StorageMode::Columns)
+				{
+					Assert::IsTrue(changed.size() == 2);
+				}
+
+				std::size_t added = 0;
+				manager.Each<Added<int>>(lastRun, [&](EntityIndex entity, const Position&) { ++added; });
+				Assert::IsTrue(storageMode == StorageMode::Archetypes || added == 1);
+				Assert::IsTrue(added >= 1);
+
+				// Reading does not count as a change, writing through a reference does.
+				lastRun = manager.NextVersion();
+				manager.Each([](const Position&, Velocity& velocity) { velocity.x += 1.0f; });
+
+				std::size_t positions = 0;
+				std::size_t velocities = 0;
+				manager.Each<Changed<Position>>(lastRun, [&](const Position&) { ++positions; });
+				manager.Each<Changed<Velocity>>(lastRun, [&](const Velocity&) { ++velocities; });
+				Assert::IsTrue(positions == 0);
+				Assert::IsTrue(velocities == 100 * MANY);
+
+				lastRun = manager.NextVersion();
+				manager.GetComponent<Velocity>(entities[3]);
+				manager.Each<Changed<Velocity>>(lastRun, [&](const Velocity&) { Assert::Fail(); });
+			}
+		}
+
+		TEST_METHOD(SnapshotsRoundTrip)
+		{
+			using IntVec = std::vector<int>;
+			UsedComponents<EntityState, int, Position, Sparse<Velocity>, IntVec> usedComponents;
+			const std::string path = "SnapshotsRoundTrip.snapshot";
+
+			EntityManager original(usedComponents);
+			std::vector<EntityIndex> entities;
+			original.CreateEntities<int, Position>(100 * MANY, OUT entities, [](std::size_t i, int& value, Position& position)
+			{
+				value = int(i);
+				position = Position(i * 1.0f, 2.0f, 3.0f);
+			});
+
+			for (std::size_t i = 0; i < entities.size(); i += 100)
+			{
+				original.SetComponent(entities[i], Velocity(i * 1.0f, 0.0f, 0.0f));
+			}
+			original.SetComponent(entities[5], IntVec{ 1, 2, 3 });
+			auto stale = original.GetHandle(entities[1]);
+			original.DestroyEntity(entities[1]);
+			original.DestroyEntity(entities[200]);
+
+			auto saved = false;
+			std::function<void()> doSave = [&] { saved = Snapshot::Save(original, path); };
+			Measure(doSave, "Snapshot::Save of 100 * MANY entities");
+			Assert::IsTrue(saved);
+
+			for (auto mode : { SnapshotLoad::Map, SnapshotLoad::Copy })
+			{
+				EntityManager loaded(usedComponents);
+				auto& query = loaded.RegisterQuery(MakeFilter<Position, Velocity>());
+
+				auto succeeded = false;
+				std::function<void()> doLoad = [&] { succeeded = Snapshot::Load(loaded, path, mode); };
+				Measure(doLoad, mode == SnapshotLoad::Map ? "Snapshot::Load mapped" : "Snapshot::Load copied");
+				Assert::IsTrue(succeeded);
+
+				Assert::IsTrue(loaded.EntityCount() == original.EntityCount());
+				Assert::IsFalse(loaded.IsValid(stale));
+				Assert::IsTrue(query.Entities().size() == MANY - 1);
+				Assert::IsTrue(loaded.GetComponent<int>(entities[777]) == 777);
+				Assert::IsTrue(loaded.GetComponent<Position>(entities.back()).x == entities.size() - 1.0f);
+				Assert::IsTrue(loaded.GetComponent<Velocity>(entities[300]).x == 300.0f);
+				Assert::IsFalse(loaded.HasComponent<Velocity>(entities[200]));
+				Assert::IsTrue(loaded.GetComponent<IntVec>(entities[5]) == IntVec({ 1, 2, 3 }));
+
+				// Writes land in private copies of the mapped pages, growth in new ones.
+				loaded.SetComponent(entities[777], 1);
+				Assert::IsTrue(loaded.CreateEntity() == entities[200]);
+				std::vector<EntityIndex> more;
+				loaded.CreateEntities(MANY, OUT more, 5, Position());
+				Assert::IsTrue(loaded.GetComponent<int>(more.back()) == 5);
+				Assert::IsTrue(loaded.GetComponent<int>(entities[777]) == 1);
+			}
+
+			EntityManager reloaded(usedComponents);
+			Assert::IsTrue(Snapshot::Load(reloaded, path));
+			Assert::IsTrue(reloaded.GetComponent<int>(entities[777]) == 777);
+			Assert::IsFalse(Snapshot::Load(reloaded, path));
+
+			// Corrupt files are rejected before anything is read: a free index
+			// past the entities, a column shorter than its components, and an
+			// entity count whose size wraps around.
+			std::string bytes;
+			{
+				std::ifstream in(path, std::ios::binary);
+				bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+			}
+			auto field = [&](std::uint64_t offset)
+			{
+				std::uint64_t value;
+				std::memcpy(&value, bytes.data() + offset, sizeof(value));
+				return value;
+			};
+			auto rejects = [&](std::uint64_t offset, std::uint64_t value)
+			{
+				auto corrupt = bytes;
+				std::memcpy(&corrupt[offset], &value, sizeof(value));
+				std::ofstream(path, std::ios::binary).write(corrupt.data(), corrupt.size());
+
+				EntityManager manager(usedComponents);
+				return !Snapshot::Load(manager, path, SnapshotLoad::Copy) && manager.EntityCount() == 0;
+			};
+			const std::uint64_t entityCountField = 8, columnsOffsetField = 32, freeListOffsetField = 40;
+			const std::uint64_t columnRecordSize = 48, dataSizeField = 40;
+			Assert::IsTrue(rejects(field(freeListOffsetField), entities.size() + 1));
+			Assert::IsTrue(rejects(field(columnsOffsetField) + columnRecordSize + dataSizeField, 16));
+			Assert::IsTrue(rejects(entityCountField, std::uint64_t(1) << 62));
+
+			EntityManager archetypes(usedComponents, StorageMode::Archetypes);
+			Assert::IsFalse(Snapshot::Save(archetypes, path));
+
+			std::remove(path.c_str());
+		}
+
+		TEST_METHOD(DeltasReplicateTicks)
+		{
+			UsedComponents<EntityState, int, Position, Sparse<Velocity>> usedComponents;
+
+			for (auto compression : { DeltaCompression::XorRle, DeltaCompression::None })
+			{
+				EntityManager original(usedComponents);
+				EntityManager replica(usedComponents);
+				auto& query = replica.RegisterQuery(MakeFilter<Position, Velocity>());
+				DeltaEncoder encoder;
+				DeltaDecoder decoder;
+				std::vector<std::byte> delta;
+
+				auto replicate = [&]
+				{
+					delta.clear();
+					Assert::IsTrue(encoder.Encode(original, OUT delta, compression));
+					Assert::IsTrue(decoder.Apply(replica, delta));
+					original.NextVersion();
+				};
+
+				auto matches = [&](const std::vector<EntityIndex>& entities)
+				{
+					Assert::IsTrue(replica.EntityCount() == original.EntityCount());
+					for (auto entity : entities)
+					{
+						Assert::IsTrue(replica.GetHandle(entity) == original.GetHandle(entity));
+						Assert::IsTrue(replica.GetSignature(entity) == original.GetSignature(entity));
+						if (original.HasComponent<int>(entity))
+						{
+							Assert::IsTrue(replica.GetComponent<int>(entity) == original.GetComponent<int>(entity));
+						}
+						if (original.HasComponent<Position>(entity))
+						{
+							Assert::IsTrue(replica.GetComponent<Position>(entity).x == original.GetComponent<Position>(entity).x);
+						}
+						if (original.HasComponent<Velocity>(entity))
+						{
+							Assert::IsTrue(replica.GetComponent<Velocity>(entity).y == original.GetComponent<Velocity>(entity).y);
+						}
+					}
+				};
+
+				std::vector<EntityIndex> entities;
+				original.CreateEntities<int, Position>(10 * MANY, OUT entities, [](std::size_t i, int& value, Position& position)
+				{
+					value = int(i);
+					position = Position(i * 1.0f, 0.0f, 0.0f);
+				});
+				for (std::size_t i = 0; i < entities.size(); i += 10)
+				{
+					original.SetComponent(entities[i], Velocity(0.0f, 1.0f, 0.0f));
+				}
+
+				replicate();
+				auto fullSize = delta.size();
+				matches(entities);
+				Assert::IsTrue(query.Entities().size() == MANY);
+
+				// A few writes and structural changes make for a small delta.
+				for (std::size_t i = 0; i < entities.size(); i += 1000)
+				{
+					original.GetContainer<Position>().Get(entities[i]).x += 0.5f;
+				}
+				original.RemoveComponent<Velocity>(entities[10]);
+				original.SetComponent(entities[11], Velocity(0.0f, 2.0f, 0.0f));
+				original.DestroyEntity(entities[20]);
+				entities.push_back(original.CreateEntityWithComponents(7));
+				entities.push_back(original.CreateEntityWithComponents(8));
+
+				replicate();
+				Assert::IsTrue(delta.size() * 50 < fullSize);
+				matches(entities);
+				Assert::IsTrue(query.Entities().size() == MANY - 1);
+				Assert::IsTrue(replica.CreateEntity() == original.CreateEntity());
+
+				// Rewriting the same values sends no components at all.
+				original.Each([](Position& position) { position.x += 0.0f; });
+				replicate();
+				Assert::IsTrue(delta.size() < 64);
+
+				// Deltas only apply in order.
+				Assert::IsFalse(decoder.Apply(replica, delta));
+				delta.clear();
+				Assert::IsTrue(encoder.Encode(original, OUT delta, compression));
+				Assert::IsFalse(decoder.Apply(replica, delta.data(), delta.size() - 1));
+				Assert::IsTrue(decoder.Apply(replica, delta));
+				matches(entities);
+			}
+
+			EntityManager original(usedComponents);
+			std::vector<EntityIndex> entities;
+			original.CreateEntities(100 * MANY, OUT entities, 0, Position());
+
+			DeltaEncoder encoder;
+			std::vector<std::byte> delta;
+			encoder.Encode(original, OUT delta);
+			original.NextVersion();
+
+			std::function<void()> encode = [&]
+			{
+				for (std::size_t i = 0; i < entities.size(); i += 100)
+				{
+					original.GetContainer<Position>().Get(entities[i]).y += 1.0f;
+				}
+				delta.clear();
+				encoder.Encode(original, OUT delta);
+				original.NextVersion();
+			};
+			Measure(encode, "DeltaEncoder::Encode, 1% of 100 * MANY positions changed");
+		}
+
+		TEST_METHOD(WorldsResolveComponentsAtCompileTime)
+		{
+			using TestWorld = World<EntityState, int, Position, Sparse<Velocity>>;
+			static_assert(TestWorld::ID<EntityState> == 0 && TestWorld::ID<const Position&> == 2 && TestWorld::ID<Velocity> == 3);
+			static_assert(TestWorld::Mask<Position, Velocity>() == 0b1100);
+			static_assert(std::is_same_v<decltype(std::declval<TestWorld&>().GetContainer<EntityState>()), TagContainer<EntityState>&>);
+
+			TestWorld world;
+			std::vector<EntityIndex> entities;
+			world.CreateEntities(100 * MANY, OUT entities, 1, Position(1.0f, 0.0f, 0.0f));
+			for (std::size_t i = 0; i < entities.size(); i += 100)
+			{
+				world.SetComponent(entities[i], Velocity(1.0f, 2.0f, 3.0f));
+			}
+
+			Assert::IsTrue(world.EntityCount() == 100 * MANY);
+			Assert::IsTrue(world.GetComponent<EntityState>(entities[5]) == EntityState::Active);
+			Assert::IsTrue(world.HasComponent<Velocity>(entities[100]));
+			Assert::IsFalse(world.HasComponent<Velocity>(entities[101]));
+
+			std::size_t moved = 0;
+			world.Each([&](Position& position, const Velocity& velocity)
+			{
+				position.x += velocity.x;
+				++moved;
+			});
+			Assert::IsTrue(moved == MANY);
+			Assert::IsTrue(world.GetComponent<Position>(entities[200]).x == 2.0f);
+			Assert::IsTrue(world.GetComponent<Position>(entities[201]).x == 1.0f);
+
+			world.RemoveComponent<Velocity>(entities[200]);
+			auto handle = world.GetHandle(entities[300]);
+			world.DestroyEntity(entities[300]);
+			Assert::IsFalse(world.IsValid(handle));
+			Assert::IsFalse(world.IsValid(EntityHandle(EntityIndex(200 * MANY), 0)));
+			Assert::IsTrue(world.CreateEntityWithComponents(5) == entities[300]);
+			Assert::IsTrue(world.GetComponent<int>(entities[300]) == 5);
+			Assert::IsFalse(world.HasComponent<Position>(entities[300]));
+
+			moved = 0;
+			world.Each<Velocity>([&](EntityIndex entity, Velocity&) { ++moved; });
+			Assert::IsTrue(moved == MANY - 2);
+
+			World<Position, Velocity> stateless;
+			stateless.CreateEntities(MANY, OUT entities, Velocity(1.0f, 0.0f, 0.0f));
+			Assert::IsTrue(stateless.HasComponent<Velocity>(entities[0]) && !stateless.HasComponent<Position>(entities[0]));
+			stateless.CreateEntities(MANY, OUT entities);
+			Assert::IsTrue(stateless.EntityCount() == 2 * MANY && !stateless.HasComponent<Velocity>(entities[0]));
+
+			EntityManager manager(UsedComponents<EntityState, int, Position, Sparse<Velocity>>{});
+			manager.CreateEntities(100 * MANY, OUT entities, 1, Position(1.0f, 0.0f, 0.0f));
+
+			std::function<void()> worldEach = [&] { world.Each([](Position& position, const int& value) { position.y += value; }); };
+			std::function<void()> managerEach = [&] { manager.Each([](Position& position, const int& value) { position.y += value; }); };
+			Measure(worldEach, "World::Each over 100 * MANY entities");
+			Measure(managerEach, "EntityManager::Each over 100 * MANY entities");
+		}
+
+		TEST_METHOD(ProfilerReportsQueriesAndContainers)
+		{
+			DefaultProfiler().Clear();
+
+			EntityManager manager(UsedComponents<EntityState, int, Position, Sparse<Velocity>>{});
+			std::vector<EntityIndex> entities;
+			manager.CreateEntities(MANY, OUT entities, 1, Position(1.0f, 0.0f, 0.0f));
+
+			for (std::size_t i = 0; i < MANY; i += 10)
+			{
+				manager.SetComponent(entities[i], Velocity(1.0f, 0.0f, 0.0f));
+			}
+
+			std::vector<EntityIndex> destroyed(entities.begin(), entities.begin() + MANY / 2);
+			manager.DestroyEntities(destroyed);
+
+			// Dense columns keep a slot for every entity index, live or not.
+			for (auto& container : manager.ContainerStatistics())
+			{
+				Assert::IsTrue(container.capacity >= container.slots && container.bytes > 0);
+
+				if (container.id == GetComponentID<Position>())
+				{
+					Assert::IsTrue(container.live == MANY / 2 && container.slots == MANY);
+					Assert::IsTrue(container.FillRatio() <= 0.5);
+				}
+				else if (container.id == GetComponentID<Velocity>())
+				{
+					Assert::IsTrue(container.policy == StoragePolicy::Sparse);
+					Assert::IsTrue(container.live == MANY / 20 && container.slots == MANY / 20);
+				}
+			}
+
+			EntityManager archetypes(UsedComponents<EntityState, int, Position>{}, StorageMode::Archetypes);
+			archetypes.CreateEntities(MANY, OUT entities, 1, Position(1.0f, 0.0f, 0.0f));
+			for (auto& container : archetypes.ContainerStatistics())
+			{
+				Assert::IsTrue(container.live == MANY && container.capacity >= MANY);
+			}
+
+			auto filter = MakeFilter<Position>();
+			{
+				ProfileScope scope("query", "Manual", filter);
+				scope.Count(10, 3);
+			}
+
+			manager.GetEntities(MakeFilter<int, Velocity>(), OUT entities);
+			manager.Each([](Position& position) { position.x += 1.0f; });
+
+			ThreadPool pool(2);
+			Scheduler scheduler(manager, pool);
+			scheduler.Add(System<Write<int>>([](int& value) { ++value; }), "Count \"up\"");
+			scheduler.Run();
+			scheduler.Run();
+
+			auto stats = DefaultProfiler().Stats();
+			auto findQuery = [&](const std::string& name, const EntityFilter& filter) -> const QueryStats*
+			{
+				for (auto& query : stats.queries)
+				{
+					if (name == query.name && filter == query.filter)
+					{
+						return &query;
+					}
+				}
+				return nullptr;
+			};
+
+			auto manual = findQuery("Manual", filter);
+			Assert::IsTrue(manual != nullptr && manual->calls == 1);
+			Assert::IsTrue(manual->scanned == 10 && manual->matched == 3);
+
+#if defined(ECS_PROFILE)
+			// The sparse Velocity bounds the scan to its owners.
+			auto getEntities = findQuery("GetEntities", MakeFilter<int, Velocity>());
+			Assert::IsTrue(getEntities != nullptr && getEntities->scanned == MANY / 20);
+			Assert::IsTrue(getEntities->matched == MANY / 20);
+
+			auto each = findQuery("Each", filter);
+			Assert::IsTrue(each != nullptr && each->scanned == MANY / 2 && each->matched == MANY / 2);
+
+			std::size_t systemCalls = 0;
+			for (auto& system : stats.systems)
+			{
+				Assert::IsTrue(std::string(system.name) == "Count \"up\"");
+				systemCalls += system.calls;
+			}
+			Assert::IsTrue(systemCalls == 2);
+#else
+			Assert::IsTrue(stats.queries.size() == 1 && stats.systems.empty());
+#endif
+
+			DefaultProfiler().RecordContainers(manager.ContainerStatistics());
+			std::ostringstream trace;
+			DefaultProfiler().WriteChromeTrace(trace);
+			Assert::IsTrue(trace.str().find("\"name\":\"Manual\",\"cat\":\"query\",\"ph\":\"X\"") != std::string::npos);
+			Assert::IsTrue(trace.str().find("\"ph\":\"C\"") != std::string::npos);
+			Logger::WriteMessage(trace.str().c_str());
+
+			DefaultProfiler().Clear();
+			Assert::IsTrue(DefaultProfiler().Stats().queries.empty());
+		}
+
+		TEST_METHOD(CompactionClosesHolesAndKeepsHandles)
+		{
+			UsedComponents<EntityState, int, Position, Sparse<Velocity>> usedComponents;
+			EntityManager manager(usedComponents);
+			EntityManager replica(usedComponents);
+			auto& query = manager.RegisterQuery(MakeFilter<int, Velocity>());
+
+			std::vector<EntityIndex> entities;
+			manager.CreateEntities<int, Position>(MANY, OUT entities, [](std::size_t i, int& value, Position& position)
+			{
+				value = int(i);
+				position = Position(i * 1.0f, 0.0f, 0.0f);
+			});
+
+			std::vector<EntityHandle> handles;
+			std::vector<EntityIndex> destroyed;
+			for (std::size_t i = 0; i < MANY; ++i)
+			{
+				handles.push_back(manager.GetHandle(entities[i]));
+				if (i % 3 == 0)
+				{
+					manager.SetComponent(entities[i], Velocity(0.0f, i * 1.0f, 0.0f));
+				}
+				if (i % 4 != 0)
+				{
+					destroyed.push_back(entities[i]);
+				}
+			}
+
+			DeltaEncoder encoder;
+			DeltaDecoder decoder;
+			std::vector<std::byte> delta;
+			auto replicate = [&]
+			{
+				delta.clear();
+				Assert::IsTrue(encoder.Encode(manager, OUT delta));
+				Assert::IsTrue(decoder.Apply(replica, delta));
+				manager.NextVersion();
+
+				Assert::IsTrue(replica.EntityCount() == manager.EntityCount());
+				for (EntityIndex entity = 0; entity < EntityIndex(manager.EntityCount()); ++entity)
+				{
+					Assert::IsTrue(replica.GetHandle(entity) == manager.GetHandle(entity));
+					Assert::IsTrue(replica.GetSignature(entity) == manager.GetSignature(entity));
+					Assert::IsTrue(replica.GetComponent<int>(entity) == manager.GetComponent<int>(entity));
+				}
+			};
+
+			replicate();
+			manager.DestroyEntities(destroyed);
+
+			// With no budget every step still makes some progress.
+			Compactor compactor(manager, CompactionOrder::Signature);
+			std::vector<EntityMove> moves;
+			std::size_t steps = 1;
+			while (!compactor.Step(std::chrono::nanoseconds(0), OUT moves))
+			{
+				++steps;
+			}
+			Assert::IsTrue(steps > 1 && compactor.IsDone());
+
+			Assert::IsTrue(manager.EntityCount() == MANY / 4);
+			for (auto& container : manager.ContainerStatistics())
+			{
+				if (container.id == GetComponentID<Position>())
+				{
+					Assert::IsTrue(container.slots == MANY / 4 && container.live == MANY / 4);
+				}
+			}
+
+			// Stored handles follow the reported moves to where Resolve points.
+			auto patched = handles;
+			for (auto& move : moves)
+			{
+				for (auto& handle : patched)
+				{
+					if (handle == move.from)
+					{
+						handle = move.to;
+					}
+				}
+			}
+
+			for (std::size_t i = 0; i < MANY; ++i)
+			{
+				auto handle = manager.Resolve(handles[i]);
+				if (i % 4 != 0)
+				{
+					Assert::IsFalse(manager.IsValid(handle));
+					continue;
+				}
+
+				Assert::IsTrue(manager.IsValid(handle) && handle == patched[i]);
+				Assert::IsTrue(manager.GetComponent<int>(handle.Index()) == int(i));
+				Assert::IsTrue(manager.GetComponent<Position>(handle.Index()).x == i * 1.0f);
+				Assert::IsTrue(manager.HasComponent<Velocity>(handle.Index()) == (i % 3 == 0));
+			}
+
+			std::size_t runs = 1;
+			for (EntityIndex entity = 1; entity < MANY / 4; ++entity)
+			{
+				runs += manager.HasComponent<Velocity>(entity) != manager.HasComponent<Velocity>(entity - 1);
+			}
+			Assert::IsTrue(runs <= 2);
+
+			std::vector<EntityIndex> scanned;
+			manager.GetEntities(MakeFilter<int, Velocity>(), OUT scanned);
+			auto cached = query.Entities();
+			std::sort(cached.begin(), cached.end());
+			Assert::IsTrue(cached == scanned && scanned.size() == (MANY + 11) / 12);
+
+			replicate();
+			manager.ClearForwarding();
+
+			Compactor byKey(manager, [&](EntityIndex entity) { return ~std::uint64_t(manager.GetComponent<int>(entity)); });
+			Assert::IsTrue(byKey.Run(OUT moves));
+			for (EntityIndex entity = 1; entity < MANY / 4; ++entity)
+			{
+				Assert::IsTrue(manager.GetComponent<int>(entity) < manager.GetComponent<int>(entity - 1));
+			}
+			replicate();
+
+			// New entities reuse nothing and stale handles stay stale.
+			auto entity = manager.CreateEntityWithComponents<int>(-1);
+			Assert::IsTrue(entity == MANY / 4);
+			for (std::size_t i = 0; i < MANY; ++i)
+			{
+				Assert::IsFalse(manager.IsValid(handles[i]) && handles[i].Index() == entity);
+			}
+			replicate();
+
+			EntityManager archetypes(UsedComponents<EntityState, int, Position>{}, StorageMode::Archetypes);
+			archetypes.CreateEntities<int, Position>(MANY, OUT entities, [](std::size_t i, int& value, Position& position)
+			{
+				value = int(i);
+				position = Position(1.0f, 0.0f, 0.0f);
+			});
+			handles.clear();
+			destroyed.clear();
+			for (std::size_t i = 0; i < MANY; ++i)
+			{
+				handles.push_back(archetypes.GetHandle(entities[i]));
+				if (i % 2 != 0)
+				{
+					destroyed.push_back(entities[i]);
+				}
+			}
+			archetypes.DestroyEntities(destroyed);
+
+			Assert::IsTrue(Compactor(archetypes, CompactionOrder::Signature).Run(OUT moves));
+			Assert::IsTrue(archetypes.EntityCount() == MANY / 2);
+			for (std::size_t i = 0; i < MANY; i += 2)
+			{
+				auto handle = archetypes.Resolve(handles[i]);
+				Assert::IsTrue(archetypes.IsValid(handle) && handle.Index() < MANY / 2);
+				Assert::IsTrue(archetypes.GetComponent<int>(handle.Index()) == int(i));
+			}
+
+			std::size_t visited = 0;
+			archetypes.Each([&](EntityIndex entity, const int& value)
+			{
+				Assert::IsTrue(archetypes.Resolve(handles[value]).Index() == entity);
+				++visited;
+			});
+			Assert::IsTrue(visited == MANY / 2);
+		}
+
+		TEST_METHOD(GroupsPackOwnedComponents)
+		{
+			UsedComponents<EntityState, int, Sparse<Position>, Sparse<Velocity>> usedComponents;
+			const std::string path = "GroupsPackOwnedComponents.snapshot";
+
+			EntityManager manager(usedComponents);
+			std::vector<EntityIndex> entities;
+			manager.CreateEntities<int>(100 * MANY, OUT entities, [](std::size_t i, int& value) { value = int(i); });
+			for (std::size_t i = 0; i < entities.size(); ++i)
+			{
+				if (i % 2 == 0)
+				{
+					manager.SetComponent(entities[i], Position(i * 1.0f, 0.0f, 0.0f));
+				}
+				if (i % 3 == 0)
+				{
+					manager.SetComponent(entities[i], Velocity(1.0f, i * 1.0f, 0.0f));
+				}
+			}
+
+			auto& group = manager.RegisterGroup<Position, Velocity>();
+			Assert::IsTrue(&manager.RegisterGroup<Velocity, Position>() == &group);
+
+			// The members lead both containers, in the same order.
+			auto packed = [](EntityManager& manager, Group& group)
+			{
+				std::vector<EntityIndex> scanned;
+				manager.GetEntities(MakeFilter<Position, Velocity>(), OUT scanned);
+				Assert::IsTrue(group.Size() == scanned.size());
+
+				const auto& positions = manager.GetContainer<Position>().Owners();
+				const auto& velocities = manager.GetContainer<Velocity>().Owners();
+				for (std::size_t slot = 0; slot < group.Size(); ++slot)
+				{
+					Assert::IsTrue(positions[slot] == velocities[slot] && positions[slot] == group.Entities()[slot]);
+				}
+
+				for (auto entity : scanned)
+				{
+					Assert::IsTrue(group.Contains(entity));
+				}
+			};
+
+			packed(manager, group);
+			Assert::IsTrue(group.Size() == (100 * MANY + 5) / 6);
+
+			auto since = manager.NextVersion();
+			std::size_t visited = 0;
+			group.Each([&](EntityIndex entity, Position& position, const Velocity& velocity)
+			{
+				Assert::IsTrue(position.x == entity && velocity.y == entity);
+				position.x += velocity.x;
+				++visited;
+			});
+			Assert::IsTrue(visited == group.Size());
+			Assert::IsTrue(manager.GetComponent<Position>(entities[6]).x == 7.0f);
+
+			std::size_t changed = 0;
+			manager.Each<Changed<Position>>(since, [&](EntityIndex, const Position&) { ++changed; });
+			Assert::IsTrue(changed == group.Size());
+
+			std::function<void()> each = [&] { group.Each([](Position& position, const Velocity& velocity) { position.x += velocity.x; }); };
+			Measure(each, "Group::Each over 100 * MANY / 6 grouped entities");
+			std::function<void()> filtered = [&] { manager.Each([](Position& position, const Velocity& velocity) { position.x += velocity.x; }); };
+			Measure(filtered, "EntityManager::Each over the same entities");
+
+			// Members leave when a component goes, with the entity or alone.
+			std::vector<EntityIndex> destroyed;
+			for (std::size_t i = 0; i + 12 <= entities.size(); i += 12)
+			{
+				manager.RemoveComponent<Velocity>(entities[i]);
+				manager.SetComponent(entities[i + 1], Position(0.0f, 0.0f, 0.0f));
+				manager.SetComponent(entities[i + 1], Velocity(0.0f, 0.0f, 0.0f));
+				destroyed.push_back(entities[i + 6]);
+			}
+			manager.DestroyEntities(destroyed);
+			manager.DestroyEntity(entities[3]);
+			packed(manager, group);
+
+			std::vector<EntityIndex> more;
+			manager.CreateEntities(MANY, OUT more, 7, Position(), Velocity());
+			packed(manager, group);
+			Assert::IsTrue(group.Contains(more.back()));
+
+			UsedComponents<EntityState, int, Sparse<Position>, Sparse<Velocity>> sameComponents;
+			EntityManager replica(sameComponents);
+			auto& replicaGroup = replica.RegisterGroup<Position, Velocity>();
+			DeltaEncoder encoder;
+			DeltaDecoder decoder;
+			std::vector<std::byte> delta;
+			Assert::IsTrue(encoder.Encode(manager, OUT delta) && decoder.Apply(replica, delta));
+			packed(replica, replicaGroup);
+
+			for (std::size_t i = 0; i < entities.size(); i += 24)
+			{
+				manager.RemoveComponent<Position>(entities[i + 1]);
+			}
+			delta.clear();
+			Assert::IsTrue(encoder.Encode(manager, OUT delta) && decoder.Apply(replica, delta));
+			packed(replica, replicaGroup);
+			Assert::IsTrue(replicaGroup.Size() == group.Size());
+
+			Assert::IsTrue(Snapshot::Save(manager, path));
+			EntityManager loaded(usedComponents);
+			auto& loadedGroup = loaded.RegisterGroup<Position, Velocity>();
+			Assert::IsTrue(Snapshot::Load(loaded, path, SnapshotLoad::Copy));
+			packed(loaded, loadedGroup);
+			Assert::IsTrue(loadedGroup.Size() == group.Size());
+			std::remove(path.c_str());
+
+			// Compaction moves members along with their entities.
+			std::vector<EntityMove> moves;
+			Assert::IsTrue(Compactor(manager, CompactionOrder::Signature).Run(OUT moves));
+			packed(manager, group);
+		}
+
+		TEST_METHOD(TagsTakeNoStorage)
+		{
+			UsedComponents<EntityState, int, Frozen, Sparse<Visible>> usedComponents;
+			const std::string path = "TagsTakeNoStorage.snapshot";
+
+			for (auto mode : { StorageMode::Columns, StorageMode::Archetypes })
+			{
+				EntityManager manager(usedComponents, mode);
+				std::vector<EntityIndex> entities;
+				manager.CreateEntities(MANY, OUT entities, 1, Frozen());
+				for (std::size_t i = 0; i < entities.size(); i += 2)
+				{
+					manager.SetComponent(entities[i], Visible());
+				}
+				manager.RemoveComponent<Frozen>(entities[0]);
+
+				Assert::IsFalse(manager.HasComponent<Frozen>(entities[0]));
+				Assert::IsTrue(manager.HasComponent<Frozen>(entities[2]) && manager.HasComponent<Visible>(entities[2]));
+				Assert::IsFalse(manager.HasComponent<Visible>(entities[1]));
+
+				std::size_t visited = 0;
+				manager.Each([&](EntityIndex entity, int& value, const Frozen&, const Visible&)
+				{
+					Assert::IsTrue(entity % 2 == 0 && entity != entities[0]);
+					value += 1;
+					++visited;
+				});
+				Assert::IsTrue(visited == MANY / 2 - 1);
+				Assert::IsTrue(manager.GetComponent<int>(entities[2]) == 2);
+
+				std::vector<EntityIndex> more;
+				manager.CreateEntities<int, Visible>(MANY, OUT more, [](std::size_t i, int& value, Visible&) { value = int(i); });
+				Assert::IsTrue(manager.HasComponent<Visible>(more.back()) && manager.GetComponent<int>(more.back()) == MANY - 1);
+
+				// Only int has a container, and liveness lives in the signature.
+				auto stats = manager.ContainerStatistics();
+				Assert::IsTrue(stats.size() == 1 && stats.front().id == GetComponentID<int>());
+				Assert::IsTrue(manager.GetComponent<EntityState>(entities[3]) == EntityState::Active);
+				manager.DestroyEntity(entities[3]);
+				Assert::IsTrue(manager.GetComponent<EntityState>(entities[3]) == EntityState::Destroyed);
+			}
+
+			EntityManager original(usedComponents);
+			EntityManager replica(usedComponents);
+			std::vector<EntityIndex> entities;
+			original.CreateEntities(MANY / 3 * 3, OUT entities, 3, Frozen());
+			for (std::size_t i = 0; i < entities.size(); i += 3)
+			{
+				original.SetComponent(entities[i], Visible());
+				original.RemoveComponent<Frozen>(entities[i + 1]);
+			}
+
+			DeltaEncoder encoder;
+			DeltaDecoder decoder;
+			std::vector<std::byte> delta;
+			Assert::IsTrue(encoder.Encode(original, OUT delta) && decoder.Apply(replica, delta));
+			original.RemoveComponent<Visible>(entities[3]);
+			original.SetComponent(entities[4], 4);
+			delta.clear();
+			Assert::IsTrue(encoder.Encode(original, OUT delta) && decoder.Apply(replica, delta));
+
+			Assert::IsTrue(Snapshot::Save(original, path));
+			EntityManager loaded(usedComponents);
+			Assert::IsTrue(Snapshot::Load(loaded, path));
+			std::remove(path.c_str());
+
+			for (auto copy : { &replica, &loaded })
+			{
+				for (std::size_t i = 0; i < entities.size(); ++i)
+				{
+					Assert::IsTrue(copy->HasComponent<Frozen>(entities[i]) == (i % 3 != 1));
+					Assert::IsTrue(copy->HasComponent<Visible>(entities[i]) == (i % 3 == 0 && i != 3));
+				}
+				Assert::IsTrue(copy->GetComponent<int>(entities[4]) == 4);
+			}
+		}
+
+		TEST_METHOD(MoveOnlyComponentsAreReleasedOnRemove)
+		{
+			using Owned = std::unique_ptr<int>;
+			UsedComponents<EntityState, Position, Buffer, Sparse<Owned>> usedComponents;
+
+			for (auto mode : { StorageMode::Columns, StorageMode::Archetypes })
+			{
+				EntityManager manager(usedComponents, mode);
+				auto first = manager.CreateEntity();
+				auto second = manager.CreateEntity();
+
+				manager.EmplaceComponent<Buffer>(first, 16);
+				manager.SetComponent(second, Buffer(8));
+				manager.EmplaceComponent<Owned>(second, new int(5));
+				Assert::IsTrue(Buffer::live == 2);
+
+				// Lvalues are copied.
+				Position position(1.0f, 2.0f, 3.0f);
+				manager.SetComponent(first, position);
+				manager.SetComponent(first, position);
+				Assert::IsTrue(manager.GetComponent<Position>(first).y == 2.0f);
+
+				// Emplacing again replaces the component, setting moves over it.
+				manager.EmplaceComponent<Buffer>(first, 32);
+				manager.SetComponent(second, Buffer(4));
+				Assert::IsTrue(Buffer::live == 2);
+				std::size_t sizes = 0;
+				manager.Each([&](const Buffer& buffer) { sizes += buffer.size; });
+				Assert::IsTrue(sizes == 36);
+
+				manager.RemoveComponent<Buffer>(first);
+				Assert::IsTrue(Buffer::live == 1);
+				manager.DestroyEntity(second);
+				Assert::IsTrue(Buffer::live == 0);
+
+				auto third = manager.CreateEntityWithComponents<Buffer, Owned, Position>(Buffer(2), Owned(new int(7)), position);
+				Assert::IsTrue(Buffer::live == 1);
+				std::size_t visited = 0;
+				manager.Each([&](EntityIndex entity, const Buffer& buffer, const Owned& owned, const Position& position)
+				{
+					Assert::IsTrue(entity == third && buffer.size == 2 && *owned == 7 && position.z == 3.0f);
+					++visited;
+				});
+				Assert::IsTrue(visited == 1);
+
+				ThreadPool pool(1);
+				CommandQueue commands(manager, pool);
+				commands.Buffer(0).SetComponent(third, Buffer(64));
+				commands.Buffer(0).SetComponent(first, Owned(new int(9)));
+				commands.Playback();
+				Assert::IsTrue(Buffer::live == 1);
+				int owned = 0;
+				manager.Each([&](const Owned& value) { owned += *value; });
+				Assert::IsTrue(owned == 16);
+			}
+
+			Assert::IsTrue(Buffer::live == 0);
+		}
+
+		TEST_METHOD(HierarchiesPropagateParentsFirst)
+		{
+			UsedComponents<EntityState, int, Sparse<LocalOffset>, Sparse<WorldOffset>> usedComponents;
+			EntityManager manager(usedComponents);
+
+			// A tree of 4 children per node, numbered breadth-first, scattered over
+			// the entity indices.
+			constexpr std::size_t count = 100 * MANY;
+			std::vector<EntityIndex> entities;
+			manager.CreateEntities(count, OUT entities, LocalOffset{ 1.0f }, WorldOffset());
+			std::vector<EntityIndex> nodes(count);
+			for (std::size_t node = 0; node < count; ++node)
+			{
+				nodes[node] = entities[node * 7919 % count];
+			}
+
+			Hierarchy tree(manager, manager.RegisterGroup<LocalOffset, WorldOffset>());
+			for (std::size_t node = 1; node < count; ++node)
+			{
+				Assert::IsTrue(tree.SetParent(nodes[node], nodes[(node - 1) / 4]));
+			}
+			Assert::IsFalse(tree.SetParent(nodes[0], nodes[21]));
+			Assert::IsFalse(tree.SetParent(nodes[5], nodes[5]));
+			Assert::IsTrue(tree.Parent(nodes[21]) == manager.GetHandle(nodes[5]));
+			Assert::IsTrue(tree.Parent(nodes[0]) == EntityHandle());
+
+			auto propagate = [](const WorldOffset* parent, WorldOffset& world, const LocalOffset& local)
+			{
+				world.x = (parent != nullptr ? parent->x : 0.0f) + local.x;
+			};
+
+			auto since = manager.NextVersion();
+			tree.Propagate<WorldOffset, const LocalOffset>(propagate);
+			Assert::IsTrue(tree.LevelCount() == 10);
+
+			auto& group = manager.RegisterGroup<LocalOffset, WorldOffset>();
+			const auto& slots = manager.GetContainer<WorldOffset>();
+			for (std::size_t slot = 0; slot < group.Size(); ++slot)
+			{
+				auto parent = tree.Parent(group.Entities()[slot]);
+				Assert::IsTrue(parent == EntityHandle() || slots.PackedSlot(parent.Index()) < slot);
+			}
+
+			for (std::size_t node = 0, depth = 0, levelEnd = 1; node < count; ++node)
+			{
+				if (node == levelEnd)
+				{
+					++depth;
+					levelEnd = levelEnd * 4 + 1;
+				}
+				Assert::IsTrue(tree.Depth(nodes[node]) == depth);
+				Assert::IsTrue(manager.GetComponent<WorldOffset>(nodes[node]).x == depth + 1.0f);
+			}
+
+			std::size_t changed = 0;
+			manager.Each<Changed<WorldOffset>>(since, [&](EntityIndex, const WorldOffset&) { ++changed; });
+			Assert::IsTrue(changed == count);
+
+			// Children of a destroyed parent become roots; the last node was under
+			// nodes[1], so it is two levels higher, and nodes[2] moves below it.
+			manager.DestroyEntity(nodes[1]);
+			Assert::IsTrue(tree.SetParent(nodes[2], nodes[count - 1]));
+			manager.Each([](WorldOffset& world) { world.x = 0.0f; });
+
+			ThreadPool pool(4);
+			tree.ParallelPropagate<WorldOffset, const LocalOffset>(pool, propagate, 64);
+			Assert::IsTrue(tree.Parent(nodes[5]) == EntityHandle());
+			Assert::IsTrue(manager.GetComponent<WorldOffset>(nodes[5]).x == 1.0f);
+			Assert::IsTrue(manager.GetComponent<WorldOffset>(nodes[21]).x == 2.0f);
+			Assert::IsTrue(manager.GetComponent<WorldOffset>(nodes[2]).x == 9.0f);
+			Assert::IsTrue(manager.GetComponent<WorldOffset>(nodes[9]).x == 10.0f);
+			Assert::IsTrue(manager.GetComponent<WorldOffset>(nodes[3]).x == 2.0f);
+
+			std::function<void()> sweep = [&] { tree.Propagate<WorldOffset, const LocalOffset>(propagate); };
+			Measure(sweep, "Hierarchy::Propagate over 100 * MANY nodes");
+			std::function<void()> parallel = [&] { tree.ParallelPropagate<WorldOffset, const LocalOffset>(pool, propagate); };
+			Measure(parallel, "Hierarchy::ParallelPropagate over 100 * MANY nodes");
+			std::function<void()> reorder = [&] { tree.ClearParent(nodes[3]); tree.Update(); };
+			Measure(reorder, "Hierarchy::Update after a link changed");
+		}
+
+		TEST_METHOD(SpatialGridsMatchBruteForce)
+		{
+			UsedComponents<EntityState, int, Position> usedComponents;
+
+			for (auto mode : { StorageMode::Columns, StorageMode::Archetypes })
+			{
+				EntityManager manager(usedComponents, mode);
+				std::vector<EntityIndex> entities;
+				manager.CreateEntities<Position>(10 * MANY, OUT entities, [](std::size_t i, Position& position)
+				{
+					position = Position(float(i * 7919 % 1000), float(i * 104729 % 1000), float(i % 7));
+				});
+
+				SpatialGrid<Position> grid(manager, 25.0f);
+				grid.Update();
+				Assert::IsTrue(grid.Size() == entities.size());
+
+				auto check = [&](const Position& center, float radius)
+				{
+					std::vector<EntityIndex> expected;
+					manager.Each([&](EntityIndex entity, const Position& position)
+					{
+						auto dx = position.x - center.x, dy = position.y - center.y, dz = position.z - center.z;
+						if (dx * dx + dy * dy + dz * dz <= radius * radius)
+						{
+							expected.push_back(entity);
+						}
+					});
+					std::sort(expected.begin(), expected.end());
+
+					std::vector<EntityIndex> found;
+					grid.QueryRadius(center, radius, OUT found);
+					Assert::IsTrue(found == expected);
+				};
+
+				check(Position(500.0f, 500.0f, 3.0f), 60.0f);
+				check(Position(0.0f, 990.0f, 0.0f), 100.0f);
+				check(Position(-50.0f, -50.0f, 0.0f), 5000.0f);
+
+				// Only moved, removed and destroyed entities are looked at again.
+				for (std::size_t i = 0; i < entities.size(); i += 10)
+				{
+					manager.SetComponent(entities[i], Position(500.0f + i % 50, 500.0f, 0.0f));
+					manager.RemoveComponent<Position>(entities[i + 1]);
+				}
+				manager.DestroyEntity(entities[2]);
+				manager.CreateEntityWithComponents<Position>(Position(510.0f, 510.0f, 0.0f));
+				grid.Update();
+				// One destroyed, one created.
+				Assert::IsTrue(grid.Size() == entities.size() - entities.size() / 10);
+
+				check(Position(500.0f, 500.0f, 3.0f), 60.0f);
+				check(Position(525.0f, 500.0f, 0.0f), 0.5f);
+
+				std::vector<EntityIndex> boxed;
+				grid.QueryBox(Position(500.0f, 500.0f, 0.0f), Position(509.0f, 500.0f, 0.0f), OUT boxed);
+				Assert::IsTrue(boxed.size() == 10 * (entities.size() / 500));
+
+				if (mode == StorageMode::Columns)
+				{
+					std::function<void()> update = [&]
+					{
+						for (std::size_t i = 0; i < entities.size(); i += 100)
+						{
+							manager.SetComponent(entities[i + 3], Position(float(i % 1000), 0.0f, 0.0f));
+						}
+						grid.Update();
+					};
+					Measure(update, "SpatialGrid::Update with 1% of 10 * MANY positions moved");
+
+					std::vector<EntityIndex> nearby;
+					std::function<void()> queries = [&]
+					{
+						for (std::size_t i = 0; i < MANY; ++i)
+						{
+							grid.QueryRadius(Position(float(i), float(i), 3.0f), 25.0f, OUT nearby);
+						}
+					};
+					Measure(queries, "SpatialGrid::QueryRadius, MANY queries");
+				}
+			}
+		}
+
+		TEST_METHOD(ObserversReceiveBatchedChanges)
+		{
+			UsedComponents<EntityState, int, Position, Sparse<Velocity>> usedComponents;
+
+			for (auto mode : { StorageMode::Columns, StorageMode::Archetypes })
+			{
+				EntityManager manager(usedComponents, mode);
+				std::vector<EntityIndex> entities;
+				manager.CreateEntities(10, OUT entities, 0);
+				manager.SetComponent(entities[0], Position());
+				manager.SetComponent(entities[0], Velocity());
+
+				std::vector<std::vector<EntityIndex>> matched, unmatched, added, removed;
+				auto into = [](std::vector<std::vector<EntityIndex>>& batches)
+				{
+					return [&batches](const EntityIndex* entities, std::size_t count) { batches.emplace_back(entities, entities + count); };
+				};
+				manager.Observe(MakeFilter<Position, Velocity>(), into(matched), into(unmatched));
+				manager.OnAdded<Position>(into(added));
+				manager.OnRemoved<Velocity>(into(removed));
+
+				for (std::size_t i = 1; i <= 5; ++i)
+				{
+					manager.SetComponent(entities[i], Position());
+					manager.SetComponent(entities[i], Velocity());
+				}
+				manager.RemoveComponent<Velocity>(entities[2]);
+				manager.SetComponent(entities[6], Position());
+				manager.RemoveComponent<Position>(entities[6]);
+				manager.DestroyEntity(entities[3]);
+				Assert::IsTrue(matched.empty());
+
+				// Entities matching on registration count, come and gone ones don't.
+				manager.FlushObservers();
+				Assert::IsTrue(matched == std::vector<std::vector<EntityIndex>>{ { 0, 1, 4, 5 } } && unmatched.empty());
+				Assert::IsTrue(added == std::vector<std::vector<EntityIndex>>{ { 0, 1, 2, 4, 5 } } && removed.empty());
+
+				manager.FlushObservers();
+				Assert::IsTrue(matched.size() == 1 && added.size() == 1);
+
+				// A reused index stops and starts matching.
+				manager.DestroyEntity(entities[1]);
+				auto reused = manager.CreateEntityWithComponents<Position, Velocity>(Position(), Velocity());
+				Assert::IsTrue(reused == entities[1]);
+				manager.RemoveComponent<Velocity>(entities[0]);
+				manager.FlushObservers();
+				Assert::IsTrue(unmatched.back() == std::vector<EntityIndex>({ 0, 1 }));
+				Assert::IsTrue(matched.back() == std::vector<EntityIndex>({ 1 }));
+				Assert::IsTrue(removed.back() == std::vector<EntityIndex>({ 0, 1 }));
+
+				// What callbacks change is reported by the next flush.
+				std::vector<EntityIndex> destroyed;
+				manager.OnRemoved<Position>([&](const EntityIndex* entities, std::size_t count)
+				{
+					for (std::size_t i = 0; i < count; ++i)
+					{
+						destroyed.push_back(entities[i]);
+						manager.DestroyEntity(entities[i] + 1);
+					}
+				});
+				manager.FlushObservers();
+				manager.RemoveComponent<Position>(entities[4]);
+				manager.FlushObservers();
+				Assert::IsTrue(destroyed == std::vector<EntityIndex>({ 4 }));
+				Assert::IsTrue(unmatched.back() == std::vector<EntityIndex>({ 4 }));
+				manager.FlushObservers();
+				Assert::IsTrue(unmatched.back() == std::vector<EntityIndex>({ 5 }));
+				Assert::IsTrue(destroyed == std::vector<EntityIndex>({ 4, 5 }));
+			}
+
+			EntityManager manager(usedComponents);
+			std::vector<EntityIndex> entities;
+			manager.CreateEntities(100 * MANY, OUT entities, 0);
+			std::size_t reported = 0;
+			manager.OnAdded<Velocity>([&](const EntityIndex*, std::size_t count) { reported += count; });
+			std::function<void()> flush = [&]
+			{
+				for (std::size_t i = 0; i < entities.size(); i += 10)
+				{
+					manager.SetComponent(entities[i], Velocity());
+				}
+				manager.FlushObservers();
+			};
+			Measure(flush, "Adding Velocity to 10 * MANY entities and flushing an observer");
+			Assert::IsTrue(reported == 10 * MANY);
+		}
+
 	private:
 		void Measure(std::function<void()> func, const std::string& name)
 		{